@@ -0,0 +1,106 @@
+/**
+ * @file adbms_chain.h
+ * @brief The isoSPI chain of the pack, on SPI1 and its transaction engine, and decoding of its responses.
+ *
+ * Reads of the ADC code registers are queued on the chain, put on the wire as one batch, then decoded into
+ * the pack's chips.  Every other command goes through the driver, on the same port and chip select.
+ *
+ * The whole pack is one daisy chain.  Splitting it across SPI ports would need every command, not just these
+ * reads, sent per port, and DMA channels for the other ports.
+ */
+
+#ifndef _ADBMS_CHAIN_H
+#define _ADBMS_CHAIN_H
+
+#include "adbms_spi.h"
+#include "adBms6830Data.h"
+
+/**
+ * @brief The chain of ICs behind the SPI port, and the reads queued on it.
+ */
+typedef struct {
+	adbms_spi_t *spi;
+	uint8_t num_chips;
+	/* responses of every queued read, back to back */
+	uint8_t rx[ADBMS_SPI_MAX_RESPONSE];
+	uint16_t used;
+	uint8_t count;
+	struct {
+		TYPE type;
+		GRP group;
+		uint16_t offset;
+		uint16_t ic_bytes;
+	} reads[ADBMS_SPI_QUEUE_LEN];
+} adbms_chain_t;
+
+/**
+ * @brief Bind a chain to its engine.
+ *
+ * @param chain Chain to bind.
+ * @param spi Engine of the chain's port, set up for num_chips.
+ * @param num_chips Number of ICs in the chain.
+ */
+void adbms_chain_bind(adbms_chain_t *chain, adbms_spi_t *spi,
+		      uint8_t num_chips);
+
+/**
+ * @brief Get the number of bytes each IC shifts for a register access, including PEC.
+ *
+ * @param type Register type accessed.
+ * @return uint16_t Bytes per IC in the frame.
+ */
+uint16_t adbms_register_frame_bytes(TYPE type);
+
+/**
+ * @brief Check if chain reads can decode a register type.  Only the ADC code registers are decoded,
+ * everything else goes through the driver.
+ *
+ * @param type Register type.
+ * @return true if the type can be queued with adbms_chain_queue_read().
+ */
+bool adbms_chain_decodes(TYPE type);
+
+/**
+ * @brief Queue a register read on the chain.
+ *
+ * @param chain Chain to queue on.
+ * @param cmd Read command.
+ * @param type Register type to read.
+ * @param group Group read, ALL_GRP for an ALL command.
+ * @return 0 if queued, -1 if the type is not decoded or the queue is full.
+ */
+int adbms_chain_queue_read(adbms_chain_t *chain, uint8_t cmd[2], TYPE type,
+			   GRP group);
+
+/**
+ * @brief Queue a bare command on the chain.
+ *
+ * @param chain Chain to queue on.
+ * @param cmd Command to send.
+ * @return 0 if queued, -1 if the queue is full.
+ */
+int adbms_chain_queue_cmd(adbms_chain_t *chain, uint8_t cmd[2]);
+
+/**
+ * @brief Put the queued reads on the wire, sleep until they are back, then decode them into the chips.
+ *
+ * A failed transfer or PEC10 mismatch is counted as a PEC error of that chip, same as the driver does.
+ *
+ * @param chain Chain to run.
+ * @param chips Chips of the chain.
+ * @param failed Set to a bit per chip that failed, for each read in queue order.  NULL if not needed.
+ * @return 0 on success, -1 if the transfer failed.
+ */
+int adbms_chain_run(adbms_chain_t *chain, cell_asic chips[NUM_CHIPS],
+		    uint32_t failed[ADBMS_SPI_QUEUE_LEN]);
+
+#ifndef ADBMS_SPI_MOCK
+/**
+ * @brief Get the chain of the pack, binding it to its port on first use.
+ *
+ * @return adbms_chain_t* The chain, or NULL if the port could not be set up.
+ */
+adbms_chain_t *adbms_pack_chain(void);
+#endif
+
+#endif
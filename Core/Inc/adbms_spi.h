@@ -0,0 +1,232 @@
+/**
+ * @file adbms_spi.h
+ * @brief Non-blocking transaction engine for the ADBMS6830 isoSPI chain.
+ *
+ * Callers queue command/response descriptors, then run the queue.  Frames are
+ * chained from the transfer complete interrupt, and the calling thread sleeps
+ * on a semaphore until the whole queue is on the wire and back.
+ *
+ * The engine only moves bytes and computes PEC, it does not know about the
+ * register layout.  The transport is supplied as a backend, so the queueing
+ * logic can run against a mock backend off target (build with ADBMS_SPI_MOCK),
+ * as the host tests in Tests/ do.
+ */
+
+#ifndef _ADBMS_SPI_H
+#define _ADBMS_SPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bms_config.h"
+
+#ifndef ADBMS_SPI_MOCK
+#include "tx_api.h"
+#include "stm32h5xx_hal.h"
+#endif
+
+/* Bytes on the wire per frame: 2 command + 2 PEC15, then per IC data + 2 PEC10 */
+#define CMD_FRAME_BYTES		 4
+#define REG_GROUP_FRAME_BYTES	 8
+/* RDCVALL, RDACALL, RDSALL, RDFCALL */
+#define RDALL_CELL_FRAME_BYTES	 34
+/* RDCSALL, RDACSALL */
+#define RDALL_CELL_S_FRAME_BYTES 66
+#define RDASALL_FRAME_BYTES	 70
+
+/* Maximum number of descriptors that can be queued before running */
+#define ADBMS_SPI_QUEUE_LEN 8
+/* Largest response of a chain to a single command, a chain is at most the whole pack */
+#define ADBMS_SPI_MAX_RESPONSE ((NUM_CHIPS) * RDASALL_FRAME_BYTES)
+/* Ticks to wait for a queue to complete before aborting it */
+#define ADBMS_SPI_TIMEOUT_TICKS 10
+/* NVIC priority of the chain's SPI and DMA interrupts, their callbacks put a semaphore so they must not
+ * preempt the kernel */
+#define ADBMS_SPI_IRQ_PRIORITY 5
+
+/**
+ * @brief Transport used by the engine.  Both functions may be called from interrupt context.
+ */
+typedef struct {
+	/**
+	 * @brief Start a transfer, and call adbms_spi_transfer_done() when it completes.
+	 *
+	 * @param ctx Backend context.
+	 * @param tx Bytes to send.
+	 * @param rx Buffer to receive into, NULL for a transmit only transfer.
+	 * @param len Number of bytes to transfer.
+	 * @return 0 if the transfer was started, -1 otherwise.
+	 */
+	int (*transfer)(void *ctx, const uint8_t *tx, uint8_t *rx,
+			uint16_t len);
+	/**
+	 * @brief Drive the chip select of the chain.
+	 *
+	 * @param ctx Backend context.
+	 * @param asserted true to pull CS low.
+	 */
+	void (*select)(void *ctx, bool asserted);
+	/**
+	 * @brief Abort the transfer in progress, after a timeout.  Optional.
+	 *
+	 * @param ctx Backend context.
+	 */
+	void (*abort)(void *ctx);
+	void *ctx;
+} adbms_spi_backend_t;
+
+/**
+ * @brief A single command on the chain, optionally followed by a response from every IC.
+ */
+typedef struct {
+	/* command and its PEC15, built when queued */
+	uint8_t cmd[CMD_FRAME_BYTES];
+	/* num_chips * ic_bytes buffer for the response, NULL for a bare command */
+	uint8_t *rx;
+	/* bytes each IC responds with, including PEC10 */
+	uint16_t ic_bytes;
+} adbms_spi_desc_t;
+
+typedef struct adbms_spi adbms_spi_t;
+
+/**
+ * @brief Initialize an engine on a backend.  Call from thread context.
+ *
+ * @param spi Engine to initialize.
+ * @param backend Transport the engine drives, copied.
+ * @param num_chips Number of ICs in the chain behind the backend.
+ * @param name Name of the completion semaphore.
+ * @return 0 on success, -1 on failure.
+ */
+int adbms_spi_init(adbms_spi_t *spi, const adbms_spi_backend_t *backend,
+		   uint8_t num_chips, char *name);
+
+/**
+ * @brief Queue a bare command, such as an ADC start.
+ *
+ * @param spi Engine to queue on.
+ * @param cmd 2 byte command.
+ * @return 0 on success, -1 if the queue is full.
+ */
+int adbms_spi_queue_cmd(adbms_spi_t *spi, const uint8_t cmd[2]);
+
+/**
+ * @brief Queue a register read.  Each IC's response lands at rx + chip * ic_bytes.
+ *
+ * @param spi Engine to queue on.
+ * @param cmd 2 byte read command.
+ * @param rx Buffer of at least num_chips * ic_bytes.
+ * @param ic_bytes Bytes each IC responds with, including PEC10.
+ * @return 0 on success, -1 if the queue is full.
+ */
+int adbms_spi_queue_read(adbms_spi_t *spi, const uint8_t cmd[2], uint8_t *rx,
+			 uint16_t ic_bytes);
+
+/**
+ * @brief Put everything queued on the wire, and sleep until it is done.  Clears the queue.
+ *
+ * @param spi Engine to run.
+ * @return 0 on success, -1 on a transfer error or timeout.
+ */
+int adbms_spi_run(adbms_spi_t *spi);
+
+/**
+ * @brief Report completion of the transfer started by the backend.  Interrupt safe.
+ *
+ * @param spi Engine the transfer belongs to.
+ * @param ok false if the transfer failed.
+ */
+void adbms_spi_transfer_done(adbms_spi_t *spi, bool ok);
+
+/**
+ * @brief Get the number of descriptors waiting to be run.
+ *
+ * @param spi Engine to check.
+ * @return uint8_t Queued descriptors.
+ */
+uint8_t adbms_spi_queued(const adbms_spi_t *spi);
+
+/**
+ * @brief Calculate the PEC15 of a command.
+ *
+ * @param data Bytes to calculate over.
+ * @param len Number of bytes.
+ * @return uint16_t The PEC15, already shifted into the 16 bits sent on the wire.
+ */
+uint16_t adbms_pec15(const uint8_t *data, uint8_t len);
+
+/**
+ * @brief Check the PEC10 of one IC's response, including the command counter bits.
+ *
+ * @param ic_data Response of one IC, data followed by 2 PEC bytes.
+ * @param ic_bytes Length of the response including PEC.
+ * @return true if the PEC matches.
+ */
+bool adbms_pec10_check(const uint8_t *ic_data, uint16_t ic_bytes);
+
+/**
+ * @brief Calculate the PEC10 of data read from an IC.
+ *
+ * @param data Data bytes, followed by the byte holding the 6 bit command counter.
+ * @param len Number of data bytes, excluding the counter byte.
+ * @return uint16_t The 10 bit PEC.
+ */
+uint16_t adbms_pec10(const uint8_t *data, uint16_t len);
+
+struct adbms_spi {
+	adbms_spi_backend_t backend;
+	adbms_spi_desc_t queue[ADBMS_SPI_QUEUE_LEN];
+	/* ICs in the chain, each answers a read with ic_bytes */
+	uint8_t num_chips;
+	/* descriptors queued, and the one on the wire */
+	uint8_t count;
+	uint8_t current;
+	/* true while the response of the current descriptor is being clocked in */
+	bool data_phase;
+	volatile bool busy;
+	volatile bool failed;
+#ifndef ADBMS_SPI_MOCK
+	TX_SEMAPHORE done;
+#endif
+};
+
+#ifndef ADBMS_SPI_MOCK
+/**
+ * @brief Get the engine of the chain, creating it with a DMA backend on the chain's SPI peripheral on
+ * first use.  There is one chain, so one engine.
+ *
+ * The SPI handle must have its hdmatx and hdmarx channels linked.
+ *
+ * @param hspi SPI handle of the chain.
+ * @return adbms_spi_t* The engine, or NULL if it could not be created or is bound to another port.
+ */
+adbms_spi_t *adbms_spi_get(SPI_HandleTypeDef *hspi);
+#else
+/**
+ * @brief Simulated chain that answers every read from a register image.  Every transfer completes
+ * synchronously, before the backend returns.
+ */
+typedef struct {
+	adbms_spi_t *spi;
+	/* data each IC answers with, PEC10 is appended on the fly */
+	uint8_t regs[NUM_CHIPS][RDASALL_FRAME_BYTES - 2];
+	/* last command frame seen, and the number of frames seen */
+	uint8_t last_cmd[CMD_FRAME_BYTES];
+	uint16_t cmds_seen;
+	/* chip whose PEC is corrupted on the next read, -1 for none */
+	int8_t corrupt_chip;
+	bool selected;
+} adbms_spi_mock_t;
+
+/**
+ * @brief Initialize an engine on a simulated chain.
+ *
+ * @param mock Simulated chain to initialize.
+ * @param spi Engine to bind to it.
+ * @param num_chips Number of ICs in the chain.
+ * @return 0 on success, -1 on failure.
+ */
+int adbms_spi_mock_init(adbms_spi_mock_t *mock, adbms_spi_t *spi,
+			uint8_t num_chips);
+#endif
+
+#endif
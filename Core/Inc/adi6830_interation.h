@@ -5,6 +5,161 @@
 #include "stm32h5xx_hal.h"
 #include "bms_config.h"
 #include "can_messages.h"
+#include "adbms_spi.h"
+#include "adbms_chain.h"
+
+/* isoSPI port goes idle after tIDLE (4.3ms min) without a CS edge, and needs a wake pulse */
+#define ISOSPI_IDLE_TIMEOUT_US 4300
+/* margin subtracted from tIDLE to cover the time between the check and the next CS edge */
+#define ISOSPI_WAKE_MARGIN_US 500
+/* core goes to sleep after tSLEEP (1.8s min) without a valid command, resetting the registers */
+#define CORE_SLEEP_TIMEOUT_US 1800000
+
+/* Time budgeted for each ADC conversion, after which the result is read.  Tune against adbms_get_adc_stats() */
+#define ADC_CONV_C_US	 1200 /* ADCV, all 16 C-ADCs in parallel */
+#define ADC_CONV_S_US	 8500 /* ADSV, or ADCV with RD on, S-ADCs are multiplexed */
+#define ADC_CONV_AUX_US	 2000 /* ADAX, all GPIOs and references */
+#define ADC_CONV_AUX2_US 5000 /* ADAX2, redundant GPIO measurement */
+/* a conversion confirmed later than its budget plus this is counted as late */
+#define ADC_LATE_MARGIN_US 200
+
+/**
+ * @brief Counters describing isoSPI link usage, reset by the caller each acquisition cycle.
+ */
+typedef struct {
+	/* wake sequences actually sent on the chain */
+	uint32_t wakes_sent;
+	/* wakes skipped because the chain was still awake */
+	uint32_t wakes_skipped;
+	/* times the chain was idle long enough for the cores to sleep */
+	uint32_t sleep_timeouts;
+	/* frames sent on the chain, commands and register accesses */
+	uint32_t transactions;
+	/* bytes shifted on the chain, including PEC */
+	uint32_t bytes;
+	/* ALL reads that failed PEC and were re-read group by group */
+	uint32_t pec_fallbacks;
+	/* register groups re-read because a chip failed PEC */
+	uint32_t pec_retries;
+} adbms_link_stats_t;
+
+/* Reads per chip and register type the PEC error rate is taken over */
+#define PEC_WINDOW_READS 32
+
+/**
+ * @brief Register types tracked for PEC errors, one per PEC counter of the driver.
+ */
+typedef enum {
+	ADBMS_REG_CFG,
+	ADBMS_REG_CELL,
+	ADBMS_REG_ACELL,
+	ADBMS_REG_SCELL,
+	ADBMS_REG_FCELL,
+	ADBMS_REG_AUX,
+	ADBMS_REG_RAUX,
+	ADBMS_REG_STAT,
+	ADBMS_REG_COMM,
+	ADBMS_REG_PWM,
+	ADBMS_REG_SID,
+	ADBMS_REGS
+} adbms_reg_t;
+
+/**
+ * @brief Quality of the isoSPI link over the last PEC_WINDOW_READS reads of every register, for telemetry.
+ */
+typedef struct {
+	/* bit per chip holding data that still failed PEC after every retry */
+	uint32_t stale_chips;
+	/* PEC errors per 10000 reads, over every chip and register */
+	uint16_t pack_error_rate;
+	/* chip with the highest error rate on any of its registers, and that rate */
+	uint8_t worst_chip;
+	uint16_t worst_error_rate;
+	/* register groups re-read since boot, and re-reads that ran out of retries */
+	uint32_t retries;
+	uint32_t exhausted;
+} adbms_link_quality_t;
+
+/**
+ * @brief ADC conversions known to the scheduler, each with its own conversion budget.
+ */
+typedef enum {
+	ADBMS_ADC_C,
+	ADBMS_ADC_S,
+	ADBMS_ADC_AUX,
+	ADBMS_ADC_AUX2,
+	ADBMS_ADC_MODES
+} adbms_adc_mode_t;
+
+/**
+ * @brief Latency of one ADC mode, from the start command to the result being confirmed ready.
+ */
+typedef struct {
+	uint32_t conversions;
+	uint32_t last_us;
+	uint32_t min_us;
+	uint32_t max_us;
+	/* sum of all latencies, divide by conversions for the mean */
+	uint64_t total_us;
+	/* conversions that were not done by their budget */
+	uint32_t late;
+} adbms_adc_stats_t;
+
+// --- BEGIN LINK HELPERS ---
+
+/**
+ * @brief Get a microsecond timestamp from the same timer used for isoSPI timing (TIM2).
+ * 
+ * @return uint32_t Timestamp in us, wraps.
+ */
+uint32_t adbms_get_us(void);
+
+/**
+ * @brief Wake the isoSPI of the daisy chain, only if it could have gone idle since the last transaction.
+ * 
+ * @param hspi SPI handle of the chain
+ */
+void adbms_wake_isospi(SPI_HandleTypeDef *hspi);
+
+/**
+ * @brief Copy out the isoSPI link counters.
+ * 
+ * @param stats Struct to copy the counters into
+ */
+void adbms_get_link_stats(adbms_link_stats_t *stats);
+
+/**
+ * @brief Zero the isoSPI link counters.
+ * 
+ */
+void adbms_reset_link_stats(void);
+
+/**
+ * @brief Get the PEC error rate of one register type of a chip, over its last PEC_WINDOW_READS reads.
+ * 
+ * @param chip Chip to get the rate of.
+ * @param reg Register type.
+ * @return uint16_t PEC errors per 10000 reads.
+ */
+uint16_t adbms_get_pec_error_rate(uint8_t chip, adbms_reg_t reg);
+
+/**
+ * @brief Get the register types of a chip holding stale data.  A register group is stale when its last read
+ * failed PEC on every retry, and is fresh again once it reads clean.
+ * 
+ * @param chip Chip to check.
+ * @return uint16_t Bit per adbms_reg_t with a stale group.
+ */
+uint16_t adbms_get_stale_regs(uint8_t chip);
+
+/**
+ * @brief Summarize the link quality of the whole pack.
+ * 
+ * @param quality Struct to fill.
+ */
+void adbms_get_link_quality(adbms_link_quality_t *quality);
+
+// --- END LINK HELPERS ---
 
 // --- BEGIN SET HELPERS ---
 
@@ -193,6 +348,12 @@ void snap_chips(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
  * @param chips 
  */
 void unsnap_chips(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
+/**
+ * @brief Clear the cell over and under voltage flags, so the next read of them only has later conversions
+ * 
+ * @param chips 
+ */
+void clear_ovuv_flags(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
 
 /**
  * @brief Write config registers. Wakes chips before writing.
@@ -213,7 +374,24 @@ void write_clear_flags(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
 // --- BEGIN READ COMMANDS ---
 
 /**
- * @brief Read all filtered voltage results A-E.  IIR must be on and ADC must be continous
+ * @brief Read all C voltage results with RDCVALL, falling back to groups A-E on PEC failure.
+ * 
+ * @param chips The chips to read voltages into
+ */
+void read_c_voltage_registers(cell_asic chips[NUM_CHIPS],
+			      SPI_HandleTypeDef *hspi);
+
+/**
+ * @brief Read all averaged voltage results with RDACALL, falling back to groups A-E on PEC failure.
+ * 
+ * @param chips The chips to read voltages into
+ */
+void read_average_voltage_registers(cell_asic chips[NUM_CHIPS],
+				    SPI_HandleTypeDef *hspi);
+
+/**
+ * @brief Read all filtered voltage results with RDFCALL, falling back to groups A-E on PEC failure.
+ * IIR must be on and ADC must be continous
  * 
  * @param chips The chips to read voltages into
  */
@@ -221,7 +399,7 @@ void read_filtered_voltage_registers(cell_asic chips[NUM_CHIPS],
 				     SPI_HandleTypeDef *hspi);
 
 /**
- * @brief Read all S voltage results A-E.  ADC must be continous.
+ * @brief Read all S voltage results with RDSALL, falling back to groups A-E on PEC failure.  ADC must be continous.
  * 
  * @param chips The chips to read the voltages into
  */
@@ -229,13 +407,20 @@ void read_s_voltage_registers(cell_asic chips[NUM_CHIPS],
 			      SPI_HandleTypeDef *hspi);
 
 /**
- * @brief Read every register connected to the AUX ADC.
+ * @brief Convert and read every register connected to the AUX ADC.  Uses RDASALL, so the status registers are refreshed too.
  * 
  * @param chips Array of chips to get voltage readings of.
  */
 void adc_and_read_aux_registers(cell_asic chips[NUM_CHIPS],
 				SPI_HandleTypeDef *hspi);
 
+/**
+ * @brief Read the redundant AUX registers, without starting a conversion.
+ * 
+ * @param chips Array of chips to get voltages of.
+ */
+void read_raux_registers(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
+
 /**
  * @brief Read voltages in every register connected to AUX2 ADC.
  * 
@@ -245,7 +430,7 @@ void adc_and_read_aux2_registers(cell_asic chips[NUM_CHIPS],
 				 SPI_HandleTypeDef *hspi);
 
 /**
- * @brief Read all status registers.
+ * @brief Read all status registers.  Uses RDASALL, so the AUX registers are refreshed too.
  * 
  * @param chips Array of chips to read.
  */
@@ -259,6 +444,15 @@ void read_status_registers(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
 void read_status_register_c(cell_asic chips[NUM_CHIPS],
 			    SPI_HandleTypeDef *hspi);
 
+/**
+ * @brief Read status register d, holding the flags of the cells the C-ADC found past the over and under voltage
+ * thresholds.  One register group, far shorter than reading the cells.
+ * 
+ * @param chips 
+ */
+void read_status_register_d(cell_asic chips[NUM_CHIPS],
+			    SPI_HandleTypeDef *hspi);
+
 /**
  * @brief Reads config register A
  * 
@@ -283,7 +477,7 @@ void read_config_register_b(cell_asic chips[NUM_CHIPS],
 void read_pwm_registers(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
 
 /**
- * @brief Read status and aux registers in one command.
+ * @brief Read status and aux registers in one command, falling back to groups on PEC failure.
  * 
  * @param chips Array of chips to read.
  */
@@ -323,6 +517,15 @@ void get_avgd_cell_voltages(cell_asic chips[NUM_CHIPS],
  */
 void get_s_adc_voltages(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
 
+/**
+ * @brief Trigger, wait, and fetch the S-ADC voltages with the open wire current on some cells.
+ * 
+ * @param chips Array of chips to get voltage readings from.
+ * @param ow Cells to pull the open wire current from.
+ */
+void get_s_adc_open_wire_voltages(cell_asic chips[NUM_CHIPS], OW_C_S ow,
+				  SPI_HandleTypeDef *hspi);
+
 /**
  * @brief Trigger, poll, and fetch the c and s adc voltages, using instaneous redundancy.
  * 
@@ -337,6 +540,47 @@ void get_c_and_s_adc_voltages(cell_asic chips[NUM_CHIPS],
  */
 void start_c_adc_conv(SPI_HandleTypeDef *hspi);
 
+/**
+ * @brief Start a single shot conversion, without waiting for it.  Other chain traffic can run
+ * until adbms_adc_wait() is called.
+ * 
+ * @param mode ADC to start.
+ * @param hspi SPI handle of the chain.
+ */
+void adbms_adc_start(adbms_adc_mode_t mode, SPI_HandleTypeDef *hspi);
+
+/**
+ * @brief Sleep until the conversion budget of a started ADC has elapsed, then confirm it is done with a single poll.
+ * The thread is woken by a TIM2 compare, so TIM2 channel 1 and its interrupt belong to this.  Returns
+ * immediately if the mode was not started.
+ * 
+ * @param mode ADC to wait for.
+ * @param hspi SPI handle of the chain.
+ */
+void adbms_adc_wait(adbms_adc_mode_t mode, SPI_HandleTypeDef *hspi);
+
+/**
+ * @brief Check if a conversion was started and not waited for yet.
+ * 
+ * @param mode ADC to check.
+ * @return true if adbms_adc_wait() is still owed for this mode.
+ */
+bool adbms_adc_pending(adbms_adc_mode_t mode);
+
+/**
+ * @brief Copy out the conversion latency stats of an ADC mode.
+ * 
+ * @param mode ADC to get stats of.
+ * @param stats Struct to copy the stats into.
+ */
+void adbms_get_adc_stats(adbms_adc_mode_t mode, adbms_adc_stats_t *stats);
+
+/**
+ * @brief Zero the conversion latency stats of every ADC mode.
+ * 
+ */
+void adbms_reset_adc_stats(void);
+
 // --- END ADC POLL ---
 
 #endif
\ No newline at end of file
@@ -12,60 +12,156 @@
 uint8_t get_num_cells(chipdata_t *chip_data);
 
 /**
- * @brief Calculate thermistor values and cell temps using thermistors.
+ * @brief Load the pack current and timestamp of the last cell measurement's snapshot.  Call before any other
+ * calculation, so every one of them works on samples from the same instant.
  * 
+ * @param bmsdata Pointer to BMS data struct.
+ */
+void calc_snapshot(bms_t *bmsdata);
+
+#ifdef DEBUG_ANALYZER_BENCH
+/**
+ * @brief Check the raw code voltage statistics against the float path on the latest cell codes, and print the
+ * DWT cycles each takes.  Rate limited, call every analysis cycle.
+ * 
+ * @param bmsdata Pointer to BMS data struct.
+ */
+void analyzer_compare_voltage_paths(const bms_t *bmsdata);
+
+/**
+ * @brief Run the scalar pack temperature and voltage statistics against calc_pack_stats() on a copy of the
+ * pack, check they agree, and print the DWT cycles each takes for the whole pack.  Rate limited, call every
+ * analysis cycle after calc_pack_stats().
+ * 
+ * @param bmsdata Pointer to BMS data struct, left untouched.
  */
-void calc_cell_temps(bms_t *bmsdata);
+void analyzer_compare_stats_paths(const bms_t *bmsdata);
 
 /**
- * @brief Calculates pack temp, and avg, min, and max cell temperatures.
+ * @brief Run calc_pack_stats() and the fault compares on its extremes against calc_cell_faults() on a copy of
+ * the pack, check both find the same faults, and print the DWT cycles each takes for the whole pack.  Rate
+ * limited, call every analysis cycle after calc_pack_stats().
  * 
+ * @param bmsdata Pointer to BMS data struct, left untouched.
+ */
+void analyzer_compare_fault_paths(const bms_t *bmsdata);
+
+/**
+ * @brief Check the thermistor lookup tables against the curve fit on the latest aux codes, and print the DWT
+ * cycles each takes.  Rate limited, call every analysis cycle.
+ * 
+ * @param bmsdata Pointer to BMS data struct.
+ */
+void analyzer_compare_temp_paths(const bms_t *bmsdata);
+#endif
+
+/**
+ * @brief Calculate thermistor values and cell temps using thermistors, and the die temps.
+ * 
+ * @param bmsdata Pointer to BMS data struct.
+ * @param therm_chips Bit per chip whose therms were refreshed, the others keep their temperatures.
+ * @param status_chips Bit per chip whose status registers were refreshed, for the die temp.
  */
-void calc_pack_temps(bms_t *bmsdata);
+void calc_cell_temps(bms_t *bmsdata, uint32_t therm_chips,
+		     uint32_t status_chips);
 
 /**
  * @brief Calclaute the voltage of every cell in the pack.
  * 
  * @param bmsdata Pointer to BMS data struct.
+ * @param chips Bit per chip whose cell registers were refreshed, the others keep their voltages.
  */
-void calc_cell_voltages(bms_t *bmsdata);
+void calc_cell_voltages(bms_t *bmsdata, uint32_t chips);
 
 /**
- * @brief Calculate statistics about pack voltage, such as min and max cell volt, pack and avg voltage, pack and avg OCV, and deltas.
+ * @brief Calculate the temperature, voltage and OCV statistics of the pack in one pass over the per cell arrays.
+ * Min and max with location, pack totals and averages, deltas, and per segment averages and totals.  Call once
+ * the cell temps, voltages and OCVs are calculated.
  * 
+ * @param bmsdata Pointer to BMS data struct.
+ * @param chips Bit per chip with a changed temp, voltage or OCV.  Only their segments are rescanned, the others
+ * are folded in from their last scan.
+ */
+void calc_pack_stats(bms_t *bmsdata, uint32_t chips);
+
+/**
+ * @brief Check every cell against the cell_fault_t limits, the open cell voltages against the voltage limits
+ * and the temperatures against MAX_CELL_TEMP, and take the chips' OV and UV comparator flags.  Fills the bit per
+ * offending cell of each chip, and how long the chip's longest offending cell has been past the limit, so
+ * faults do not wait on the pack statistics and can name every offending cell.  Call every analysis cycle,
+ * after the OCVs and temps.
+ * 
+ * @param bmsdata Pointer to BMS data struct.
+ * @param chips Bit per chip with a changed temp or OCV.  Only they are rescanned, the durations of the others
+ * still grow.
+ * @param flag_chips Bit per chip whose OV and UV flags were read.
+ */
+void calc_cell_faults(bms_t *bmsdata, uint32_t chips, uint32_t flag_chips);
+
+/**
+ * @brief Estimate open cell voltages from the cell voltages, adding back the drop the impedance model gives
+ * under load.  At rest this is the measured voltage.  Call after calc_cell_resistances().
+ * 
+ * @param bmsdata Pointer to BMS data struct.
+ * @param chips Bit per chip whose cell voltages changed.
+ * @return uint32_t Bit per chip whose open cell voltages were updated.
  */
-void calc_pack_voltage_stats(bms_t *bmsdata);
+uint32_t calc_open_cell_voltage(bms_t *bmsdata, uint32_t chips);
 
 /**
- * @brief Calculate open cell voltages based on cell voltages and previous open cell voltages.
+ * @brief Estimate the ohmic and polarization resistance of every cell group, by recursive least squares over
+ * the changes in its voltage against the changes in pack current, see impedance.h.  Also finds the highest and
+ * lowest, and the pack resistance.
+ * 
+ * Measurements whose cell voltages and current are not from the same snapshot do not update the estimates.
  * 
+ * @param bmsdata Pointer to BMS data struct.
+ * @param chips Bit per chip whose cell voltages changed.
  */
-void calc_open_cell_voltage(bms_t *bmsdata);
+void calc_cell_resistances(bms_t *bmsdata, uint32_t chips);
 
 /**
- * @brief Calculate cell resistances using Rin = ( Voc - V )/I
+ * @brief Predict the currents every cell group can carry over each sop_horizon_t without leaving its voltage
+ * limits, from its state of charge, capacity and impedance, see sop.h.  Call after calc_cell_soc(), and before
+ * calc_cont_dcl() and calc_cont_ccl().
  * 
+ * @param bmsdata Pointer to BMS data struct.
  */
-void calc_cell_resistances(bms_t *bmsdata);
+void calc_state_of_power(bms_t *bmsdata);
 
 /**
- * @brief Calculate the continuous discharge current limit based on cell temperatures and a cell temp to DCL lookup table.
+ * @brief Calculate the discharge current limits, the state of power limits capped by the current rating derated
+ * with the cell temperatures.  cont_DCL is the continuous one.
  * 
+ * @param bmsdata Pointer to BMS data struct.
  */
 void calc_cont_dcl(bms_t *bmsdata);
 
 /**
- * @brief Calculate continuous charge current limit (CCL) using linear derating from max cell temperature and voltage.
+ * @brief Calculate the charge current limits, the state of power limits capped by the current rating derated
+ * with the cell temperatures.  cont_CCL is the continuous one.
  *
  * @param bmsdata Pointer to BMS data structure.
  */
 void calc_cont_ccl(bms_t *bmsdata);
 
 /**
- * @brief Calcuate state of charge by using a formula based on datasheet graph
+ * @brief Calculate the state of charge of the weakest cell group.  Coulomb counts the pack current of each new
+ * cell measurement, and corrects with the group's voltage against the OCV curve, trusting it more the longer
+ * the pack has rested.  Call after the pack statistics.
  * 
  * @param bmsdata Pointer to BMS data struct.
  */
 void calc_state_of_charge(bms_t *bmsdata);
 
+/**
+ * @brief Calculate the state of charge of every cell group, the same way as calc_state_of_charge() does for
+ * the weakest, with each group's own capacity.  Capacities are measured across rests, and the charge and
+ * energy the pack has left are taken from the weakest and strongest groups.
+ * 
+ * @param bmsdata Pointer to BMS data struct.
+ * @param chips Bit per chip whose cell voltages were measured since the last call.
+ */
+void calc_cell_soc(bms_t *bmsdata, uint32_t chips);
+
 #endif
\ No newline at end of file
@@ -3,6 +3,14 @@
 
 #define DEBUG_MODE_ENABLED true
 #define DEBUG_STATS
+// print the timing of every segment scan over UART, the blocking prints take longer than a scan period
+// #define DEBUG_SCAN_STATS
+// print the worst case DWT cycles of the analyzer's calculations against the cell period
+// #define DEBUG_ANALYZER_BENCH
+// read the ADC code registers through the DMA transaction engine, SPI DMA channels must be set up
+#define ADBMS_SPI_DMA
+// keep cell voltages as raw ADC codes through the analyzer, converting to volts only for output
+// #define ANALYZER_FIXED_POINT
 
 // Hardware definition
 #define NUM_SEGMENTS	5
@@ -11,6 +19,8 @@
 #define NUM_CELLS	NUM_CELLS_PER_CHIP * NUM_CHIPS
 // only actual flexPCB therms counted
 #define NUM_THERMS NUM_CELLS / 2
+// cells wired in parallel behind each cell tap, a tap's capacity and impedance are those of the group
+#define CELLS_IN_PARALLEL 3
 
 
 // Firmware limits
@@ -46,6 +56,10 @@
 
 // ADBMS6830 limits
 #define MAX_CHIP_TEMP 60
+// comparator thresholds, on terminal voltage every C-ADC conversion.  Well outside the cell limits, which are
+// checked on OCV, so load sag and the IR rise while charging do not trip them, a cell past these is gone.
+#define HW_OV_VOLT 4.3
+#define HW_UV_VOLT 1.0
 
 // Algorithm settings
 #define VOLT_SAG_MARGIN \
@@ -67,8 +81,29 @@
 #define LOW_CELL_TIME	   55000
 #define HIGH_TEMP_TIME	   55000
 #define MAX_CHIPTEMP_TIME  55000
+// the comparators flag a cell on every C-ADC conversion it is past the threshold, a few of them rule out a glitch
+#define HW_OVER_VOLT_TIME  300
+#define HW_UNDER_VOLT_TIME 300
 
 // system wide base ADBMS sample rate
 #define SAMPLE_RATE 2 /* Hz */
 
+// Period of each quantity in the segment measurement sequencer
+#define OVUV_PERIOD_MS	    10
+#define CELL_PERIOD_MS	    100
+#define THERM_PERIOD_MS	    500
+#define STATUS_PERIOD_MS    1000
+#define S_ADC_PERIOD_MS	    2000
+#define OPEN_WIRE_PERIOD_MS 10000
+#define SERIAL_ID_PERIOD_MS 60000
+
+// Longest the state machine waits for an analysis pass before running on the last one, so fault timers still run out
+#define SM_WATCHDOG_MS 500
+
+// S-ADC reading with the open wire current on that differs this much from the C-ADC is an open wire
+#define OPEN_WIRE_DELTA_V 0.5
+
+// Re-reads of a register group failing PEC before its data is marked stale
+#define PEC_MAX_RETRIES 2
+
 #endif
\ No newline at end of file
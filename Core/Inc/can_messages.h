@@ -39,8 +39,8 @@
 
 #define OVERFLOW_CANID	   0x6F1
 #define OVERFLOW_SIZE	   6
-#define PEC_ERROR_CANID	   0x6F2
-#define PEC_ERROR_SIZE	   3
+#define LINK_QUALITY_CANID 0x6F3
+#define LINK_QUALITY_SIZE  8
 #define ALPHA_CELL_CANID   0x6FA
 #define BETA_CELL_CANID	   0x6FB
 #define CELL_MSG_SIZE	   7
@@ -58,6 +58,11 @@
 #define DEBUG_SIZE	  8
 #define FAULT_TIMER_CANID 0x6F9
 #define FAULT_TIMER_SIZE  4
+#define CELL_FAULT_CANID  0x6F8
+#define CELL_FAULT_SIZE	  8
+#define FAULT_TRACE_CANID 0x6F7
+#define FAULT_TRACE_SIZE  8
+#define FAULT_TRACE_REQ_CANID 0x6F4
 
 /**
  * @brief sends charger message
@@ -268,11 +273,45 @@ void send_alpha_status_b_message(float v_res, uint8_t chip, float vref2,
 				 stc_ *flt_reg);
 
 /**
- * @brief Sends a CAN message containing the PEC error count for a specific chip.
+ * @brief Sends a CAN message summarizing the isoSPI link quality of the whole pack.
  *
- * @param chip_num The index of the chip that reported PEC errors.
- * @param pec_count The total number of PEC errors detected for the specified chip.
+ * @param stale_chips Bit per chip holding data that failed PEC on every retry.
+ * @param pack_error_rate PEC errors per 10000 reads over the whole pack.
+ * @param worst_chip Chip with the highest PEC error rate.
+ * @param worst_error_rate PEC errors per 10000 reads of the worst chip's worst register.
+ * @param retries Register groups re-read since boot, wraps.
  */
-void send_pec_error_message(uint8_t chip_num, uint16_t pec_count);
+void send_link_quality_message(uint16_t stale_chips, uint16_t pack_error_rate,
+			       uint8_t worst_chip, uint16_t worst_error_rate,
+			       uint8_t retries);
+
+/**
+ * @brief Send the cells of a chip that are past a fault's limit.
+ *
+ * @param fault_code The fault they raised.
+ * @param chip The chip.
+ * @param cells Bit per offending cell, bit n for cell n.
+ * @param duration_ms How long the longest offending cell has been past the limit.
+ */
+void send_cell_fault_message(uint32_t fault_code, uint8_t chip, uint16_t cells,
+			     uint32_t duration_ms);
+
+/**
+ * @brief Send three bins of a fault latency histogram, see fault_trace.h.
+ *
+ * @param hist The fault_hist_t.
+ * @param first_bin The bin counts[0] is.
+ * @param counts The counts of the bins.
+ */
+void send_fault_trace_message(uint8_t hist, uint8_t first_bin,
+			      const uint16_t counts[3]);
+
+/**
+ * @brief Send the worst latency of a fault latency histogram, as its bin FAULT_TRACE_BINS.
+ *
+ * @param hist The fault_hist_t.
+ * @param worst_us The worst latency binned.
+ */
+void send_fault_trace_worst_message(uint8_t hist, uint32_t worst_us);
 
 #endif
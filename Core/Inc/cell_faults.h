@@ -0,0 +1,68 @@
+/**
+ * @file cell_faults.h
+ * @brief Threshold kernels that mark every cell of a chip past a fault limit.
+ *
+ * Each kernel compares a chip's cells against one limit and returns a bit per cell, bit n for cell n, so a
+ * fault knows every offending cell rather than just the worst one.  On target the cell voltage kernels
+ * compare two codes per instruction, host builds (or CELL_FAULTS_PORTABLE) get plain C loops with the same
+ * results.
+ */
+
+#ifndef _CELL_FAULTS_H
+#define _CELL_FAULTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "datastructs.h"
+
+/**
+ * @brief Mark the cells of a chip over a limit.
+ *
+ * @param data The chip's cells, NUM_CELLS_PER_CHIP of them.
+ * @param lim The limit.
+ * @return uint16_t Bit per cell over lim.
+ */
+uint16_t mask_cell_volt_above(const cell_volt_t *data, cell_volt_t lim);
+
+/**
+ * @brief Mark the cells of a chip under a limit.
+ *
+ * @param data The chip's cells, NUM_CELLS_PER_CHIP of them.
+ * @param lim The limit.
+ * @return uint16_t Bit per cell under lim.
+ */
+uint16_t mask_cell_volt_below(const cell_volt_t *data, cell_volt_t lim);
+
+/**
+ * @brief Mark the cells of a chip over a limit.
+ *
+ * @param data The chip's cells, NUM_CELLS_PER_CHIP of them.
+ * @param lim The limit.
+ * @return uint16_t Bit per cell over lim.
+ */
+uint16_t mask_float_above(const float *data, float lim);
+
+/**
+ * @brief Mark the cells of a chip with a flag set.
+ *
+ * @param flags The chip's flags, a byte per cell, NUM_CELLS_PER_CHIP of them.
+ * @return uint16_t Bit per cell flagged.
+ */
+uint16_t mask_flags(const uint8_t *flags);
+
+/**
+ * @brief Whether any cell of the pack is marked.
+ *
+ * @param masks Bit per cell of each chip.
+ * @return true if a bit is set.
+ */
+static inline bool cell_faults_any(const uint16_t masks[NUM_CHIPS])
+{
+	uint16_t any = 0;
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		any |= masks[c];
+	}
+	return any != 0;
+}
+
+#endif
@@ -9,6 +9,44 @@
 #include "adBms6830Data.h"
 #include "timer.h"
 
+/* ADBMS6830 cell codes are volts = code * 150 uV + 1.5 V, same as getVoltage() */
+#define CELL_CODE_LSB_V	   0.00015f
+#define CELL_CODE_OFFSET_V 1.5f
+/* volts to the nearest cell code, for constants */
+#define VOLTS_TO_CELL_CODE(v)                                        \
+	((int16_t)(((v) - CELL_CODE_OFFSET_V) / CELL_CODE_LSB_V + \
+		   ((v) >= CELL_CODE_OFFSET_V ? 0.5f : -0.5f)))
+
+/**
+ * @brief A cell voltage as the analyzer keeps it.  With ANALYZER_FIXED_POINT this is the raw cell code, so
+ * min, max, sums and fault thresholds are integer operations, and volts only appear at the edges.
+ */
+#ifdef ANALYZER_FIXED_POINT
+typedef int16_t cell_volt_t;
+/* sum of cell voltages, with the count summed to place the offset */
+typedef int32_t cell_volt_sum_t;
+#define CELL_VOLT(v)		  VOLTS_TO_CELL_CODE(v)
+#define CELL_VOLT_FROM_CODE(code) ((int16_t)(code))
+#define CELL_VOLT_FROM_FLOAT(v)	  VOLTS_TO_CELL_CODE(v)
+#define CELL_VOLT_TO_FLOAT(x)	  ((x) * CELL_CODE_LSB_V + CELL_CODE_OFFSET_V)
+#define CELL_VOLT_SUM_TO_FLOAT(sum, n) \
+	((sum) * CELL_CODE_LSB_V + (n) * CELL_CODE_OFFSET_V)
+#define CELL_VOLT_DIFF_TO_FLOAT(d) ((d) * CELL_CODE_LSB_V)
+#define CELL_VOLT_LOWEST	   INT16_MIN
+#define CELL_VOLT_HIGHEST	   INT16_MAX
+#else
+typedef float cell_volt_t;
+typedef float cell_volt_sum_t;
+#define CELL_VOLT(v)		       (v)
+#define CELL_VOLT_FROM_CODE(code)      getVoltage(code)
+#define CELL_VOLT_FROM_FLOAT(v)	       (v)
+#define CELL_VOLT_TO_FLOAT(x)	       (x)
+#define CELL_VOLT_SUM_TO_FLOAT(sum, n) (sum)
+#define CELL_VOLT_DIFF_TO_FLOAT(d)     (d)
+#define CELL_VOLT_LOWEST	       (-FLT_MAX)
+#define CELL_VOLT_HIGHEST	       FLT_MAX
+#endif
+
 /**
  * @brief Stores critical values for the pack (across all chips), and where that critical value can be found
  */
@@ -24,14 +62,10 @@ typedef struct {
 typedef struct {
 	int error_reading;
 
-	/* These are calculated during the analysis of data */
+	/* bit per adbms_reg_t whose data failed PEC on every retry, the analyzer keeps the last good values */
+	uint16_t stale_regs;
 
-	/* Cell temperature in celsius */
-	float cell_temp[NUM_CELLS];
-	float cell_resistance[NUM_CELLS];
-	float open_cell_voltage[NUM_CELLS];
-
-	float cell_voltages[NUM_CELLS];
+	/* These are calculated during the analysis of data, per cell values live in bms_t */
 
 	/* True if chip is alpha, False if Chip is Beta */
 	bool alpha;
@@ -48,10 +82,59 @@ typedef struct {
  */
 typedef struct {
 	float val;
+	/* voltages only, val as a cell_volt_t */
+	cell_volt_t raw;
 	uint8_t chipIndex;
 	uint8_t cellNum;
 } crit_cellval_t;
 
+/**
+ * @brief Quantities the analyzer derives, recomputed only when the measurements they depend on change
+ */
+typedef enum {
+	ANALYZED_CELL_TEMPS,
+	ANALYZED_CELL_VOLTS,
+	ANALYZED_OCV,
+	ANALYZED_RESISTANCES,
+	ANALYZED_PACK_STATS,
+	ANALYZED_LIMITS,
+	ANALYZED_SOC,
+	ANALYZED_CELL_SOC,
+	ANALYZED_CELL_FAULTS,
+	ANALYZED_QUANTITIES
+} analyzed_quantity_t;
+
+/**
+ * @brief How far ahead the state of power limits look, see sop.h
+ */
+typedef enum {
+	SOP_2S,
+	SOP_10S,
+	SOP_CONT,
+	SOP_HORIZONS
+} sop_horizon_t;
+
+/**
+ * @brief Limits every cell is checked against, see calc_cell_faults()
+ */
+typedef enum {
+	/* open cell voltage over MAX_VOLT */
+	CELL_FAULT_OV,
+	/* open cell voltage over MAX_CHARGE_VOLT */
+	CELL_FAULT_CHARGE_OV,
+	/* open cell voltage under MIN_VOLT */
+	CELL_FAULT_UV,
+	/* open cell voltage under 0.9 V, a cell too far gone to recover */
+	CELL_FAULT_DEEP_UV,
+	/* temperature over MAX_CELL_TEMP */
+	CELL_FAULT_OT,
+	/* flagged by the chip's comparator over its OV threshold, HW_OV_VOLT */
+	CELL_FAULT_HW_OV,
+	/* flagged by the chip's comparator under its UV threshold, HW_UV_VOLT */
+	CELL_FAULT_HW_UV,
+	CELL_FAULTS
+} cell_fault_t;
+
 typedef enum {
     BOOT,
     READY,
@@ -72,15 +155,52 @@ typedef struct {
 	/* Array of structs containing raw data from and configurations for the ADBMS6830 chips */
 	cell_asic chips[NUM_CHIPS];
 
+	/*
+	 * Per cell values calculated during the analysis of data, indexed [chip][cell].  One contiguous array per
+	 * quantity, so scans over the pack walk memory in order.
+	 */
+
+	/* Cell temperature in celsius */
+	float cell_temp[NUM_CHIPS][NUM_CELLS_PER_CHIP];
+	/* Ohmic resistance, and polarization resistance of the RC pair, of each cell group, see impedance.h */
+	float cell_resistance[NUM_CHIPS][NUM_CELLS_PER_CHIP];
+	float cell_polarization[NUM_CHIPS][NUM_CELLS_PER_CHIP];
+	/* see cell_volt_t, convert with CELL_VOLT_TO_FLOAT() */
+	cell_volt_t open_cell_voltage[NUM_CHIPS][NUM_CELLS_PER_CHIP];
+	cell_volt_t cell_voltages[NUM_CHIPS][NUM_CELLS_PER_CHIP];
+	/* State of charge in percent, and capacity in Ah, of each cell group */
+	float cell_soc[NUM_CHIPS][NUM_CELLS_PER_CHIP];
+	float cell_capacity[NUM_CHIPS][NUM_CELLS_PER_CHIP];
+
 	float pack_current;
+	/* adbms_get_us() of the snapshot the cell voltages and pack current were taken in */
+	uint32_t snapshot_us;
+	/* false if the cell voltages and pack current are not from the same instant */
+	bool snapshot_coherent;
+	/* seconds since the pack current was last over OCV_CURR_THRESH */
+	float rest_s;
+	/* charge drawn from the pack since boot in Ah, negative if more went in */
+	float pack_ah;
 	float pack_voltage;
 	float pack_ocv;
 	float pack_res;
 
 	float cont_DCL;
 	float cont_CCL;
+	/* Discharge and charge currents in A that keep every cell group in its voltage limits over each horizon */
+	float sop_dcl[SOP_HORIZONS];
+	float sop_ccl[SOP_HORIZONS];
 	float soc;
 
+	/* Charge the pack can give before its weakest group is empty, and take before its strongest is full */
+	float discharge_ah;
+	float charge_ah;
+	/* Energy the pack can give, in Wh */
+	float pack_energy_wh;
+	/* The groups with the least charge left, and the least room left */
+	crit_cellval_t weakest_cell;
+	crit_cellval_t strongest_cell;
+
 	float segment_average_temps[NUM_SEGMENTS];
 	/* OCV average voltages */
 	float segment_average_volts[NUM_SEGMENTS];
@@ -120,11 +240,19 @@ typedef struct {
 	float avg_ocv;
 	float delt_ocv;
 
+	/* Bit per cell of each chip past each cell_fault_t limit, bit n for cell n */
+	uint16_t cell_fault_mask[CELL_FAULTS][NUM_CHIPS];
+	/* ms the longest offending cell of each chip has been past the limit, 0 if none is */
+	uint32_t cell_fault_ms[CELL_FAULTS][NUM_CHIPS];
+
 	// the current discharge configuration the state machine wants
 	bool discharge_config[NUM_CHIPS][NUM_CELLS_PER_CHIP];
 	// whether balancing should be on, or muted
 	bool should_balance;
 
+	/* HAL tick each analyzed quantity was last recomputed at, 0 if never */
+	uint32_t updated_ms[ANALYZED_QUANTITIES];
+
 	/// whether the charger is connected, synonymous with being in the state of CHARGING, and therefore irreversible
 	bool is_charger_connected;
 	/// whether the state machine has determined its time to charge
@@ -161,39 +289,15 @@ enum {
 };
 
 /**
- * @brief Represents fault evaluation operators
- */
-typedef enum {
-	GT, /* fault if {data} greater than {threshold}             */
-	LT, /* fault if {data} less than {threshold}                */
-	GE, /* fault if {data} greater than or equal to {threshold} */
-	LE, /* fault if {data} less than or equal to {threshold}    */
-	EQ, /* fault if {data} equal to {threshold}                 */
-	NEQ, /* fault if {data} not equal to {threshold}             */
-	NOP /* no operation, use for single threshold faults        */
-
-} fault_evalop_t;
-
-/**
- * @brief Represents data to be packaged into a fault evaluation
+ * @brief Describes a fault, see fault_table.h.  Lives in flash, the timer of each fault is kept beside it.
  */
 typedef struct {
-	char id[100];
-	nertimer_t timer;
-
-	float data_1;
-	fault_evalop_t optype_1;
-	float lim_1;
-
-	int timeout;
-	int code;
-
-	fault_evalop_t optype_2;
-	float data_2;
-	float lim_2;
-
+	const char *id;
+	uint32_t code;
+	uint32_t timeout;
 	bool is_critical;
-	// bool is_faulted; /* note: unused field */
+	/* the cell limit the fault is raised on, CELL_FAULTS if it is not on the cells */
+	cell_fault_t cells;
 } fault_eval_t;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+/**
+ * @file fault_table.h
+ * @brief Every fault the state machine evaluates, declared once.
+ *
+ * Each entry is X(name, label, code, critical, timeout, cells, value, condition).  value and condition are
+ * expressions in b, the const bms_t * being evaluated, so they read the live pack state every cycle.  A fault
+ * trips once condition has held for timeout ms, value is what is reported with it over CAN.  Faults on a
+ * cell_fault_t limit name it in cells, and are raised by calc_cell_faults()'s masks, so they report every
+ * offending cell when they trip.  The others have CELL_FAULTS there.
+ *
+ * The entries expand into the fault_index_t indices, the const table of fault_eval_t, and the evaluation in
+ * fault_table_eval().  Add a fault by adding a line here.
+ */
+
+#ifndef _FAULT_TABLE_H
+#define _FAULT_TABLE_H
+
+#include "datastructs.h"
+#include "cell_faults.h"
+
+// clang-format off
+/*        name                 label                      code                               critical  timeout             cells                 value                condition */
+#define FAULT_TABLE(X) \
+	X(DISCHARGE_CURRENT,  "Discharge Current Limit", DISCHARGE_LIMIT_ENFORCEMENT_FAULT, true, OVER_CURR_TIME,     CELL_FAULTS,          b->pack_current,     b->pack_current > b->cont_DCL) \
+	X(CHARGE_CURRENT,     "Charge Current Limit",    CHARGE_LIMIT_ENFORCEMENT_FAULT,    true, OVER_CHG_CURR_TIME, CELL_FAULTS,          b->pack_current,     b->pack_current > b->cont_CCL && b->pack_current < 0) \
+	X(LOW_CELL_VOLTAGE,   "Low Cell Voltage",        CELL_VOLTAGE_TOO_LOW,              true, UNDER_VOLT_TIME,    CELL_FAULT_UV,        b->min_ocv.val,      cell_faults_any(b->cell_fault_mask[CELL_FAULT_UV])) \
+	X(HIGH_CHARGE_VOLTAGE, "High Charge Voltage",    CELL_VOLTAGE_TOO_HIGH,             true, OVER_VOLT_TIME,     CELL_FAULT_CHARGE_OV, b->max_ocv.val,      cell_faults_any(b->cell_fault_mask[CELL_FAULT_CHARGE_OV]) && b->is_charger_connected) \
+	X(HIGH_CELL_VOLTAGE,  "High Cell Voltage",       CELL_VOLTAGE_TOO_HIGH,             true, OVER_VOLT_TIME,     CELL_FAULT_OV,        b->max_ocv.val,      cell_faults_any(b->cell_fault_mask[CELL_FAULT_OV])) \
+	X(HIGH_TEMP,          "High Temp",               PACK_TOO_HOT,                      true, HIGH_TEMP_TIME,     CELL_FAULT_OT,        b->max_temp.val,     cell_faults_any(b->cell_fault_mask[CELL_FAULT_OT])) \
+	X(EXTREMELY_LOW_VOLTAGE, "Extremely Low Voltage", LOW_CELL_VOLTAGE,                 true, LOW_CELL_TIME,      CELL_FAULT_DEEP_UV,   b->min_ocv.val,      cell_faults_any(b->cell_fault_mask[CELL_FAULT_DEEP_UV])) \
+	X(DIE_OVERTEMP,       "Die Overtemp",            DIE_TEMP_MAXIMUM_FAULT,            true, MAX_CHIPTEMP_TIME,  CELL_FAULTS,          b->max_chiptemp.val, b->max_chiptemp.val > MAX_CHIP_TEMP) \
+	X(HW_OVER_VOLTAGE,    "Comparator Over Voltage", CELL_VOLTAGE_TOO_HIGH,             true, HW_OVER_VOLT_TIME,  CELL_FAULT_HW_OV,     b->max_voltage.val,  cell_faults_any(b->cell_fault_mask[CELL_FAULT_HW_OV])) \
+	X(HW_UNDER_VOLTAGE,   "Comparator Under Voltage", CELL_VOLTAGE_TOO_LOW,             true, HW_UNDER_VOLT_TIME, CELL_FAULT_HW_UV,     b->min_voltage.val,  cell_faults_any(b->cell_fault_mask[CELL_FAULT_HW_UV]))
+// clang-format on
+
+/**
+ * @brief Index of each fault in the table
+ */
+typedef enum {
+#define FAULT_INDEX(name, label, code, critical, timeout, cells, value, \
+		    condition)                                              \
+	FAULT_##name,
+	FAULT_TABLE(FAULT_INDEX)
+#undef FAULT_INDEX
+	NUM_FAULTS
+} fault_index_t;
+
+typedef enum {
+	FAULT_STAT_FAULTED = 1,
+	FAULT_STAT_CLEARED = 2,
+} fault_stat_t;
+
+/* Every fault's description, indexed by fault_index_t */
+extern const fault_eval_t fault_table[NUM_FAULTS];
+
+/**
+ * @brief Evaluate the condition of every fault on the pack state as it is now.
+ *
+ * @param b The pack state.
+ * @param present Set to whether each fault's condition holds.
+ * @param values Set to the value each condition tested, reported over CAN.
+ */
+void fault_table_eval(const bms_t *b, bool present[NUM_FAULTS],
+		      float values[NUM_FAULTS]);
+
+/**
+ * @brief Run a fault's timer on whether its condition holds, and report when it
+ * starts, trips or clears.  sm_fault_update() calls this per fault with the
+ * condition and value from fault_table_eval().
+ *
+ * @param fault_item The fault.
+ * @param timer The fault's timer.
+ * @param fault_present Whether the fault's condition holds.
+ * @param value The value the condition tested, reported over CAN.
+ * @return FAULT_STAT_FAULTED when the timer expires, FAULT_STAT_CLEARED when the
+ * condition clears with the timer running, otherwise 0.
+ */
+fault_stat_t sm_fault_eval(const fault_eval_t *fault_item, nertimer_t *timer,
+			   bool fault_present, float value);
+
+#endif
@@ -0,0 +1,119 @@
+/**
+ * @file fault_trace.h
+ * @brief Timestamps of each cell sample through the fault pipeline, and histograms of the latency between them.
+ *
+ * A sample is keyed by its snapshot timestamp, bms_t snapshot_us, which every stage downstream of the readout
+ * carries.  Every sample is traced up to its fault evaluation.  When a sample's evaluation faults the pack, it
+ * is also traced through the transition to FAULTED and the zero discharge limit leaving on CAN.  The fault
+ * timeouts are deliberate debounce, and are not part of any latency here.
+ *
+ * Latencies are binned by powers of two, bin 0 is under 2^FAULT_TRACE_MIN_SHIFT us and bin n is
+ * [2^(FAULT_TRACE_MIN_SHIFT + n - 1), 2^(FAULT_TRACE_MIN_SHIFT + n)) us, the last bin taking everything above.
+ */
+
+#ifndef _FAULT_TRACE_H
+#define _FAULT_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FAULT_TRACE_BINS      16
+#define FAULT_TRACE_MIN_SHIFT 6
+
+/**
+ * @brief Trace points of a sample, in pipeline order.
+ */
+typedef enum {
+	/* cell conversion started, or frozen by the snapshot command when converting continuously */
+	FAULT_TRACE_CONVERSION,
+	/* cell registers read out */
+	FAULT_TRACE_READOUT,
+	/* analysis pass published */
+	FAULT_TRACE_PUBLISH,
+	/* faults evaluated by the state machine */
+	FAULT_TRACE_EVAL,
+	/* state machine transitioned to FAULTED, and asserted the fault line */
+	FAULT_TRACE_TRANSITION,
+	/* zero discharge limit handed to the CAN controller */
+	FAULT_TRACE_CAN_TX,
+	FAULT_TRACE_STAGES
+} fault_trace_stage_t;
+
+/**
+ * @brief Latencies the histograms are kept of.  The first are the time from the previous trace point to each
+ * one, the last are end to end.
+ */
+typedef enum {
+	FAULT_HIST_READOUT,
+	FAULT_HIST_PUBLISH,
+	FAULT_HIST_EVAL,
+	FAULT_HIST_TRANSITION,
+	FAULT_HIST_CAN_TX,
+	/* conversion to fault evaluation, of every sample */
+	FAULT_HIST_DECISION,
+	/* conversion to the zero discharge limit leaving, of the samples that faulted */
+	FAULT_HIST_RESPONSE,
+	FAULT_HISTS
+} fault_hist_t;
+
+/**
+ * @brief Start tracing a sample once its cell registers are read out.
+ *
+ * @param conversion_us adbms_get_us() of the conversion.
+ * @param sample_us The sample's snapshot timestamp.
+ */
+void fault_trace_sample(uint32_t conversion_us, uint32_t sample_us);
+
+/**
+ * @brief Timestamp a sample at a trace point after its readout.  Marking FAULT_TRACE_EVAL bins the sample's
+ * latencies up to it, marking FAULT_TRACE_TRANSITION waits for the zero discharge limit to leave.
+ *
+ * @param stage The trace point.
+ * @param sample_us The sample's snapshot timestamp.
+ */
+void fault_trace_mark(fault_trace_stage_t stage, uint32_t sample_us);
+
+/**
+ * @brief Note a CAN message handed to the controller, completes the trace of a fault waiting on it.
+ *
+ * @param id The message's ID.
+ * @param data The message's data.
+ */
+void fault_trace_can_tx(uint32_t id, const uint8_t *data);
+
+/**
+ * @brief Get a histogram.
+ *
+ * @param hist The latency.
+ * @param bins Filled with the count in each bin, they saturate at UINT16_MAX.
+ * @return uint32_t The worst latency binned, in us.
+ */
+uint32_t fault_trace_get(fault_hist_t hist, uint16_t bins[FAULT_TRACE_BINS]);
+
+/**
+ * @brief Send a histogram over CAN, on FAULT_TRACE_CANID.  Queues a message per three bins, and one
+ * with the worst latency.
+ *
+ * @param hist The latency.
+ */
+void fault_trace_send(fault_hist_t hist);
+
+/**
+ * @brief Print every histogram over UART.
+ */
+void fault_trace_print(void);
+
+/**
+ * @brief Empty every histogram.
+ */
+void fault_trace_reset(void);
+
+/**
+ * @brief Answer a request for the histograms, received on FAULT_TRACE_REQ_CANID.
+ *
+ * @param data The request, bit 0 of byte 0 sends the histogram in byte 1 over CAN, bit 1 prints every histogram
+ * over UART, and bit 2 empties them after.
+ */
+void fault_trace_request(const uint8_t *data);
+
+#endif
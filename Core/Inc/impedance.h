@@ -0,0 +1,101 @@
+/**
+ * @file impedance.h
+ * @brief Online estimation of cell group impedance, by recursive least squares with a forgetting factor.
+ *
+ * Each group is modelled as an ohmic resistance R0 in series with one RC pair, R1 polarizing with a fixed
+ * time constant.  Between two cell measurements the OCV barely moves, so the change in a group's voltage
+ * is -R0 times the change in current, minus R1 times the change in the current low passed by the time
+ * constant.
+ *
+ * Every group in the pack carries the same current, so the regressors, and with them the covariance and
+ * gain of the estimator, are the same for all of them.  They are stepped once per measurement, and each
+ * group then only applies the shared gain to its own prediction error.
+ */
+
+#ifndef _IMPEDANCE_H
+#define _IMPEDANCE_H
+
+#include <stdbool.h>
+
+/* Polarization time constant of the RC pair, in s */
+#define IMPEDANCE_TAU_S 5.0f
+
+/**
+ * @brief Estimator state shared by every group.
+ */
+typedef struct {
+	/* covariance of [R0, R1], scaled by the measurement noise */
+	float p[2][2];
+	/* regressors and gain of the latest step */
+	float phi[2];
+	float gain[2];
+	/* whether the latest step updates the groups */
+	bool update;
+	float last_amps;
+	/* the current low passed by the polarization time constant */
+	float polar_amps;
+} impedance_rls_t;
+
+/**
+ * @brief Estimator state of one group.
+ */
+typedef struct {
+	/* ohmic and polarization resistance */
+	float r0;
+	float r1;
+	float last_volts;
+} impedance_cell_t;
+
+/**
+ * @brief Start the shared estimator state.
+ *
+ * @param rls State to start.
+ * @param amps Pack current at the first measurement, positive discharging.
+ */
+void impedance_init(impedance_rls_t *rls, float amps);
+
+/**
+ * @brief Start a group's estimate at the typical values.
+ *
+ * @param cell State to start.
+ * @param volts Voltage of the group at the first measurement.
+ * @param ohms Typical ohmic resistance of the group, R1 starts equal to it.
+ */
+void impedance_cell_init(impedance_cell_t *cell, float volts, float ohms);
+
+/**
+ * @brief Step the shared state to a new measurement, and work out the gain for the groups.
+ *
+ * @param rls State to step.
+ * @param amps Pack current at the measurement, positive discharging.
+ * @param dt_s Seconds since the last measurement.
+ * @param trusted false if the voltages were not taken at the same instant as the current, they then do
+ * not update the estimates.
+ * @return bool Whether the groups should be updated with this measurement.
+ */
+bool impedance_step(impedance_rls_t *rls, float amps, float dt_s,
+		    bool trusted);
+
+/**
+ * @brief Update a group's estimate with its voltage at the measurement impedance_step() was last called for.
+ *
+ * @param rls Shared state, stepped to the measurement.
+ * @param cell State of the group.
+ * @param volts Voltage of the group.
+ */
+void impedance_cell_update(const impedance_rls_t *rls, impedance_cell_t *cell,
+			   float volts);
+
+/**
+ * @brief Estimate a group's open cell voltage under load, by adding back the ohmic drop and the polarization
+ * the model gives for the current so far.
+ *
+ * @param rls Shared state, stepped to the measurement.
+ * @param cell State of the group.
+ * @param volts Voltage of the group at the measurement.
+ * @return float The open cell voltage.
+ */
+float impedance_ocv(const impedance_rls_t *rls, const impedance_cell_t *cell,
+		    float volts);
+
+#endif
@@ -0,0 +1,56 @@
+/**
+ * @file pack_state.h
+ * @brief Published snapshot of the pack state, so readers never wait on the bms mutex.
+ *
+ * The working bms_t belongs to whoever holds bms_mutex.  When a writer is done with it, it publishes a copy
+ * into the back one of two buffers and flips which one is published.  Readers copy the published buffer
+ * without taking any lock, and copy again if a publish overwrote it part way through, so every copy is one
+ * consistent analysis pass.
+ */
+
+#ifndef _PACK_STATE_H
+#define _PACK_STATE_H
+
+#include <stdint.h>
+#include "datastructs.h"
+
+/**
+ * @brief Publish the working pack state to readers.  Call with bms_mutex held, it is what keeps writers apart.
+ *
+ * @param bmsdata The working pack state.
+ */
+void pack_state_publish(const bms_t *bmsdata);
+
+/**
+ * @brief Copy the latest published pack state.  Never blocks.
+ *
+ * @param bmsdata Filled with the pack state.
+ * @return uint32_t Number of publishes the copy includes, 0 if nothing was published yet and bmsdata is
+ * untouched.
+ */
+uint32_t pack_state_read(bms_t *bmsdata);
+
+/**
+ * @brief Copy the values the state machine decides from a pack state into the working one, everything else
+ * there belongs to the analyzer.  Call with bms_mutex held.
+ *
+ * @param bmsdata The working pack state.
+ * @param sm The pack state the state machine ran on.
+ */
+void pack_state_commit_sm(bms_t *bmsdata, const bms_t *sm);
+
+#ifdef DEBUG_STATS
+/**
+ * @brief Time bms_mutex is held, from just after it is taken to just before it is put.
+ *
+ * @param start_us adbms_get_us() once the mutex was taken.
+ */
+void pack_state_log_hold(uint32_t start_us);
+
+/**
+ * @brief Print the worst and latest mutex hold and reader copy times since the last print.
+ */
+void pack_state_print_stats(void);
+#endif
+
+#endif
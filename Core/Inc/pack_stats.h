@@ -0,0 +1,58 @@
+/**
+ * @file pack_stats.h
+ * @brief Block statistics kernels the analyzer scans the pack's per cell arrays with.
+ *
+ * Each kernel takes the max and min with their first location, and the sum, of a contiguous block.  On target
+ * they run on CMSIS-DSP, host builds (or PACK_STATS_PORTABLE) get plain C loops with the same results.
+ */
+
+#ifndef _PACK_STATS_H
+#define _PACK_STATS_H
+
+#include <stdint.h>
+#include "datastructs.h"
+
+/**
+ * @brief Statistics of a block of floats.
+ */
+typedef struct {
+	float max;
+	float min;
+	float sum;
+	/* offsets into the block, the first one if there is a tie */
+	uint16_t max_at;
+	uint16_t min_at;
+} float_stats_t;
+
+/**
+ * @brief Statistics of a block of cell voltages, kept as cell_volt_t.
+ */
+typedef struct {
+	cell_volt_t max;
+	cell_volt_t min;
+	cell_volt_sum_t sum;
+	/* offsets into the block, the first one if there is a tie */
+	uint16_t max_at;
+	uint16_t min_at;
+} cell_volt_stats_t;
+
+/**
+ * @brief Take the statistics of a block of floats.
+ *
+ * @param data Block to scan.
+ * @param len Number of values, at least 1.
+ * @param stats Filled with the statistics of the block.
+ */
+void stats_float(const float *data, uint16_t len, float_stats_t *stats);
+
+/**
+ * @brief Take the statistics of a block of cell voltages.
+ *
+ * @param data Block to scan.
+ * @param len Number of values, at least 1.
+ * @param stats Filled with the statistics of the block.
+ */
+void stats_cell_volt(const cell_volt_t *data, uint16_t len,
+		     cell_volt_stats_t *stats);
+
+#endif
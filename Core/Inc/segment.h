@@ -4,8 +4,73 @@
 #include "bms_config.h"
 #include "stm32h5xx.h"
 #include "adBms6830Data.h"
+#include "adi6830_interation.h"
 #include <stdbool.h>
 
+/**
+ * @brief Timing of the acquisition cycles, used to measure acquisition latency.
+ */
+typedef struct {
+	/* duration of the most recent acquisition cycle */
+	uint32_t last_cycle_us;
+	/* longest acquisition cycle since boot */
+	uint32_t max_cycle_us;
+	/* what the last cycle would have taken if every transaction re-woke the chain */
+	uint32_t last_cycle_always_wake_us;
+	/* time between the starts of the last two cycles, the achieved scan period */
+	uint32_t last_period_us;
+	/* link usage during the most recent cycle */
+	adbms_link_stats_t link;
+} segment_scan_stats_t;
+
+/**
+ * @brief Quantities measured by the segment sequencer, in the order they are measured within a scan.
+ */
+typedef enum {
+	SEQ_OVUV,
+	SEQ_CELLS,
+	SEQ_THERMS,
+	SEQ_STATUS,
+	SEQ_S_ADC,
+	SEQ_OPEN_WIRE,
+	SEQ_SERIAL_ID,
+	SEQ_QUANTITIES
+} segment_quantity_t;
+
+/* Chip mask with every chip in the pack set, see segment_take_dirty() */
+#define SEGMENT_ALL_CHIPS ((1UL << (NUM_CHIPS)) - 1)
+
+/**
+ * @brief Requested and achieved rate of a sequencer quantity.
+ */
+typedef struct {
+	const char *name;
+	/* rates in mHz, so slow diagnostics still resolve */
+	uint32_t requested_mhz;
+	uint32_t achieved_mhz;
+	/* time between the last two measurements */
+	uint32_t last_interval_ms;
+	/* time the last measurement took on the chain */
+	uint32_t last_duration_us;
+	uint32_t runs;
+} segment_seq_stats_t;
+
+/**
+ * @brief Instant the cell voltages of the last cell measurement were taken at, and the pack current
+ * sampled with them.
+ */
+typedef struct {
+	/* adbms_get_us() when the cell voltages were frozen */
+	uint32_t timestamp_us;
+	float pack_current;
+	/* false if no current sampler is set, pack_current is then 0 */
+	bool has_current;
+	/* false if the cell registers were read live, and groups may be from different conversions */
+	bool coherent;
+	/* incremented on every cell measurement */
+	uint32_t seq;
+} segment_snapshot_t;
+
 /**
  * @brief Initialize chips with default values.
  * 
@@ -38,20 +103,58 @@ void segment_snap(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
 void segment_unsnap(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
 
 /**
- * @brief Pulls all cell data from the segments and returns all cell data.  For drive mode.
+ * @brief Run one scan of the measurement sequencer, measuring whatever quantity is due.  For drive mode.
  *
  */
 void segment_retrieve_active_data(cell_asic chips[NUM_CHIPS],
 				  SPI_HandleTypeDef *hspi);
 /**
- * @brief Pulls all cell data from the segments and returns all cell data.  For charge mode.
+ * @brief Run one scan of the measurement sequencer, measuring whatever quantity is due.  For charge mode,
+ * cells are read from single shot C-ADC conversions.
  *
  */
 void segment_retrieve_charging_data(cell_asic chips[NUM_CHIPS],
 				    SPI_HandleTypeDef *hspi);
 
 /**
- * @brief Fetch extra data for segment
+ * @brief Switch between pipelined and sequential acquisition, pipelined by default.
+ * 
+ * When pipelined, the AUX2 conversion for the next therm measurement is started right after each
+ * readout, so it converts between scans.  Therm readings are one measurement old.
+ * 
+ * @param pipelined true to overlap conversions with readout.
+ */
+void segment_set_pipelined(bool pipelined);
+
+/**
+ * @brief Switch coherent snapshots on or off, on by default.
+ * 
+ * With snapshots on, the result registers are frozen with SNAP before the cell voltages are read
+ * and released with UNSNAP after, and the pack current is sampled at the instant they were frozen.
+ * Every register group then comes from the same conversion as the current.
+ * 
+ * @param enabled true to freeze the cell registers around every cell measurement.
+ */
+void segment_set_snapshots(bool enabled);
+
+/**
+ * @brief Set the function sampling the pack current at the instant of a snapshot.  It must return
+ * quickly, it runs while the result registers are frozen.  Nothing registers one yet, there is no pack
+ * current source in the tree, so snapshots carry has_current false until one is.
+ * 
+ * @param sample Returns the pack current in A, NULL for none.
+ */
+void segment_set_current_sampler(float (*sample)(void));
+
+/**
+ * @brief Get the instant and pack current of the last cell measurement.
+ * 
+ * @param snap Struct to copy the snapshot into.
+ */
+void segment_get_snapshot(segment_snapshot_t *snap);
+
+/**
+ * @brief Measure every quantity of the sequencer now, whether it is due or not.
  * 
  */
 void segment_retrieve_debug_data(cell_asic chips[NUM_CHIPS],
@@ -121,4 +224,38 @@ void get_adc_comparison(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
  */
 void read_serial_id(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
 
+/**
+ * @brief Get timing and link statistics of the latest acquisition cycle.
+ * 
+ * @param stats Struct to copy the statistics into.
+ */
+void segment_get_scan_stats(segment_scan_stats_t *stats);
+
+/**
+ * @brief Get the requested and achieved rate of a quantity measured by the sequencer.
+ * 
+ * @param quantity Quantity to get stats of.
+ * @param stats Struct to copy the stats into.
+ */
+void segment_get_seq_stats(segment_quantity_t quantity,
+			   segment_seq_stats_t *stats);
+
+/**
+ * @brief Take the chips whose measurement of a quantity has been refreshed since the last take, and clear them.
+ * A chip is only marked once its registers pass PEC, so the analyzer can recompute just the cells that changed.
+ * Lock free, the scan marks chips and this takes them atomically, so it is safe from any thread.
+ * 
+ * @param quantity Quantity to take the refreshed chips of.
+ * @return uint32_t Bit per chip, set if the chip was refreshed.
+ */
+uint32_t segment_take_dirty(segment_quantity_t quantity);
+
+/**
+ * @brief Get the cells found open by the last open wire check.
+ * 
+ * @param chip Chip to get the open wires of.
+ * @return uint16_t Bit per cell, set if the cell's sense wire is open.
+ */
+uint16_t segment_get_open_wires(uint8_t chip);
+
 #endif
\ No newline at end of file
@@ -6,6 +6,7 @@
 
 extern mutex_t logger_mutex;
 extern mutex_t bms_mutex;
+extern mutex_t fault_trace_mutex;
 
 uint8_t mutexes_init(); // Initializes all mutexes
 
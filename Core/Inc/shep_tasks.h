@@ -16,5 +16,7 @@ uint8_t shep_threads_init(TX_BYTE_POOL *byte_pool);
 uint8_t shep_flags_init();
 
 #define ANALYZER_FLAG 0x1
+/* set by the analyzer each time it publishes a pass, see pack_state.h */
+#define STATE_MACHINE_FLAG 0x1
 
 #endif
\ No newline at end of file
@@ -0,0 +1,94 @@
+/**
+ * @file soc.h
+ * @brief State of charge estimation, by an extended Kalman filter over coulomb counting and the OCV curve.
+ *
+ * Each filter tracks one cell group's state of charge and the variance of its error.  Between voltage
+ * readings the pack current is integrated against the group's capacity, and every voltage reading pulls
+ * the estimate towards the state of charge the OCV curve gives for it.  How hard it pulls depends on how
+ * much the reading can be trusted: fully at rest, barely under load, when the ohmic drop and polarization
+ * swamp the curve.
+ */
+
+#ifndef _SOC_H
+#define _SOC_H
+
+#include <stdint.h>
+
+/**
+ * @brief State of one state of charge filter.
+ */
+typedef struct {
+	/* state of charge, 0 to 1 */
+	float soc;
+	/* variance of the error of soc */
+	float var;
+} soc_ekf_t;
+
+/**
+ * @brief Start a filter from a voltage taken at rest.
+ *
+ * @param ekf Filter to start.
+ * @param ocv Open cell voltage of the group.
+ */
+void soc_ekf_init(soc_ekf_t *ekf, float ocv);
+
+/**
+ * @brief Integrate the current drawn from the group since the last step.
+ *
+ * @param ekf Filter to step.
+ * @param amps Current out of the group, positive discharging.
+ * @param dt_s Seconds the current flowed for.
+ * @param capacity_ah Capacity of the group.
+ */
+void soc_ekf_predict(soc_ekf_t *ekf, float amps, float dt_s,
+		     float capacity_ah);
+
+/**
+ * @brief Variance of a voltage reading as a measure of the OCV.  It is the same for every group in the pack,
+ * so take it once per reading.
+ *
+ * @param amps Current out of the groups when the voltages were taken, positive discharging.
+ * @param rest_s Seconds since the current last went over OCV_CURR_THRESH.
+ * @return float Variance in V^2.
+ */
+float soc_voltage_noise(float amps, float rest_s);
+
+/**
+ * @brief Correct the state of charge with a voltage reading.
+ *
+ * @param ekf Filter to correct.
+ * @param volts Terminal voltage of the group.
+ * @param amps Current out of the group when volts was taken, positive discharging.
+ * @param ohms Impedance of the group.
+ * @param noise soc_voltage_noise() of the reading.
+ */
+void soc_ekf_correct(soc_ekf_t *ekf, float volts, float amps, float ohms,
+		     float noise);
+
+/**
+ * @brief Look up the open cell voltage of a state of charge.
+ *
+ * @param soc State of charge, 0 to 1.
+ * @param slope If not NULL, set to dOCV/dSoC at soc, in V.
+ * @return float The open cell voltage.
+ */
+float soc_ocv(float soc, float *slope);
+
+/**
+ * @brief Look up the state of charge of an open cell voltage.
+ *
+ * @param ocv Open cell voltage.
+ * @return float The state of charge, 0 to 1.
+ */
+float soc_from_ocv(float ocv);
+
+/**
+ * @brief Integral of the OCV curve from empty to a state of charge.  Times capacity in Ah, it is the energy in
+ * Wh a group delivers from that state of charge down to empty, at rest.
+ *
+ * @param soc State of charge, 0 to 1.
+ * @return float The integral, in V.
+ */
+float soc_energy(float soc);
+
+#endif
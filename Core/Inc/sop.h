@@ -0,0 +1,57 @@
+/**
+ * @file sop.h
+ * @brief State of power, the currents a cell group can carry for a while without leaving its voltage limits.
+ *
+ * Under a constant current I, the group's voltage after T seconds is
+ *
+ *   V(T) = OCV - slope * I * T / C - I * R0 - I * R1 * (1 - e^(-T / tau)) - V1 * e^(-T / tau)
+ *
+ * where the OCV falls along its curve as charge C is drawn, R0 and R1 are the ohmic and polarization
+ * resistances of impedance.h, and V1 is the polarization the group already carries.  Solving for the I
+ * that puts V(T) on the limit gives the limit for that horizon.
+ */
+
+#ifndef _SOP_H
+#define _SOP_H
+
+#include "datastructs.h"
+
+/* Horizon of the continuous limits, in s */
+#define SOP_CONT_S 60.0f
+
+/**
+ * @brief Electrical state of one group, as the limits see it.
+ */
+typedef struct {
+	/* open cell voltage, and its slope against state of charge, in V */
+	float ocv;
+	float slope;
+	/* capacity in Ah */
+	float capacity;
+	/* ohmic and polarization resistance */
+	float r0;
+	float r1;
+	/* voltage across the RC pair now, positive after discharging */
+	float polarization;
+} sop_cell_t;
+
+/**
+ * @brief Start the pack limits before taking the groups in with sop_cell_limits().
+ *
+ * @param dcl Discharge limit of each horizon.
+ * @param ccl Charge limit of each horizon.
+ */
+void sop_limits_init(float dcl[SOP_HORIZONS], float ccl[SOP_HORIZONS]);
+
+/**
+ * @brief Lower the pack limits to a group's.  The groups are in series, so the pack can carry the least of
+ * them.
+ *
+ * @param cell The group.
+ * @param dcl Discharge limit of each horizon, lowered to the group's.
+ * @param ccl Charge limit of each horizon, lowered to the group's.
+ */
+void sop_cell_limits(const sop_cell_t *cell, float dcl[SOP_HORIZONS],
+		     float ccl[SOP_HORIZONS]);
+
+#endif
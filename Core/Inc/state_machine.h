@@ -3,13 +3,7 @@
 #define _STATE_MACHINE_H
 
 #include "analyzer.h"
-
-#define NUM_FAULTS 8
-
-typedef enum {
-	FAULT_STAT_FAULTED = 1,
-	FAULT_STAT_CLEARED = 2,
-} fault_stat_t;
+#include "fault_table.h"
 
 /**
  * @brief Called when we receive a message from the charger
@@ -45,15 +39,6 @@ bool sm_charging_check(bms_t *bmsdata);
  */
 void sm_fault_return(bms_t *accData);
 
-/**
- * @brief Used in parellel to faultReturn(), calculates each fault to append the
- * fault status
- *
- * @param fault_item
- * @return fault_status
- */
-fault_stat_t sm_fault_eval(fault_eval_t *fault_item);
-
 /**
  * @brief handles the state machine, calls the appropriate handler function and
  * runs every loop functions
@@ -70,4 +55,20 @@ void sm_handle_state(bms_t *bmsdata);
  */
 void sm_balance_cells(bms_t *bms_data);
 
+#ifdef DEBUG_STATS
+/**
+ * @brief Time a decision, from the snapshot it was made on through the state machine waking on its publish.
+ *
+ * @param bmsdata The pack state the state machine ran on.
+ * @param wake_us adbms_get_us() when the state machine woke.
+ * @param fresh false if the watchdog woke the state machine rather than a publish.
+ */
+void sm_log_latency(const bms_t *bmsdata, uint32_t wake_us, bool fresh);
+
+/**
+ * @brief Print the latest and worst decision latencies, and the wakeups, since the last print.
+ */
+void sm_print_latency(void);
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,35 @@
+/**
+ * @file therm_curve.h
+ * @brief Curve fit and dividers of the 10,000 ohm NTC thermistors (model 103).
+ *
+ * The fit is T = A8 * c^(1/8) + A4 * c^(1/4) + A2 * c^(1/2) + A1 * c + A0, with c = R / 10000.
+ * It was achieved via passing ThermCalcs.xlsx into
+ * https://www.standardsapplied.com/nonlinear-curve-fitting-calculator.html
+ *
+ * scripts/gen_therm_lut.py reads these defines to generate the temperature lookup tables, keep
+ * each one a plain number on its own line.
+ */
+
+#ifndef _THERM_CURVE_H
+#define _THERM_CURVE_H
+
+#define THERM_FIT_A8 -1149.531863
+#define THERM_FIT_A4 658.9396848
+#define THERM_FIT_A2 -87.8102815
+#define THERM_FIT_A1 2.034216235
+#define THERM_FIT_A0 601.008351
+/* Resistance the fit is normalized to */
+#define THERM_NOMINAL_OHMS 10000.0
+
+/* Every thermistor sits under a 5.6k pull up */
+#define THERM_PULLUP_OHMS 5600.0
+/* The flex PCB dividers are fed from 3 V, the onboard ones from 5 V */
+#define THERM_CELL_SUPPLY_V    3.0
+#define THERM_ONBOARD_SUPPLY_V 5.0
+
+/* Lookup table nodes are 2^THERM_LUT_SHIFT ADC codes apart, 4.8 mV */
+#define THERM_LUT_SHIFT 5
+/* Hottest temperature the tables report, the fit runs away below a few hundred ohms */
+#define THERM_LUT_MAX_C 125.0
+
+#endif
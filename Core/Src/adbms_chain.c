@@ -0,0 +1,228 @@
+/**
+ * @file adbms_chain.c
+ * @brief The isoSPI chain of the pack, and decoding of its responses.
+ */
+
+#include "adbms_chain.h"
+#include <string.h>
+
+void adbms_chain_bind(adbms_chain_t *chain, adbms_spi_t *spi,
+		      uint8_t num_chips)
+{
+	memset(chain, 0, sizeof(*chain));
+	chain->spi = spi;
+	chain->num_chips = num_chips;
+}
+
+uint16_t adbms_register_frame_bytes(TYPE type)
+{
+	switch (type) {
+	case Rdcvall:
+	case Rdacall:
+	case Rdsall:
+	case Rdfcall:
+		return RDALL_CELL_FRAME_BYTES;
+	case Rdcsall:
+	case Rdacsall:
+		return RDALL_CELL_S_FRAME_BYTES;
+	case Rdasall:
+		return RDASALL_FRAME_BYTES;
+	default:
+		return REG_GROUP_FRAME_BYTES;
+	}
+}
+
+/**
+ * @brief Get where the codes of a register read land in a chip, and its PEC counter.
+ *
+ * @param chip Chip to decode into.
+ * @param type Register type read.
+ * @param len Set to the number of codes in the array.
+ * @param pec_errors Set to the PEC error counter of the register type.
+ * @return int16_t* The code array, or NULL if this type is not decoded.  Keep in sync with adbms_chain_decodes().
+ */
+static int16_t *chain_codes(cell_asic *chip, TYPE type, uint8_t *len,
+			    uint8_t **pec_errors)
+{
+	switch (type) {
+	case Cell:
+	case Rdcvall:
+		*len = sizeof(chip->cell.c_codes) / sizeof(int16_t);
+		*pec_errors = &chip->cccrc.cell_pec;
+		return chip->cell.c_codes;
+	case AvgCell:
+	case Rdacall:
+		*len = sizeof(chip->acell.ac_codes) / sizeof(int16_t);
+		*pec_errors = &chip->cccrc.acell_pec;
+		return chip->acell.ac_codes;
+	case S_volt:
+	case Rdsall:
+		*len = sizeof(chip->scell.sc_codes) / sizeof(int16_t);
+		*pec_errors = &chip->cccrc.scell_pec;
+		return chip->scell.sc_codes;
+	case F_volt:
+	case Rdfcall:
+		*len = sizeof(chip->fcell.fc_codes) / sizeof(int16_t);
+		*pec_errors = &chip->cccrc.fcell_pec;
+		return chip->fcell.fc_codes;
+	case Aux:
+		*len = sizeof(chip->aux.a_codes) / sizeof(int16_t);
+		*pec_errors = &chip->cccrc.aux_pec;
+		return chip->aux.a_codes;
+	case RAux:
+		*len = sizeof(chip->raux.ra_codes) / sizeof(int16_t);
+		*pec_errors = &chip->cccrc.raux_pec;
+		return chip->raux.ra_codes;
+	default:
+		return NULL;
+	}
+}
+
+bool adbms_chain_decodes(TYPE type)
+{
+	switch (type) {
+	case Cell:
+	case Rdcvall:
+	case AvgCell:
+	case Rdacall:
+	case S_volt:
+	case Rdsall:
+	case F_volt:
+	case Rdfcall:
+	case Aux:
+	case RAux:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Check the chain can take one more descriptor, and optionally a response.
+ *
+ * @param ic_bytes Bytes each IC responds with, 0 for a bare command.
+ */
+static bool chain_has_room(adbms_chain_t *chain, uint16_t ic_bytes)
+{
+	return adbms_spi_queued(chain->spi) < ADBMS_SPI_QUEUE_LEN &&
+	       chain->count < ADBMS_SPI_QUEUE_LEN &&
+	       chain->used + chain->num_chips * ic_bytes <= sizeof(chain->rx);
+}
+
+int adbms_chain_queue_read(adbms_chain_t *chain, uint8_t cmd[2], TYPE type,
+			   GRP group)
+{
+	uint16_t ic_bytes = adbms_register_frame_bytes(type);
+
+	if (!adbms_chain_decodes(type) || !chain_has_room(chain, ic_bytes)) {
+		return -1;
+	}
+
+	adbms_spi_queue_read(chain->spi, cmd, &chain->rx[chain->used],
+			     ic_bytes);
+
+	chain->reads[chain->count].type = type;
+	chain->reads[chain->count].group = group;
+	chain->reads[chain->count].offset = chain->used;
+	chain->reads[chain->count].ic_bytes = ic_bytes;
+	chain->count++;
+	chain->used += chain->num_chips * ic_bytes;
+
+	return 0;
+}
+
+int adbms_chain_queue_cmd(adbms_chain_t *chain, uint8_t cmd[2])
+{
+	if (!chain_has_room(chain, 0)) {
+		return -1;
+	}
+
+	return adbms_spi_queue_cmd(chain->spi, cmd);
+}
+
+/**
+ * @brief Decode the reads of the chain into its chips, then clear them.
+ *
+ * @param ok false if the chain's transfers failed, every read is then a PEC error.
+ * @param failed Bits of the chips that fail are set per read, NULL if not needed.
+ */
+static void chain_decode(adbms_chain_t *chain, cell_asic chips[NUM_CHIPS],
+			 bool ok, uint32_t *failed)
+{
+	for (uint8_t i = 0; i < chain->count; i++) {
+		uint16_t ic_bytes = chain->reads[i].ic_bytes;
+		GRP group = chain->reads[i].group;
+		/* groups hold 3 codes each, ALL commands start from the first */
+		uint8_t first = group == ALL_GRP ? 0 : (group - A) * 3;
+
+		for (uint8_t ic = 0; ic < chain->num_chips; ic++) {
+			cell_asic *chip = &chips[ic];
+			uint8_t *data =
+				&chain->rx[chain->reads[i].offset +
+					   ic * ic_bytes];
+			uint8_t len;
+			uint8_t *pec_errors;
+			int16_t *codes = chain_codes(
+				chip, chain->reads[i].type, &len, &pec_errors);
+
+			if (!ok || !adbms_pec10_check(data, ic_bytes)) {
+				(*pec_errors)++;
+				if (failed) {
+					failed[i] |= 1UL << ic;
+				}
+				continue;
+			}
+
+			chip->cccrc.cmd_cntr = data[ic_bytes - 2] >> 2;
+			for (uint8_t code = 0;
+			     code < (ic_bytes - 2) / 2 && first + code < len;
+			     code++) {
+				codes[first + code] =
+					(int16_t)(data[2 * code] |
+						  (data[2 * code + 1] << 8));
+			}
+		}
+	}
+
+	chain->count = 0;
+	chain->used = 0;
+}
+
+int adbms_chain_run(adbms_chain_t *chain, cell_asic chips[NUM_CHIPS],
+		    uint32_t failed[ADBMS_SPI_QUEUE_LEN])
+{
+	if (failed) {
+		memset(failed, 0, ADBMS_SPI_QUEUE_LEN * sizeof(failed[0]));
+	}
+
+	bool ok = adbms_spi_run(chain->spi) == 0;
+	chain_decode(chain, chips, ok, failed);
+
+	return ok ? 0 : -1;
+}
+
+#ifndef ADBMS_SPI_MOCK
+
+extern SPI_HandleTypeDef hspi1;
+
+static adbms_chain_t pack_chain;
+static bool pack_bound = false;
+
+adbms_chain_t *adbms_pack_chain(void)
+{
+	if (pack_bound) {
+		return &pack_chain;
+	}
+
+	// the driver's port and chip select, so reads here and commands through the driver share the chain
+	adbms_spi_t *spi = adbms_spi_get(&hspi1);
+	if (!spi) {
+		return NULL;
+	}
+	adbms_chain_bind(&pack_chain, spi, NUM_CHIPS);
+
+	pack_bound = true;
+	return &pack_chain;
+}
+
+#endif
@@ -0,0 +1,366 @@
+/**
+ * @file adbms_spi.c
+ * @brief Non-blocking transaction engine for the ADBMS6830 isoSPI chain, and its DMA backend.
+ */
+
+#include "adbms_spi.h"
+#include <string.h>
+
+#ifndef ADBMS_SPI_MOCK
+#include "mcuWrapper.h"
+#endif
+
+/* Clocked out while the ICs shift their response in, reads ignore MOSI */
+static uint8_t dummy_tx[ADBMS_SPI_MAX_RESPONSE];
+
+uint16_t adbms_pec15(const uint8_t *data, uint8_t len)
+{
+	uint16_t remainder = 16; /* PEC seed */
+
+	for (uint8_t i = 0; i < len; i++) {
+		remainder ^= (uint16_t)data[i] << 7;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			if (remainder & 0x4000) {
+				/* x15 + x14 + x10 + x8 + x7 + x4 + x3 + 1 */
+				remainder = (remainder << 1) ^ 0x4599;
+			} else {
+				remainder <<= 1;
+			}
+			remainder &= 0x7FFF;
+		}
+	}
+
+	/* the PEC is sent with a trailing 0 */
+	return remainder << 1;
+}
+
+uint16_t adbms_pec10(const uint8_t *data, uint16_t len)
+{
+	uint16_t remainder = 16; /* PEC seed */
+
+	for (uint16_t i = 0; i < len; i++) {
+		remainder ^= (uint16_t)data[i] << 2;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			if (remainder & 0x200) {
+				/* x10 + x7 + x3 + x2 + x + 1 */
+				remainder = (remainder << 1) ^ 0x8F;
+			} else {
+				remainder <<= 1;
+			}
+		}
+	}
+
+	/* the 6 bit command counter shares the first PEC byte, and is covered by the PEC */
+	remainder ^= (uint16_t)(data[len] & 0xFC) << 2;
+	for (uint8_t bit = 0; bit < 6; bit++) {
+		if (remainder & 0x200) {
+			remainder = (remainder << 1) ^ 0x8F;
+		} else {
+			remainder <<= 1;
+		}
+	}
+
+	return remainder & 0x3FF;
+}
+
+bool adbms_pec10_check(const uint8_t *ic_data, uint16_t ic_bytes)
+{
+	uint16_t len = ic_bytes - 2;
+	uint16_t received = ((uint16_t)(ic_data[len] & 0x03) << 8) |
+			    ic_data[len + 1];
+
+	return adbms_pec10(ic_data, len) == received;
+}
+
+int adbms_spi_init(adbms_spi_t *spi, const adbms_spi_backend_t *backend,
+		   uint8_t num_chips, char *name)
+{
+	memset(spi, 0, sizeof(*spi));
+	spi->backend = *backend;
+	spi->num_chips = num_chips;
+
+	memset(dummy_tx, 0xFF, sizeof(dummy_tx));
+
+#ifndef ADBMS_SPI_MOCK
+	if (tx_semaphore_create(&spi->done, name, 0) != TX_SUCCESS) {
+		return -1;
+	}
+#else
+	(void)name;
+#endif
+
+	return 0;
+}
+
+uint8_t adbms_spi_queued(const adbms_spi_t *spi)
+{
+	return spi->count;
+}
+
+/**
+ * @brief Claim the next free descriptor and build its command frame.
+ *
+ * @param spi Engine to queue on.
+ * @param cmd 2 byte command.
+ * @return adbms_spi_desc_t* The descriptor, or NULL if the queue is full or running.
+ */
+static adbms_spi_desc_t *queue_desc(adbms_spi_t *spi, const uint8_t cmd[2])
+{
+	if (spi->busy || spi->count >= ADBMS_SPI_QUEUE_LEN) {
+		return NULL;
+	}
+
+	adbms_spi_desc_t *desc = &spi->queue[spi->count++];
+	uint16_t pec = adbms_pec15(cmd, 2);
+
+	desc->cmd[0] = cmd[0];
+	desc->cmd[1] = cmd[1];
+	desc->cmd[2] = (uint8_t)(pec >> 8);
+	desc->cmd[3] = (uint8_t)pec;
+	desc->rx = NULL;
+	desc->ic_bytes = 0;
+
+	return desc;
+}
+
+int adbms_spi_queue_cmd(adbms_spi_t *spi, const uint8_t cmd[2])
+{
+	return queue_desc(spi, cmd) ? 0 : -1;
+}
+
+int adbms_spi_queue_read(adbms_spi_t *spi, const uint8_t cmd[2], uint8_t *rx,
+			 uint16_t ic_bytes)
+{
+	if (spi->num_chips * ic_bytes > ADBMS_SPI_MAX_RESPONSE) {
+		return -1;
+	}
+
+	adbms_spi_desc_t *desc = queue_desc(spi, cmd);
+	if (!desc) {
+		return -1;
+	}
+
+	desc->rx = rx;
+	desc->ic_bytes = ic_bytes;
+
+	return 0;
+}
+
+/**
+ * @brief Mark the queue as done, and wake the thread running it.
+ *
+ * @param spi Engine to finish.
+ * @param ok false if any transfer failed.
+ */
+static void finish_queue(adbms_spi_t *spi, bool ok)
+{
+	spi->failed = !ok;
+	spi->count = 0;
+	spi->current = 0;
+	spi->busy = false;
+
+#ifndef ADBMS_SPI_MOCK
+	tx_semaphore_put(&spi->done);
+#endif
+}
+
+/**
+ * @brief Select the chain and send the command of the current descriptor.
+ *
+ * @param spi Engine to start.
+ * @return 0 if the transfer started, -1 otherwise.
+ */
+static int start_current(adbms_spi_t *spi)
+{
+	adbms_spi_desc_t *desc = &spi->queue[spi->current];
+
+	spi->data_phase = false;
+	spi->backend.select(spi->backend.ctx, true);
+
+	return spi->backend.transfer(spi->backend.ctx, desc->cmd, NULL,
+				     CMD_FRAME_BYTES);
+}
+
+void adbms_spi_transfer_done(adbms_spi_t *spi, bool ok)
+{
+	adbms_spi_desc_t *desc = &spi->queue[spi->current];
+
+	// the command is out, clock in the response before releasing CS
+	if (ok && !spi->data_phase && desc->rx) {
+		spi->data_phase = true;
+		if (spi->backend.transfer(spi->backend.ctx, dummy_tx, desc->rx,
+					  spi->num_chips * desc->ic_bytes) == 0) {
+			return;
+		}
+		ok = false;
+	}
+
+	spi->backend.select(spi->backend.ctx, false);
+
+	if (!ok) {
+		finish_queue(spi, false);
+		return;
+	}
+
+	spi->current++;
+	if (spi->current < spi->count) {
+		if (start_current(spi) == 0) {
+			return;
+		}
+		spi->backend.select(spi->backend.ctx, false);
+		finish_queue(spi, false);
+		return;
+	}
+
+	finish_queue(spi, true);
+}
+
+/**
+ * @brief Put everything queued on the wire, without waiting for it.
+ *
+ * @param spi Engine to start.
+ */
+static void start_queue(adbms_spi_t *spi)
+{
+	if (spi->count == 0) {
+		spi->failed = false;
+		return;
+	}
+
+#ifndef ADBMS_SPI_MOCK
+	// drop a completion left over from a queue that timed out
+	while (tx_semaphore_get(&spi->done, TX_NO_WAIT) == TX_SUCCESS)
+		;
+#endif
+
+	spi->busy = true;
+	spi->failed = false;
+	spi->current = 0;
+
+	if (start_current(spi) != 0) {
+		spi->backend.select(spi->backend.ctx, false);
+		finish_queue(spi, false);
+	}
+}
+
+/**
+ * @brief Sleep until a started queue is done.  Clears the queue.
+ *
+ * @param spi Engine to wait for.
+ * @return 0 on success, -1 on a transfer error or timeout.
+ */
+static int wait_queue(adbms_spi_t *spi)
+{
+	// the mock backend completes every transfer before returning, there is nothing to sleep on
+#ifndef ADBMS_SPI_MOCK
+	if (spi->busy || spi->count > 0) {
+		if (tx_semaphore_get(&spi->done, ADBMS_SPI_TIMEOUT_TICKS) !=
+		    TX_SUCCESS) {
+			if (spi->backend.abort) {
+				spi->backend.abort(spi->backend.ctx);
+			}
+			spi->backend.select(spi->backend.ctx, false);
+			spi->count = 0;
+			spi->busy = false;
+			return -1;
+		}
+	}
+#endif
+
+	return spi->failed ? -1 : 0;
+}
+
+int adbms_spi_run(adbms_spi_t *spi)
+{
+	if (spi->count == 0) {
+		return 0;
+	}
+
+	start_queue(spi);
+	return wait_queue(spi);
+}
+
+#ifndef ADBMS_SPI_MOCK
+
+// --- BEGIN DMA BACKEND ---
+
+/* The engine of the chain, and the SPI peripheral it is bound to */
+static adbms_spi_t chain_spi;
+static SPI_HandleTypeDef *chain_hspi = NULL;
+
+static int dma_transfer(void *ctx, const uint8_t *tx, uint8_t *rx,
+			uint16_t len)
+{
+	SPI_HandleTypeDef *hspi = ctx;
+	HAL_StatusTypeDef status;
+
+	if (rx) {
+		status = HAL_SPI_TransmitReceive_DMA(hspi, (uint8_t *)tx, rx,
+						     len);
+	} else {
+		status = HAL_SPI_Transmit_DMA(hspi, (uint8_t *)tx, len);
+	}
+
+	return status == HAL_OK ? 0 : -1;
+}
+
+static void dma_select(void *ctx, bool asserted)
+{
+	(void)ctx;
+
+	// the driver's chip select, commands through the driver and the engine share the chain
+	if (asserted) {
+		adBmsCsLow();
+	} else {
+		adBmsCsHigh();
+	}
+}
+
+static void dma_abort(void *ctx)
+{
+	HAL_SPI_Abort((SPI_HandleTypeDef *)ctx);
+}
+
+adbms_spi_t *adbms_spi_get(SPI_HandleTypeDef *hspi)
+{
+	if (chain_hspi) {
+		return chain_hspi == hspi ? &chain_spi : NULL;
+	}
+
+	adbms_spi_backend_t backend = { .transfer = dma_transfer,
+					.select = dma_select,
+					.abort = dma_abort,
+					.ctx = hspi };
+	if (adbms_spi_init(&chain_spi, &backend, NUM_CHIPS, "ADBMS SPI Done") !=
+	    0) {
+		return NULL;
+	}
+	chain_hspi = hspi;
+
+	return &chain_spi;
+}
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if (hspi == chain_hspi) {
+		adbms_spi_transfer_done(&chain_spi, true);
+	}
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if (hspi == chain_hspi) {
+		adbms_spi_transfer_done(&chain_spi, true);
+	}
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+	if (hspi == chain_hspi) {
+		adbms_spi_transfer_done(&chain_spi, false);
+	}
+}
+
+// --- END DMA BACKEND ---
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file adbms_spi_mock.c
+ * @brief Simulated chain for the ADBMS SPI engine, for exercising the engine off target.
+ *
+ * Not part of the firmware build, the host tests in Tests/ compile it together with adbms_spi.c and -DADBMS_SPI_MOCK.
+ */
+
+#ifdef ADBMS_SPI_MOCK
+
+#include "adbms_spi.h"
+#include <string.h>
+
+/**
+ * @brief Fill a read response, as every IC in the chain would shift it out.
+ *
+ */
+static void fill_response(adbms_spi_mock_t *mock, uint8_t *rx, uint16_t len)
+{
+	uint16_t ic_bytes = len / mock->spi->num_chips;
+	uint16_t data_bytes = ic_bytes - 2;
+
+	for (uint8_t chip = 0; chip < mock->spi->num_chips; chip++) {
+		uint8_t *ic = &rx[chip * ic_bytes];
+
+		memcpy(ic, mock->regs[chip], data_bytes);
+		/* command counter of 1, a fresh IC has just been reset */
+		ic[data_bytes] = 1 << 2;
+		uint16_t pec = adbms_pec10(ic, data_bytes);
+		if (chip == mock->corrupt_chip) {
+			pec ^= 1;
+		}
+		ic[data_bytes] |= (uint8_t)(pec >> 8);
+		ic[data_bytes + 1] = (uint8_t)pec;
+	}
+	mock->corrupt_chip = -1;
+}
+
+static int mock_transfer(void *ctx, const uint8_t *tx, uint8_t *rx,
+			 uint16_t len)
+{
+	adbms_spi_mock_t *mock = ctx;
+
+	if (!mock->selected) {
+		return -1;
+	}
+
+	if (rx) {
+		fill_response(mock, rx, len);
+	} else {
+		memcpy(mock->last_cmd, tx, CMD_FRAME_BYTES);
+		mock->cmds_seen++;
+	}
+
+	adbms_spi_transfer_done(mock->spi, true);
+	return 0;
+}
+
+static void mock_select(void *ctx, bool asserted)
+{
+	adbms_spi_mock_t *mock = ctx;
+	mock->selected = asserted;
+}
+
+int adbms_spi_mock_init(adbms_spi_mock_t *mock, adbms_spi_t *spi,
+			uint8_t num_chips)
+{
+	if (num_chips > NUM_CHIPS) {
+		return -1;
+	}
+
+	memset(mock, 0, sizeof(*mock));
+	mock->spi = spi;
+	mock->corrupt_chip = -1;
+
+	adbms_spi_backend_t backend = { .transfer = mock_transfer,
+					.select = mock_select,
+					.abort = NULL,
+					.ctx = mock };
+
+	return adbms_spi_init(spi, &backend, num_chips, "ADBMS SPI Mock");
+}
+
+#endif
@@ -4,30 +4,35 @@
 //#include "can_messages.h" // TODO set up can messages
 #include "compute.h"
 #include "mcuWrapper.h"
+#include "tx_api.h"
 
 /**
- * @brief Count and reset PEC errors for all chips, then send a CAN message if needed.
+ * @brief Sum the PEC error counters of a chip.
  *
- * This function iterates through all chips, accumulates the PEC (Packet Error Code) 
- * error count, resets the PEC error counter and Command counter, then sends a CAN message if any errors exist.
+ * @param chip Chip containing PEC error data.
+ */
+static uint16_t sum_pec_errors(cell_asic *chip)
+{
+	return (uint16_t)(chip->cccrc.cfgr_pec + chip->cccrc.cell_pec +
+			  chip->cccrc.acell_pec + chip->cccrc.scell_pec +
+			  chip->cccrc.fcell_pec + chip->cccrc.aux_pec +
+			  chip->cccrc.raux_pec + chip->cccrc.stat_pec +
+			  chip->cccrc.comm_pec + chip->cccrc.pwm_pec +
+			  chip->cccrc.sid_pec);
+}
+
+/**
+ * @brief Print and reset PEC errors for all chips.
+ *
+ * Errors are tracked per register as they happen, see pec_record(), and reach CAN through the link quality
+ * message.  This only logs them and resets the PEC error counter and Command counter.
  *
  * @param chips Array of chips containing PEC error data.
  */
 static void count_pec_errors(cell_asic chips[NUM_CHIPS])
 {
 	for (uint8_t chip = 0U; chip < NUM_CHIPS; chip++) {
-		uint16_t pec_error_count =
-			(uint16_t)(chips[chip].cccrc.cfgr_pec +
-				   chips[chip].cccrc.cell_pec +
-				   chips[chip].cccrc.acell_pec +
-				   chips[chip].cccrc.scell_pec +
-				   chips[chip].cccrc.fcell_pec +
-				   chips[chip].cccrc.aux_pec +
-				   chips[chip].cccrc.raux_pec +
-				   chips[chip].cccrc.stat_pec +
-				   chips[chip].cccrc.comm_pec +
-				   chips[chip].cccrc.pwm_pec +
-				   chips[chip].cccrc.sid_pec);
+		uint16_t pec_error_count = sum_pec_errors(&chips[chip]);
 
 		// printf("1 %d\n", chips[chip].cccrc.cfgr_pec);
 		// printf("b %d\n", chips[chip].cccrc.cell_pec);
@@ -93,8 +98,6 @@ static void count_pec_errors(cell_asic chips[NUM_CHIPS])
 				}
 				printf("\n");
 			}
-
-			send_pec_error_message(chip, pec_error_count);
 		}
 
 		memset(&(chips[chip].cccrc), 0, sizeof(chips[chip].cccrc));
@@ -222,19 +225,85 @@ inline void delay_us(uint32_t us)
 }
 
 /**
- * @brief Wake the isoSPI of every ADBMS6830 IC in the daisy chain. Blocking critical section wait for around 30us * NUM_CHIPS.
+ * @brief State of the isoSPI link, used to skip wake pulses while the chain is still awake.
+ */
+static struct {
+	/* TIM2 timestamp of the last CS edge on the chain */
+	uint32_t last_activity_us;
+	/* false until the first wake, or after a soft reset */
+	bool awake;
+	adbms_link_stats_t stats;
+} isospi_link = { 0 };
+
+uint32_t adbms_get_us(void)
+{
+	return __HAL_TIM_GET_COUNTER(&htim2);
+}
+
+/**
+ * @brief Record isoSPI activity on the chain.  Call after every transaction, the idle timer restarts on each CS edge.
+ * 
+ */
+static inline void isospi_mark_activity(void)
+{
+	isospi_link.last_activity_us = adbms_get_us();
+}
+
+/**
+ * @brief Record a frame sent on the chain, for link activity and bus usage.
+ * 
+ * @param ic_bytes Bytes shifted per IC after the command, 0 for a bare command.
+ */
+static inline void isospi_record_frame(uint16_t ic_bytes)
+{
+	isospi_mark_activity();
+	isospi_link.stats.transactions++;
+	isospi_link.stats.bytes += CMD_FRAME_BYTES + NUM_CHIPS * ic_bytes;
+}
+
+/**
+ * @brief Wake the isoSPI of every ADBMS6830 IC in the daisy chain. Blocking critical section wait for around 1ms * NUM_CHIPS.
+ * 
+ * Wake pulses are only sent if the chain could have gone idle since the last transaction (tIDLE), otherwise this returns immediately.
  * 
  * Takes in the SPI object as an onwership strategy, it is externed inside the driver
  * 
  */
 void adbms_wake_isospi(SPI_HandleTypeDef *hspi)
 {
+	uint32_t idle_us = adbms_get_us() - isospi_link.last_activity_us;
+
+	if (isospi_link.awake &&
+	    idle_us < ISOSPI_IDLE_TIMEOUT_US - ISOSPI_WAKE_MARGIN_US) {
+		isospi_link.stats.wakes_skipped++;
+		return;
+	}
+
+	// the cores go to sleep after tSLEEP, the wake below still wakes them but the registers are reset
+	if (isospi_link.awake && idle_us >= CORE_SLEEP_TIMEOUT_US) {
+		isospi_link.stats.sleep_timeouts++;
+	}
+
 	for (uint8_t ic = 0; ic < NUM_CHIPS; ic++) {
 		adBmsCsLow();
 		delay_us(500);
 		adBmsCsHigh();
 		delay_us(500);
 	}
+
+	isospi_link.awake = true;
+	isospi_link.stats.wakes_sent++;
+	isospi_mark_activity();
+}
+
+void adbms_get_link_stats(adbms_link_stats_t *stats)
+{
+	*stats = isospi_link.stats;
+}
+
+void adbms_reset_link_stats(void)
+{
+	memset(&isospi_link.stats, 0, sizeof(isospi_link.stats));
 }
 
 /**
@@ -264,24 +333,443 @@ void write_adbms_data(cell_asic chips[NUM_CHIPS], uint8_t command[2], TYPE type,
 	adbms_wake_isospi(hspi);
 
 	adBmsWriteData(NUM_CHIPS, chips, command, type, group);
+	isospi_record_frame(type == Clrflag ? REG_GROUP_FRAME_BYTES :
+					      adbms_register_frame_bytes(type));
+}
+
+// --- BEGIN PEC TRACKING ---
+
+static struct {
+	/* bit per read, newest in bit 0, set if the read failed PEC */
+	uint32_t history[NUM_CHIPS][ADBMS_REGS];
+	/* reads in the history, up to PEC_WINDOW_READS */
+	uint8_t reads[NUM_CHIPS][ADBMS_REGS];
+	/* bit per GRP whose data failed PEC on every retry of its last read */
+	uint8_t stale[NUM_CHIPS][ADBMS_REGS];
+	uint32_t retries;
+	uint32_t exhausted;
+} pec_quality = { 0 };
+
+/**
+ * @brief Get the PEC counter a register type is tracked under.
+ * 
+ * @param type Register type read.
+ * @return adbms_reg_t The tracked register, ADBMS_REGS if the type is not tracked.
+ */
+static adbms_reg_t pec_reg(TYPE type)
+{
+	switch (type) {
+	case Config:
+		return ADBMS_REG_CFG;
+	case Cell:
+	case Rdcvall:
+	case Rdcsall:
+		return ADBMS_REG_CELL;
+	case AvgCell:
+	case Rdacall:
+	case Rdacsall:
+		return ADBMS_REG_ACELL;
+	case S_volt:
+	case Rdsall:
+		return ADBMS_REG_SCELL;
+	case F_volt:
+	case Rdfcall:
+		return ADBMS_REG_FCELL;
+	case Aux:
+	case Rdasall:
+		return ADBMS_REG_AUX;
+	case RAux:
+		return ADBMS_REG_RAUX;
+	case Status:
+		return ADBMS_REG_STAT;
+	case Comm:
+		return ADBMS_REG_COMM;
+	case Pwm:
+		return ADBMS_REG_PWM;
+	case Sid:
+		return ADBMS_REG_SID;
+	default:
+		return ADBMS_REGS;
+	}
+}
+
+/**
+ * @brief Add a read to the error window of one register on every chip.
+ * 
+ * @param reg Register read.
+ * @param failed Bit per chip that failed PEC.
+ */
+static void pec_record_reg(adbms_reg_t reg, uint32_t failed)
+{
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		pec_quality.history[chip][reg] =
+			(pec_quality.history[chip][reg] << 1) |
+			((failed >> chip) & 1);
+		if (pec_quality.reads[chip][reg] < PEC_WINDOW_READS) {
+			pec_quality.reads[chip][reg]++;
+		}
+	}
+}
+
+/**
+ * @brief Add a read to the error window of every chip.
+ * 
+ * @param type Register type read.
+ * @param failed Bit per chip that failed PEC.
+ */
+static void pec_record(TYPE type, uint32_t failed)
+{
+	adbms_reg_t reg = pec_reg(type);
+	if (reg == ADBMS_REGS) {
+		return;
+	}
+
+	pec_record_reg(reg, failed);
+	// RDASALL carries the status registers behind the aux ones, under the same PEC
+	if (type == Rdasall) {
+		pec_record_reg(ADBMS_REG_STAT, failed);
+	}
+}
+
+/**
+ * @brief Mark the data of a group of one register stale on the chips that failed, fresh on the rest.
+ */
+static void pec_mark_reg(adbms_reg_t reg, GRP group, uint32_t failed)
+{
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		if ((failed >> chip) & 1) {
+			pec_quality.stale[chip][reg] |= 1 << group;
+		} else if (group == ALL_GRP) {
+			pec_quality.stale[chip][reg] = 0;
+		} else {
+			pec_quality.stale[chip][reg] &= ~(1 << group);
+		}
+	}
 }
 
 /**
- * @brief Read data from all chips.
+ * @brief Mark the data of a register group stale on the chips that failed its last read, fresh on the rest.
+ * 
+ * @param type Register type read.
+ * @param group Group read, ALL_GRP covers every group.
+ * @param failed Bit per chip that failed PEC.
+ */
+static void pec_mark(TYPE type, GRP group, uint32_t failed)
+{
+	adbms_reg_t reg = pec_reg(type);
+	if (reg == ADBMS_REGS) {
+		return;
+	}
+
+	pec_mark_reg(reg, group, failed);
+	if (type == Rdasall) {
+		pec_mark_reg(ADBMS_REG_STAT, group, failed);
+	}
+}
+
+/**
+ * @brief Get the chips whose PEC error counters went up since a read started.
+ * 
+ * @param before Sum of each chip's counters before the read.
+ * @return uint32_t Bit per chip that failed.
+ */
+static uint32_t pec_failed_chips(cell_asic chips[NUM_CHIPS],
+				 const uint16_t before[NUM_CHIPS])
+{
+	uint32_t failed = 0;
+
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		if (sum_pec_errors(&chips[chip]) != before[chip]) {
+			failed |= 1UL << chip;
+		}
+	}
+	return failed;
+}
+
+uint16_t adbms_get_pec_error_rate(uint8_t chip, adbms_reg_t reg)
+{
+	uint8_t reads = pec_quality.reads[chip][reg];
+	if (reads == 0) {
+		return 0;
+	}
+
+	uint32_t window = pec_quality.history[chip][reg];
+	if (reads < PEC_WINDOW_READS) {
+		window &= (1UL << reads) - 1;
+	}
+
+	return (uint16_t)(__builtin_popcount(window) * 10000 / reads);
+}
+
+uint16_t adbms_get_stale_regs(uint8_t chip)
+{
+	uint16_t regs = 0;
+
+	for (uint8_t reg = 0; reg < ADBMS_REGS; reg++) {
+		if (pec_quality.stale[chip][reg]) {
+			regs |= 1 << reg;
+		}
+	}
+	return regs;
+}
+
+void adbms_get_link_quality(adbms_link_quality_t *quality)
+{
+	uint32_t errors = 0;
+	uint32_t reads = 0;
+
+	memset(quality, 0, sizeof(*quality));
+	quality->retries = pec_quality.retries;
+	quality->exhausted = pec_quality.exhausted;
+
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		if (adbms_get_stale_regs(chip)) {
+			quality->stale_chips |= 1UL << chip;
+		}
+
+		for (uint8_t reg = 0; reg < ADBMS_REGS; reg++) {
+			uint16_t rate = adbms_get_pec_error_rate(chip, reg);
+
+			errors += rate * pec_quality.reads[chip][reg];
+			reads += pec_quality.reads[chip][reg];
+			if (rate > quality->worst_error_rate) {
+				quality->worst_error_rate = rate;
+				quality->worst_chip = chip;
+			}
+		}
+	}
+
+	// errors is in reads * 1/10000, so this is already a rate per 10000 reads
+	quality->pack_error_rate = reads ? errors / reads : 0;
+}
+
+// --- END PEC TRACKING ---
+
+/**
+ * @brief A single register group read, as issued by read_adbms_groups().
+ */
+typedef struct {
+	uint8_t *command;
+	TYPE type;
+	GRP group;
+} reg_read_t;
+
+#ifdef ADBMS_SPI_DMA
+
+/**
+ * @brief Queue a register read on the chain of the pack.  Only ADC code registers are handled,
+ * everything else stays on the blocking driver path.
+ * 
+ * @param chain Chain of the pack.
+ * @param command Read command.
+ * @param type Register type to read.
+ * @param group Group read, ALL_GRP for an ALL command.
+ * @return 0 if queued, -1 if the read has to go through the driver.
+ */
+static int dma_queue_read(adbms_chain_t *chain, uint8_t command[2], TYPE type,
+			  GRP group)
+{
+	if (!chain ||
+	    adbms_chain_queue_read(chain, command, type, group) != 0) {
+		return -1;
+	}
+
+	isospi_record_frame(adbms_register_frame_bytes(type));
+	return 0;
+}
+
+/**
+ * @brief Put the reads queued on the chain on the wire, sleeping until they are back, then decode them.
+ * 
+ * @param chain Chain of the pack.
+ * @param chips Array of chips to decode into.
+ * @param failed Set to the chips that failed PEC, per read in queue order.  NULL if not needed.
+ * @param hspi SPI handle of the chain.
+ */
+static void dma_run_reads(adbms_chain_t *chain, cell_asic chips[NUM_CHIPS],
+			  uint32_t failed[ADBMS_SPI_QUEUE_LEN],
+			  SPI_HandleTypeDef *hspi)
+{
+	adbms_wake_isospi(hspi);
+	adbms_chain_run(chain, chips, failed);
+	isospi_mark_activity();
+}
+
+#endif
+
+/**
+ * @brief Read one register group of all chips, without checking PEC errors.
  * 
  * @param chips Array of chips to read data to.
  * @param command Command to issue to the chip.
- * @param type Register type to write to.
- * @param group Group of registers to write to.
+ * @param type Register type to read.
+ * @param group Group of registers to read.
  */
-void read_adbms_data(cell_asic chips[NUM_CHIPS], uint8_t command[2], TYPE type,
-		     GRP group, SPI_HandleTypeDef *hspi)
+static void read_chain(cell_asic chips[NUM_CHIPS], uint8_t command[2],
+		       TYPE type, GRP group, SPI_HandleTypeDef *hspi)
 {
+#ifdef ADBMS_SPI_DMA
+	adbms_chain_t *chain = adbms_pack_chain();
+	if (dma_queue_read(chain, command, type, group) == 0) {
+		dma_run_reads(chain, chips, NULL, hspi);
+		return;
+	}
+#endif
+
 	adbms_wake_isospi(hspi);
 
 	adBmsReadData(NUM_CHIPS, chips, command, type, group);
+	isospi_record_frame(adbms_register_frame_bytes(type));
+}
 
+/**
+ * @brief Read one register group of all chips once, and record which chips failed PEC.
+ * 
+ * @return uint32_t Bit per chip that failed PEC.
+ */
+static uint32_t read_once(cell_asic chips[NUM_CHIPS], uint8_t command[2],
+			  TYPE type, GRP group, SPI_HandleTypeDef *hspi)
+{
+	uint16_t before[NUM_CHIPS];
+
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		before[chip] = sum_pec_errors(&chips[chip]);
+	}
+
+	read_chain(chips, command, type, group, hspi);
+
+	uint32_t failed = pec_failed_chips(chips, before);
+	pec_record(type, failed);
+	return failed;
+}
+
+/**
+ * @brief Re-read a register group while any chip fails PEC, up to PEC_MAX_RETRIES times.  Chips still failing
+ * after the last retry have the group marked stale.
+ * 
+ * Every chip answers every read, so a retry re-reads the group on the whole chain, but nothing else.  The data
+ * left in each chip is from the last read, so staleness is judged on the last read alone.
+ * 
+ * @param failed Chips that failed the read being retried.
+ */
+static void retry_failed(cell_asic chips[NUM_CHIPS], uint8_t command[2],
+			 TYPE type, GRP group, uint32_t failed,
+			 SPI_HandleTypeDef *hspi)
+{
+	for (uint8_t retry = 0; failed && retry < PEC_MAX_RETRIES; retry++) {
+		pec_quality.retries++;
+		isospi_link.stats.pec_retries++;
+		failed = read_once(chips, command, type, group, hspi);
+	}
+
+	if (failed) {
+		pec_quality.exhausted++;
+	}
+	pec_mark(type, group, failed);
+}
+
+/**
+ * @brief Read one register group of all chips, retrying it on PEC errors.
+ */
+static void read_checked(cell_asic chips[NUM_CHIPS], uint8_t command[2],
+			 TYPE type, GRP group, SPI_HandleTypeDef *hspi)
+{
+	uint32_t failed = read_once(chips, command, type, group, hspi);
+	retry_failed(chips, command, type, group, failed, hspi);
+}
+
+/**
+ * @brief Read data from all chips, retrying the group on PEC errors.
+ * 
+ * @param chips Array of chips to read data to.
+ * @param command Command to issue to the chip.
+ * @param type Register type to read.
+ * @param group Group of registers to read.
+ */
+void read_adbms_data(cell_asic chips[NUM_CHIPS], uint8_t command[2], TYPE type,
+		     GRP group, SPI_HandleTypeDef *hspi)
+{
+	read_checked(chips, command, type, group, hspi);
+
+	count_pec_errors(chips);
+}
+
+/**
+ * @brief Read a list of register groups from all chips.  With the DMA engine, the code registers
+ * are queued and put on the wire as one batch.
+ * 
+ * @param chips Array of chips to read data to.
+ * @param reads Register groups to read.
+ * @param count Number of groups.
+ */
+static void read_adbms_groups(cell_asic chips[NUM_CHIPS],
+			      const reg_read_t *reads, uint8_t count,
+			      SPI_HandleTypeDef *hspi)
+{
+#ifdef ADBMS_SPI_DMA
+	adbms_chain_t *chain = adbms_pack_chain();
+	/* reads queued on the chain, in queue order */
+	const reg_read_t *queued[ADBMS_SPI_QUEUE_LEN];
+	uint8_t num_queued = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		if (dma_queue_read(chain, reads[i].command, reads[i].type,
+				   reads[i].group) == 0) {
+			queued[num_queued++] = &reads[i];
+		} else {
+			read_checked(chips, reads[i].command, reads[i].type,
+				     reads[i].group, hspi);
+		}
+	}
+	if (num_queued > 0) {
+		uint32_t failed[ADBMS_SPI_QUEUE_LEN];
+		dma_run_reads(chain, chips, failed, hspi);
+
+		// only the groups that failed go back on the wire
+		for (uint8_t i = 0; i < num_queued; i++) {
+			pec_record(queued[i]->type, failed[i]);
+			retry_failed(chips, queued[i]->command, queued[i]->type,
+				     queued[i]->group, failed[i], hspi);
+		}
+	}
+#else
+	for (uint8_t i = 0; i < count; i++) {
+		read_checked(chips, reads[i].command, reads[i].type,
+			     reads[i].group, hspi);
+	}
+#endif
+
+	count_pec_errors(chips);
+}
+
+/**
+ * @brief Read a whole register bank from all chips with one ALL command.  Each IC's response carries
+ * a single PEC, if any of them fail the bank is re-read group by group instead.
+ * 
+ * @param chips Array of chips to read data to.
+ * @param command ALL command to issue to the chip.
+ * @param type ALL register type to read.
+ * @param fallback Per-group reads of the same registers, used on PEC failure.
+ * @param fallback_len Number of groups in the fallback.
+ * @return true if the ALL read passed PEC, false if the fallback was used.
+ */
+static bool read_adbms_all_data(cell_asic chips[NUM_CHIPS], uint8_t command[2],
+				TYPE type, const reg_read_t *fallback,
+				uint8_t fallback_len, SPI_HandleTypeDef *hspi)
+{
+	bool pec_ok = read_once(chips, command, type, ALL_GRP, hspi) == 0;
+
+	// fresh on a clean read, on a failed one the fallback marks each group it re-reads
+	pec_mark(type, ALL_GRP, 0);
+
+	// reports and clears the errors of the ALL read
 	count_pec_errors(chips);
+
+	if (!pec_ok) {
+		isospi_link.stats.pec_fallbacks++;
+		read_adbms_groups(chips, fallback, fallback_len, hspi);
+	}
+
+	return pec_ok;
 }
 
 uint32_t adBmsPollAdc_indicator(uint8_t poll_type[2])
@@ -289,39 +777,56 @@ uint32_t adBmsPollAdc_indicator(uint8_t poll_type[2])
 	set_debug_led_2(1);
 	uint32_t result = adBmsPollAdc(poll_type);
 	set_debug_led_2(0);
+	isospi_record_frame(0);
 	return result;
 }
 
 // --- BEGIN WRITE COMMANDS ---
 
+static void adc_cancel_pending(void);
+
 void soft_reset_chips(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
 	adbms_wake_isospi(hspi);
 	spiSendCmd(SRST);
 	adbms_wake_core();
+	// the reset puts the isoSPI back to idle, always wake on the next transaction
+	isospi_link.awake = false;
+	adc_cancel_pending();
 }
 
 void mute_chips(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
 	adbms_wake_isospi(hspi);
 	spiSendCmd(MUTE);
+	isospi_record_frame(0);
 }
 void unmute_chips(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
 	adbms_wake_isospi(hspi);
 	spiSendCmd(UNMUTE);
+	isospi_record_frame(0);
 }
 
 void snap_chips(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
 	adbms_wake_isospi(hspi);
 	spiSendCmd(SNAP);
+	isospi_record_frame(0);
 }
 
 void unsnap_chips(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
 	adbms_wake_isospi(hspi);
 	spiSendCmd(UNSNAP);
+	isospi_record_frame(0);
+}
+
+void clear_ovuv_flags(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
+{
+	adbms_wake_isospi(hspi);
+	spiSendCmd(CLOVUV);
+	isospi_record_frame(0);
 }
 
 void write_config_regs(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
@@ -357,80 +862,103 @@ void write_clear_flags(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 
 // --- BEGIN READ COMMANDS ---
 
+#define READS_LEN(reads) (sizeof(reads) / sizeof(reads[0]))
+
+static const reg_read_t c_voltage_groups[] = {
+	{ RDCVA, Cell, A }, { RDCVB, Cell, B }, { RDCVC, Cell, C },
+	{ RDCVD, Cell, D }, { RDCVE, Cell, E },
+};
+
+static const reg_read_t average_voltage_groups[] = {
+	{ RDACA, AvgCell, A }, { RDACB, AvgCell, B }, { RDACC, AvgCell, C },
+	{ RDACD, AvgCell, D }, { RDACE, AvgCell, E },
+};
+
+static const reg_read_t filtered_voltage_groups[] = {
+	{ RDFCA, F_volt, A }, { RDFCB, F_volt, B }, { RDFCC, F_volt, C },
+	{ RDFCD, F_volt, D }, { RDFCE, F_volt, E },
+};
+
+static const reg_read_t s_voltage_groups[] = {
+	{ RDSVA, S_volt, A }, { RDSVB, S_volt, B }, { RDSVC, S_volt, C },
+	{ RDSVD, S_volt, D }, { RDSVE, S_volt, E },
+};
+
+/* RDASALL returns AUX followed by the status registers */
+static const reg_read_t status_aux_groups[] = {
+	{ RDAUXA, Aux, A },	  { RDAUXB, Aux, B },
+	{ RDAUXC, Aux, C },	  { RDAUXD, Aux, D },
+	{ RDSTATA, Status, A }, { RDSTATB, Status, B },
+	{ RDSTATC, Status, C }, { RDSTATD, Status, D },
+	{ RDSTATE, Status, E },
+};
+
+static const reg_read_t raux_groups[] = {
+	{ RDRAXA, RAux, A },
+	{ RDRAXB, RAux, B },
+	{ RDRAXC, RAux, C },
+	{ RDRAXD, RAux, D },
+};
+
 void read_c_voltage_registers(cell_asic chips[NUM_CHIPS],
 			      SPI_HandleTypeDef *hspi)
 {
-	read_adbms_data(chips, RDCVA, Cell, A, hspi);
-	read_adbms_data(chips, RDCVB, Cell, B, hspi);
-	read_adbms_data(chips, RDCVC, Cell, C, hspi);
-	read_adbms_data(chips, RDCVD, Cell, D, hspi);
-	read_adbms_data(chips, RDCVE, Cell, E, hspi);
+	read_adbms_all_data(chips, RDCVALL, Rdcvall, c_voltage_groups,
+			    READS_LEN(c_voltage_groups), hspi);
 }
 
 void read_average_voltage_registers(cell_asic chips[NUM_CHIPS],
 				    SPI_HandleTypeDef *hspi)
 {
-	read_adbms_data(chips, RDACA, AvgCell, A, hspi);
-	read_adbms_data(chips, RDACB, AvgCell, B, hspi);
-	read_adbms_data(chips, RDACC, AvgCell, C, hspi);
-	read_adbms_data(chips, RDACD, AvgCell, D, hspi);
-	read_adbms_data(chips, RDACE, AvgCell, E, hspi);
+	read_adbms_all_data(chips, RDACALL, Rdacall, average_voltage_groups,
+			    READS_LEN(average_voltage_groups), hspi);
 }
 
 void read_filtered_voltage_registers(cell_asic chips[NUM_CHIPS],
 				     SPI_HandleTypeDef *hspi)
 {
-	read_adbms_data(chips, RDFCA, F_volt, A, hspi);
-	read_adbms_data(chips, RDFCB, F_volt, B, hspi);
-	read_adbms_data(chips, RDFCC, F_volt, C, hspi);
-	read_adbms_data(chips, RDFCD, F_volt, D, hspi);
-	read_adbms_data(chips, RDFCE, F_volt, E, hspi);
+	read_adbms_all_data(chips, RDFCALL, Rdfcall, filtered_voltage_groups,
+			    READS_LEN(filtered_voltage_groups), hspi);
 }
 
 void read_s_voltage_registers(cell_asic chips[NUM_CHIPS],
 			      SPI_HandleTypeDef *hspi)
 {
-	read_adbms_data(chips, RDSVA, S_volt, A, hspi);
-	read_adbms_data(chips, RDSVB, S_volt, B, hspi);
-	read_adbms_data(chips, RDSVC, S_volt, C, hspi);
-	read_adbms_data(chips, RDSVD, S_volt, D, hspi);
-	read_adbms_data(chips, RDSVE, S_volt, E, hspi);
+	read_adbms_all_data(chips, RDSALL, Rdsall, s_voltage_groups,
+			    READS_LEN(s_voltage_groups), hspi);
 }
 
 void adc_and_read_aux_registers(cell_asic chips[NUM_CHIPS],
 				SPI_HandleTypeDef *hspi)
 {
-	// TODO only poll correct GPIOs
-	adbms_wake_isospi(hspi);
-	adBms6830_Adax(AUX_OW_OFF, PUP_DOWN, AUX_ALL);
-	adBmsPollAdc_indicator(PLAUX1);
+	adbms_adc_start(ADBMS_ADC_AUX, hspi);
+	adbms_adc_wait(ADBMS_ADC_AUX, hspi);
 
-	read_adbms_data(chips, RDAUXA, Aux, A, hspi);
-	read_adbms_data(chips, RDAUXB, Aux, B, hspi);
-	read_adbms_data(chips, RDAUXC, Aux, C, hspi);
-	read_adbms_data(chips, RDAUXD, Aux, D, hspi);
+	// AUX has no ALL command of its own, RDASALL brings the status registers along
+	read_adbms_all_data(chips, RDASALL, Rdasall, status_aux_groups,
+			    READS_LEN(status_aux_groups), hspi);
+}
+
+void read_raux_registers(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
+{
+	// there is no RAUX ALL command
+	read_adbms_groups(chips, raux_groups, READS_LEN(raux_groups), hspi);
 }
 
 void adc_and_read_aux2_registers(cell_asic chips[NUM_CHIPS],
 				 SPI_HandleTypeDef *hspi)
 {
-	adbms_wake_isospi(hspi);
-	adBms6830_Adax2(AUX_ALL);
-	adBmsPollAdc_indicator(PLAUX2);
+	adbms_adc_start(ADBMS_ADC_AUX2, hspi);
+	adbms_adc_wait(ADBMS_ADC_AUX2, hspi);
 
-	read_adbms_data(chips, RDRAXA, RAux, A, hspi);
-	read_adbms_data(chips, RDRAXB, RAux, B, hspi);
-	read_adbms_data(chips, RDRAXC, RAux, C, hspi);
-	read_adbms_data(chips, RDRAXD, RAux, D, hspi);
+	read_raux_registers(chips, hspi);
 }
 
 void read_status_registers(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
-	read_adbms_data(chips, RDSTATA, Status, A, hspi);
-	read_adbms_data(chips, RDSTATB, Status, B, hspi);
-	read_adbms_data(chips, RDSTATC, Status, C, hspi);
-	read_adbms_data(chips, RDSTATD, Status, D, hspi);
-	read_adbms_data(chips, RDSTATE, Status, E, hspi);
+	// there is no status only ALL command, RDASALL also refreshes AUX
+	read_adbms_all_data(chips, RDASALL, Rdasall, status_aux_groups,
+			    READS_LEN(status_aux_groups), hspi);
 }
 
 void read_status_register_c(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
@@ -438,6 +966,11 @@ void read_status_register_c(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 	read_adbms_data(chips, RDSTATC, Status, C, hspi);
 }
 
+void read_status_register_d(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
+{
+	read_adbms_data(chips, RDSTATD, Status, D, hspi);
+}
+
 void read_config_register_a(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
 	read_adbms_data(chips, RDCFGA, Config, A, hspi);
@@ -457,7 +990,8 @@ void read_pwm_registers(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 void read_status_aux_registers(cell_asic chips[NUM_CHIPS],
 			       SPI_HandleTypeDef *hspi)
 {
-	read_adbms_data(chips, RDASALL, Rdasall, ALL_GRP, hspi);
+	read_adbms_all_data(chips, RDASALL, Rdasall, status_aux_groups,
+			    READS_LEN(status_aux_groups), hspi);
 }
 
 void read_serial_id(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
@@ -469,11 +1003,194 @@ void read_serial_id(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 
 // --- BEGIN ADC POLL ---
 
-void get_c_adc_voltages(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
+/* Length of a ThreadX tick */
+#define TICK_US (1000000 / TX_TIMER_TICKS_PER_SECOND)
+/* Ticks past a conversion's budget to give up on its compare, and time the rest on TIM2 */
+#define ADC_DUE_TIMEOUT_TICKS(us) ((us) / TICK_US + 2)
+
+static const uint32_t adc_conv_us[ADBMS_ADC_MODES] = {
+	[ADBMS_ADC_C] = ADC_CONV_C_US,
+	[ADBMS_ADC_S] = ADC_CONV_S_US,
+	[ADBMS_ADC_AUX] = ADC_CONV_AUX_US,
+	[ADBMS_ADC_AUX2] = ADC_CONV_AUX2_US,
+};
+
+static struct {
+	uint32_t start_us;
+	bool pending;
+	adbms_adc_stats_t stats;
+} adc_sched[ADBMS_ADC_MODES] = { 0 };
+
+/* put by the TIM2 channel 1 compare, at the time a conversion being waited on is due */
+static TX_SEMAPHORE adc_due;
+static bool adc_due_ready = false;
+
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+	if (htim == &htim2 && htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1) {
+		__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC1);
+		tx_semaphore_put(&adc_due);
+	}
+}
+
+/**
+ * @brief Sleep until a TIM2 timestamp, woken by a compare on TIM2 channel 1.  The tick is far too coarse for
+ * conversions of a few ms, the compare wakes the thread within an interrupt of the time.
+ * 
+ * @param due_us TIM2 timestamp to wake at.
+ */
+static void adc_sleep_until(uint32_t due_us)
+{
+	if (!adc_due_ready) {
+		if (tx_semaphore_create(&adc_due, "ADBMS ADC Due", 0) !=
+		    TX_SUCCESS) {
+			return;
+		}
+		HAL_NVIC_SetPriority(TIM2_IRQn, ADBMS_SPI_IRQ_PRIORITY, 0);
+		HAL_NVIC_EnableIRQ(TIM2_IRQn);
+		adc_due_ready = true;
+	}
+
+	// drop a compare left over from a wait that timed out
+	while (tx_semaphore_get(&adc_due, TX_NO_WAIT) == TX_SUCCESS)
+		;
+
+	__HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_1, due_us);
+	__HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_CC1);
+	__HAL_TIM_ENABLE_IT(&htim2, TIM_IT_CC1);
+
+	// the compare only fires on a match, so it must still be ahead once armed
+	int32_t remaining_us = (int32_t)(due_us - adbms_get_us());
+	if (remaining_us > 0) {
+		tx_semaphore_get(&adc_due,
+				 ADC_DUE_TIMEOUT_TICKS((uint32_t)remaining_us));
+	}
+
+	__HAL_TIM_DISABLE_IT(&htim2, TIM_IT_CC1);
+}
+
+/**
+ * @brief Record that a conversion was just started.  Call right after the start command.
+ * 
+ * @param mode ADC that was started.
+ */
+static void adc_started(adbms_adc_mode_t mode)
+{
+	isospi_record_frame(0);
+	adc_sched[mode].start_us = adbms_get_us();
+	adc_sched[mode].pending = true;
+}
+
+void adbms_adc_start(adbms_adc_mode_t mode, SPI_HandleTypeDef *hspi)
 {
 	adbms_wake_isospi(hspi);
-	adBms6830_Adcv(RD_OFF, SINGLE, DCP_OFF, RSTF_ON, OW_OFF_ALL_CH);
-	adBmsPollAdc_indicator(PLCADC);
+
+	switch (mode) {
+	case ADBMS_ADC_C:
+		adBms6830_Adcv(RD_OFF, SINGLE, DCP_OFF, RSTF_ON,
+			       OW_OFF_ALL_CH);
+		break;
+	case ADBMS_ADC_S:
+		adBms6830_Adsv(SINGLE, DCP_OFF, OW_OFF_ALL_CH);
+		break;
+	case ADBMS_ADC_AUX:
+		// TODO only poll correct GPIOs
+		adBms6830_Adax(AUX_OW_OFF, PUP_DOWN, AUX_ALL);
+		break;
+	case ADBMS_ADC_AUX2:
+		adBms6830_Adax2(AUX_ALL);
+		break;
+	default:
+		return;
+	}
+
+	adc_started(mode);
+}
+
+void adbms_adc_wait(adbms_adc_mode_t mode, SPI_HandleTypeDef *hspi)
+{
+	static uint8_t *const poll_cmds[ADBMS_ADC_MODES] = {
+		[ADBMS_ADC_C] = PLCADC,
+		[ADBMS_ADC_S] = PLSADC,
+		[ADBMS_ADC_AUX] = PLAUX1,
+		[ADBMS_ADC_AUX2] = PLAUX2,
+	};
+
+	if (mode >= ADBMS_ADC_MODES || !adc_sched[mode].pending) {
+		return;
+	}
+
+	uint32_t budget = adc_conv_us[mode];
+	uint32_t elapsed = adbms_get_us() - adc_sched[mode].start_us;
+
+	if (elapsed < budget) {
+		adc_sleep_until(adc_sched[mode].start_us + budget);
+
+		// only left if the compare never came, time the rest on TIM2 instead of polling the chain
+		elapsed = adbms_get_us() - adc_sched[mode].start_us;
+		if (elapsed < budget) {
+			delay_us(budget - elapsed);
+		}
+	}
+
+	// the poll returns on its first read if the conversion is done
+	adbms_wake_isospi(hspi);
+	adBmsPollAdc_indicator(poll_cmds[mode]);
+
+	uint32_t latency = adbms_get_us() - adc_sched[mode].start_us;
+	adbms_adc_stats_t *stats = &adc_sched[mode].stats;
+
+	adc_sched[mode].pending = false;
+	stats->last_us = latency;
+	if (stats->conversions == 0 || latency < stats->min_us) {
+		stats->min_us = latency;
+	}
+	if (latency > stats->max_us) {
+		stats->max_us = latency;
+	}
+	stats->total_us += latency;
+	stats->conversions++;
+	if (latency > budget + ADC_LATE_MARGIN_US) {
+		stats->late++;
+	}
+}
+
+/**
+ * @brief Forget every started conversion, their results are gone after a reset.
+ * 
+ */
+static void adc_cancel_pending(void)
+{
+	for (uint8_t mode = 0; mode < ADBMS_ADC_MODES; mode++) {
+		adc_sched[mode].pending = false;
+	}
+}
+
+bool adbms_adc_pending(adbms_adc_mode_t mode)
+{
+	// a result left for longer than tSLEEP is lost with the core registers
+	return adc_sched[mode].pending &&
+	       adbms_get_us() - adc_sched[mode].start_us <
+		       CORE_SLEEP_TIMEOUT_US;
+}
+
+void adbms_get_adc_stats(adbms_adc_mode_t mode, adbms_adc_stats_t *stats)
+{
+	*stats = adc_sched[mode].stats;
+}
+
+void adbms_reset_adc_stats(void)
+{
+	for (uint8_t mode = 0; mode < ADBMS_ADC_MODES; mode++) {
+		memset(&adc_sched[mode].stats, 0,
+		       sizeof(adc_sched[mode].stats));
+	}
+}
+
+void get_c_adc_voltages(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
+{
+	adbms_adc_start(ADBMS_ADC_C, hspi);
+	adbms_adc_wait(ADBMS_ADC_C, hspi);
 
 	read_c_voltage_registers(chips, hspi);
 }
@@ -482,7 +1199,8 @@ void get_avgd_cell_voltages(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
 	adbms_wake_isospi(hspi);
 	adBms6830_Adcv(RD_OFF, SINGLE, DCP_OFF, RSTF_OFF, OW_OFF_ALL_CH);
-	adBmsPollAdc_indicator(PLCADC);
+	adc_started(ADBMS_ADC_C);
+	adbms_adc_wait(ADBMS_ADC_C, hspi);
 
 	read_average_voltage_registers(chips, hspi);
 }
@@ -495,10 +1213,20 @@ void get_avgd_cell_voltages(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 // }
 
 void get_s_adc_voltages(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
+{
+	adbms_adc_start(ADBMS_ADC_S, hspi);
+	adbms_adc_wait(ADBMS_ADC_S, hspi);
+
+	read_s_voltage_registers(chips, hspi);
+}
+
+void get_s_adc_open_wire_voltages(cell_asic chips[NUM_CHIPS], OW_C_S ow,
+				  SPI_HandleTypeDef *hspi)
 {
 	adbms_wake_isospi(hspi);
-	adBms6830_Adsv(SINGLE, DCP_OFF, OW_OFF_ALL_CH);
-	adBmsPollAdc_indicator(PLSADC);
+	adBms6830_Adsv(SINGLE, DCP_OFF, ow);
+	adc_started(ADBMS_ADC_S);
+	adbms_adc_wait(ADBMS_ADC_S, hspi);
 
 	read_s_voltage_registers(chips, hspi);
 }
@@ -508,7 +1236,9 @@ void get_c_and_s_adc_voltages(cell_asic chips[NUM_CHIPS],
 {
 	adbms_wake_isospi(hspi);
 	adBms6830_Adcv(RD_ON, SINGLE, DCP_OFF, RSTF_OFF, OW_OFF_ALL_CH);
-	adBmsPollAdc_indicator(PLSADC);
+	// with RD on, the S-ADC conversion is the one to wait for
+	adc_started(ADBMS_ADC_S);
+	adbms_adc_wait(ADBMS_ADC_S, hspi);
 
 	read_c_voltage_registers(chips, hspi);
 	read_s_voltage_registers(chips, hspi);
@@ -518,6 +1248,7 @@ void start_c_adc_conv(SPI_HandleTypeDef *hspi)
 {
 	adbms_wake_isospi(hspi);
 	adBms6830_Adcv(RD_ON, CONTINUOUS, DCP_OFF, RSTF_ON, OW_OFF_ALL_CH);
+	isospi_record_frame(0);
 }
 
 // --- END ADC POLL ---
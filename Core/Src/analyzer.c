@@ -8,9 +8,13 @@
 
 #include "serialPrintResult.h"
 #include "timer.h"
-
-// the OCV timer
-nertimer_t ocvTimer;
+#include "segment.h"
+#include "therm_lut.h"
+#include "pack_stats.h"
+#include "soc.h"
+#include "impedance.h"
+#include "sop.h"
+#include "cell_faults.h"
 
 // TODO adjust for alpha and beta having same number of cells
 
@@ -79,62 +83,165 @@ uint8_t get_num_cells(chipdata_t *chip_data)
 }
 
 /**
- * @brief Calculate the cell temperature of a 10,000 ohm NTP resistor (model 103)
- * 
- * @param res The resistance of the resistor
- * @return float The temperature
+ * @brief Interpolate a thermistor temperature from its generated lookup table.
+ *
+ * @param lut Table of the divider the thermistor sits on.
+ * @param code The raw aux ADC code of the divider.
+ * @return float The temperature in degrees Celsius.
  */
-float calc_temp(float res)
+static float therm_lut_lookup(const therm_lut_t *lut, int16_t code)
 {
-	float coef = res / 10000.0;
-	// achieved via passing ThermCalcs.xlsx into https://www.standardsapplied.com/nonlinear-curve-fitting-calculator.html
-	return -1149.531863 * (pow(coef, 1.0 / 8)) +
-	       658.9396848 * (pow(coef, 1.0 / 4)) +
-	       -87.8102815 * (pow(coef, 1.0 / 2)) + 2.034216235 * coef +
-	       601.008351;
+	int32_t offset = (int32_t)code - lut->code_min;
+	if (offset <= 0) {
+		return lut->centi_c[0] * 0.01f;
+	}
+
+	uint32_t index = (uint32_t)offset >> THERM_LUT_SHIFT;
+	if (index >= lut->len - 1U) {
+		return lut->centi_c[lut->len - 1] * 0.01f;
+	}
+
+	int32_t frac = offset & ((1 << THERM_LUT_SHIFT) - 1);
+	int32_t a = lut->centi_c[index];
+	int32_t b = lut->centi_c[index + 1];
+
+	return (a + (((b - a) * frac) >> THERM_LUT_SHIFT)) * 0.01f;
 }
 
 /**
  * @brief Calculate a cell temperature based on the thermistor reading.
  * 
- * @param voltage The thremistor reading.
+ * @param code The raw aux ADC code of the thermistor.
  * @return float The temperature in degrees Celsius.
  */
-float calc_cell_temp(float voltage)
+float calc_cell_temp(int16_t code)
 {
-	float res = (5600 * (3 - voltage)) / voltage;
-	return calc_temp(res);
+	return therm_lut_lookup(&therm_lut_cell, code);
 }
 
 /**
  * @brief Calculate a cell temperature of onboard therm
  * 
- * @param voltage the voltage read by ADC
+ * @param code The raw aux ADC code of the thermistor.
  * @return float The temperature in degrees C
  */
-float calc_cell_temp_onboard(float voltage)
+float calc_cell_temp_onboard(int16_t code)
+{
+	return therm_lut_lookup(&therm_lut_onboard, code);
+}
+
+/**
+ * @brief Stamp an analyzed quantity as recomputed now.
+ */
+static inline void mark_updated(bms_t *bmsdata, analyzed_quantity_t quantity)
+{
+	bmsdata->updated_ms[quantity] = HAL_GetTick();
+}
+
+#ifdef DEBUG_ANALYZER_BENCH
+
+/* Period of the benchmark prints */
+#define ANALYZER_BENCH_PERIOD_MS 10000
+
+/**
+ * @brief Worst case cycles of a calculation, printed against the analyzer's budget.
+ */
+typedef struct {
+	const char *name;
+	nertimer_t timer;
+	uint32_t max_cycles;
+} cycle_bench_t;
+
+/**
+ * @brief Check if a rate limited benchmark is due, and restart its period if it is.
+ *
+ * @param timer Period of the benchmark.
+ * @return true at most every ANALYZER_BENCH_PERIOD_MS.
+ */
+static bool bench_due(nertimer_t *timer)
+{
+	if (is_timer_active(timer) && !is_timer_expired(timer)) {
+		return false;
+	}
+	start_timer(timer, ANALYZER_BENCH_PERIOD_MS);
+	return true;
+}
+
+/**
+ * @brief Start timing a calculation.
+ *
+ * @return uint32_t DWT cycle count to pass to bench_end().
+ */
+static uint32_t bench_start(void)
 {
-	float res = (5600 * (5 - voltage)) / voltage;
-	return calc_temp(res);
+	DCB->DEMCR |= DCB_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	return DWT->CYCCNT;
 }
 
-void calc_cell_temps(bms_t *bmsdata)
+/**
+ * @brief Finish timing a calculation, and print its worst case as a share of one cell measurement period,
+ * the budget of an analysis pass.  Prints at most every ANALYZER_BENCH_PERIOD_MS.
+ *
+ * @param bench Worst case so far.
+ * @param start bench_start() of the calculation.
+ */
+static void bench_end(cycle_bench_t *bench, uint32_t start)
 {
+	uint32_t cycles = DWT->CYCCNT - start;
+	if (cycles > bench->max_cycles) {
+		bench->max_cycles = cycles;
+	}
+
+	if (!bench_due(&bench->timer)) {
+		return;
+	}
+
+	uint32_t percent = SystemCoreClock / 1000 * CELL_PERIOD_MS / 100;
+	printf("%s: %lu cycles, worst %lu, %lu.%02lu%% of the cell period\n",
+	       bench->name, cycles, bench->max_cycles,
+	       bench->max_cycles / percent,
+	       bench->max_cycles * 100 / percent % 100);
+	bench->max_cycles = 0;
+}
+
+#endif
+
+void calc_cell_temps(bms_t *bmsdata, uint32_t therm_chips,
+		     uint32_t status_chips)
+{
+#ifdef DEBUG_ANALYZER_BENCH
+	static cycle_bench_t bench = { .name = "Cell temps" };
+	uint32_t start = bench_start();
+#endif
+
 	for (int chip = 0; chip < NUM_CHIPS; chip++) {
 		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[chip]);
 
+		/* set the die temp */
+		// conversion rate from datasheet, Table 105.  also in driver src
+		if (status_chips & (1UL << chip)) {
+			bmsdata->chip_data[chip].die_temp =
+				(getVoltage(bmsdata->chips[chip].stata.itmp) /
+				 0.0075) -
+				273;
+		}
+
+		// only chips whose therms were refreshed, the rest keep their last good temperatures
+		if (!(therm_chips & (1UL << chip))) {
+			continue;
+		}
+
 		for (int cell = 0; cell < num_cells; cell++) {
 			if (THERM_FAIL_MAP[chip][THERM_MAP[cell]]) {
 				static bool is_first = true;
 				if (is_first) {
-					bmsdata->chip_data[chip]
-						.cell_temp[cell] = 33.33;
+					bmsdata->cell_temp[chip][cell] = 33.33;
 					is_first = false;
 				} else {
 					if (!isnan(bmsdata->segment_average_temps
 							   [chip / 2]))
-						bmsdata->chip_data[chip]
-							.cell_temp[cell] =
+						bmsdata->cell_temp[chip][cell] =
 							bmsdata->segment_average_temps
 								[chip / 2];
 				}
@@ -143,11 +250,10 @@ void calc_cell_temps(bms_t *bmsdata)
 					bmsdata->chips[chip]
 						.raux.ra_codes[THERM_MAP[cell]];
 
-				bmsdata->chip_data[chip].cell_temp[cell] =
-					calc_cell_temp(getVoltage(x));
+				bmsdata->cell_temp[chip][cell] =
+					calc_cell_temp(x);
 				// if (cell == 2 && chip == 5)
-				// 	bmsdata->chip_data[chip]
-				// 		.cell_temp[cell] = 61.5;
+				// 	bmsdata->cell_temp[chip][cell] = 61.5;
 			}
 		}
 
@@ -156,76 +262,175 @@ void calc_cell_temps(bms_t *bmsdata)
 		if (!bmsdata->chip_data[chip].alpha) {
 			// Take average of both onboard therms
 			bmsdata->chip_data[chip].on_board_temp =
-				(calc_cell_temp_onboard(getVoltage(
-					 bmsdata->chips[chip].raux.ra_codes[6])) +
-				 calc_cell_temp_onboard(getVoltage(
-					 bmsdata->chips[chip]
-						 .raux.ra_codes[7]))) /
+				(calc_cell_temp_onboard(
+					 bmsdata->chips[chip].raux.ra_codes[6]) +
+				 calc_cell_temp_onboard(
+					 bmsdata->chips[chip].raux.ra_codes[7])) /
 				2;
 		} else {
 			//printf("\nONBOARD alpha %f\n\n",
 			//       getVoltage(
 			//	       bmsdata->chips[chip].raux.ra_codes[7]));
 			bmsdata->chip_data[chip].on_board_temp =
-				calc_cell_temp_onboard(getVoltage(
-					bmsdata->chips[chip].raux.ra_codes[7]));
+				calc_cell_temp_onboard(
+					bmsdata->chips[chip].raux.ra_codes[7]);
 		}
+	}
 
-		/* set the die temp */
-		// conversion rate from datasheet, Table 105.  also in driver src
-		bmsdata->chip_data[chip].die_temp =
-			(getVoltage(bmsdata->chips[chip].stata.itmp) / 0.0075) -
-			273;
+	if (therm_chips) {
+		mark_updated(bmsdata, ANALYZED_CELL_TEMPS);
 	}
+
+#ifdef DEBUG_ANALYZER_BENCH
+	bench_end(&bench, start);
+#endif
 }
 
-void calc_pack_temps(bms_t *bmsdata)
+void calc_cell_voltages(bms_t *bmsdata, uint32_t chips)
 {
-	bmsdata->max_temp.val = FLT_MIN;
-	bmsdata->max_temp.cellNum = 0;
-	bmsdata->max_temp.chipIndex = 0;
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[chip]);
 
-	bmsdata->min_temp.val = FLT_MAX;
-	bmsdata->min_temp.cellNum = 0;
-	bmsdata->min_temp.chipIndex = 0;
+		// only chips whose cells were refreshed, the rest keep their last good voltages
+		bmsdata->chip_data[chip].stale_regs = adbms_get_stale_regs(chip);
+		if (!(chips & (1UL << chip))) {
+			continue;
+		}
 
-	bmsdata->max_chiptemp.val = 0;
+		for (uint8_t cell = 0; cell < num_cells; cell++) {
+			if (VOLTS_FAIL_MAP[chip][cell]) {
+				static bool is_first = true;
+				if (is_first) {
+					bmsdata->cell_voltages[chip][cell] =
+						CELL_VOLT(3.5);
+					is_first = false;
+				} else {
+					bmsdata->cell_voltages[chip][cell] =
+						CELL_VOLT_FROM_FLOAT(
+							bmsdata->segment_average_volts
+								[chip / 2]);
+				}
+			} else if (bmsdata->current_state == CHARGING) {
+				// in charging state, we read single shot c codes ONLY
+				bmsdata->cell_voltages[chip][cell] =
+					CELL_VOLT_FROM_CODE(
+						bmsdata->chips[chip]
+							.cell.c_codes[cell]);
+			} else {
+				bmsdata->cell_voltages[chip][cell] =
+					CELL_VOLT_FROM_CODE(
+						bmsdata->chips[chip]
+							.fcell.fc_codes[cell]);
+				// if (chip == 5 && cell == 2)
+				// 	bmsdata->cell_voltages[chip][cell] =
+				// 		2.4;
+			}
+		}
+	}
 
-	float total_temp = 0;
-	float total_seg_temp = 0;
+	if (chips) {
+		mark_updated(bmsdata, ANALYZED_CELL_VOLTS);
+	}
+}
 
-	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
-		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[c]);
+/* Segments are a pair of chips, so each segment's cells are contiguous in the per cell arrays */
+#define CHIPS_PER_SEGMENT ((NUM_CHIPS) / NUM_SEGMENTS)
+#define CELLS_PER_SEGMENT (CHIPS_PER_SEGMENT * NUM_CELLS_PER_CHIP)
 
-		for (uint8_t cell = 0; cell < num_cells; cell++) {
-			if (bmsdata->chip_data[c].cell_temp[cell] >
-			    bmsdata->max_temp.val) {
-				bmsdata->max_temp.val =
-					bmsdata->chip_data[c].cell_temp[cell];
-				bmsdata->max_temp.cellNum = cell;
-				bmsdata->max_temp.chipIndex = c;
-			}
+/**
+ * @brief Point a critical value at a cell, from an offset into its segment's block.
+ */
+static inline void set_crit_at(crit_cellval_t *crit, uint8_t seg, uint16_t at)
+{
+	crit->chipIndex = seg * CHIPS_PER_SEGMENT + at / NUM_CELLS_PER_CHIP;
+	crit->cellNum = at % NUM_CELLS_PER_CHIP;
+}
 
-			/* finds out the minimum cell temp and location */
-			if (bmsdata->chip_data[c].cell_temp[cell] <
-			    bmsdata->min_temp.val) {
-				bmsdata->min_temp.val =
-					bmsdata->chip_data[c].cell_temp[cell];
-				bmsdata->min_temp.cellNum = cell;
-				bmsdata->min_temp.chipIndex = c;
-			}
+void calc_pack_stats(bms_t *bmsdata, uint32_t chips)
+{
+#ifdef DEBUG_ANALYZER_BENCH
+	static cycle_bench_t bench = { .name = "Pack stats" };
+	uint32_t start = bench_start();
+#endif
+
+	/* block statistics of every segment, only the segments with changed chips are rescanned */
+	static float_stats_t seg_temp[NUM_SEGMENTS];
+	static cell_volt_stats_t seg_volt[NUM_SEGMENTS];
+	static cell_volt_stats_t seg_ocv[NUM_SEGMENTS];
+	static bool scanned = false;
+
+	if (!scanned) {
+		chips = SEGMENT_ALL_CHIPS;
+		scanned = true;
+	}
 
-			total_temp += bmsdata->chip_data[c].cell_temp[cell];
-			total_seg_temp += bmsdata->chip_data[c].cell_temp[cell];
+	float total_temp = 0;
+	cell_volt_sum_t total_volt = 0;
+	cell_volt_sum_t total_ocv = 0;
+
+	for (uint8_t seg = 0; seg < NUM_SEGMENTS; seg++) {
+		uint8_t chip = seg * CHIPS_PER_SEGMENT;
+		uint32_t seg_chips = ((1UL << CHIPS_PER_SEGMENT) - 1) << chip;
+
+		if (chips & seg_chips) {
+			/* the segment spans two chip rows, so index from the start of the whole array rather than a row */
+			const uint16_t first = chip * NUM_CELLS_PER_CHIP;
+
+			stats_float(&bmsdata->cell_temp[0][0] + first,
+				    CELLS_PER_SEGMENT, &seg_temp[seg]);
+			stats_cell_volt(&bmsdata->cell_voltages[0][0] + first,
+					CELLS_PER_SEGMENT, &seg_volt[seg]);
+			stats_cell_volt(&bmsdata->open_cell_voltage[0][0] +
+						first,
+					CELLS_PER_SEGMENT, &seg_ocv[seg]);
 		}
-		/* only for NERO */
-		if (c % 2 == 1) {
-			bmsdata->segment_average_temps[c / 2] =
-				total_seg_temp /
-				((float)(NUM_CELLS * 2));
-			total_seg_temp = 0;
+
+		const float_stats_t temp = seg_temp[seg];
+		const cell_volt_stats_t volt = seg_volt[seg];
+		const cell_volt_stats_t ocv = seg_ocv[seg];
+
+		// strict compares keep the first cell on a tie, same as a scan over the pack
+		if (seg == 0 || temp.max > bmsdata->max_temp.val) {
+			bmsdata->max_temp.val = temp.max;
+			set_crit_at(&bmsdata->max_temp, seg, temp.max_at);
+		}
+		if (seg == 0 || temp.min < bmsdata->min_temp.val) {
+			bmsdata->min_temp.val = temp.min;
+			set_crit_at(&bmsdata->min_temp, seg, temp.min_at);
+		}
+		if (seg == 0 || volt.max > bmsdata->max_voltage.raw) {
+			bmsdata->max_voltage.raw = volt.max;
+			set_crit_at(&bmsdata->max_voltage, seg, volt.max_at);
+		}
+		if (seg == 0 || volt.min < bmsdata->min_voltage.raw) {
+			bmsdata->min_voltage.raw = volt.min;
+			set_crit_at(&bmsdata->min_voltage, seg, volt.min_at);
 		}
+		if (seg == 0 || ocv.max > bmsdata->max_ocv.raw) {
+			bmsdata->max_ocv.raw = ocv.max;
+			set_crit_at(&bmsdata->max_ocv, seg, ocv.max_at);
+		}
+		if (seg == 0 || ocv.min < bmsdata->min_ocv.raw) {
+			bmsdata->min_ocv.raw = ocv.min;
+			set_crit_at(&bmsdata->min_ocv, seg, ocv.min_at);
+		}
+
+		total_temp += temp.sum;
+		total_volt += volt.sum;
+		total_ocv += ocv.sum;
+
+		bmsdata->segment_average_temps[seg] =
+			temp.sum / CELLS_PER_SEGMENT;
+		bmsdata->segment_total_volts[seg] =
+			CELL_VOLT_SUM_TO_FLOAT(volt.sum, CELLS_PER_SEGMENT);
+		/* OCV average voltages */
+		bmsdata->segment_average_volts[seg] =
+			CELL_VOLT_SUM_TO_FLOAT(ocv.sum, CELLS_PER_SEGMENT) /
+			CELLS_PER_SEGMENT;
+	}
 
+	bmsdata->max_chiptemp.val = 0;
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
 		if (bmsdata->max_chiptemp.val <
 		    bmsdata->chip_data[c].die_temp) {
 			bmsdata->max_chiptemp = (crit_chipval_t){
@@ -235,157 +440,276 @@ void calc_pack_temps(bms_t *bmsdata)
 		}
 	}
 
-	/* Takes the average of all the cell temperatures. */
-	bmsdata->avg_temp = total_temp / NUM_CELLS;
+	bmsdata->avg_temp = total_temp / (NUM_CELLS);
+
+	/* convert to volts once the whole pack is in */
+	bmsdata->max_voltage.val = CELL_VOLT_TO_FLOAT(bmsdata->max_voltage.raw);
+	bmsdata->min_voltage.val = CELL_VOLT_TO_FLOAT(bmsdata->min_voltage.raw);
+	bmsdata->max_ocv.val = CELL_VOLT_TO_FLOAT(bmsdata->max_ocv.raw);
+	bmsdata->min_ocv.val = CELL_VOLT_TO_FLOAT(bmsdata->min_ocv.raw);
+
+	bmsdata->pack_voltage = CELL_VOLT_SUM_TO_FLOAT(total_volt, (NUM_CELLS));
+	bmsdata->avg_voltage = bmsdata->pack_voltage / (NUM_CELLS);
+	bmsdata->delt_voltage =
+		bmsdata->max_voltage.val - bmsdata->min_voltage.val;
+
+	bmsdata->pack_ocv = CELL_VOLT_SUM_TO_FLOAT(total_ocv, (NUM_CELLS));
+	bmsdata->avg_ocv = bmsdata->pack_ocv / (NUM_CELLS);
+	bmsdata->delt_ocv = bmsdata->max_ocv.val - bmsdata->min_ocv.val;
+
+	mark_updated(bmsdata, ANALYZED_PACK_STATS);
+
+#ifdef DEBUG_ANALYZER_BENCH
+	bench_end(&bench, start);
+#endif
 }
 
-void calc_cell_voltages(bms_t *bmsdata)
+/* HAL tick each cell went past each limit at, valid while its bit is set */
+static uint32_t cell_fault_onset[CELL_FAULTS][NUM_CHIPS][NUM_CELLS_PER_CHIP];
+
+/**
+ * @brief Take a chip's new mask of cells past a limit, stamping the cells that went past it since the last one.
+ */
+static void set_cell_faults(bms_t *bmsdata, cell_fault_t fault, uint8_t chip,
+			    uint16_t mask, uint32_t now)
 {
-	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
-		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[chip]);
+	uint16_t onset = mask & ~bmsdata->cell_fault_mask[fault][chip];
+	for (; onset; onset &= onset - 1) {
+		cell_fault_onset[fault][chip][__builtin_ctz(onset)] = now;
+	}
+	bmsdata->cell_fault_mask[fault][chip] = mask;
+}
 
-		for (uint8_t cell = 0; cell < num_cells; cell++) {
-			if (VOLTS_FAIL_MAP[chip][cell]) {
-				static bool is_first = true;
-				if (is_first) {
-					bmsdata->chip_data[chip]
-						.cell_voltages[cell] = 3.5;
-					is_first = false;
-				} else {
-					bmsdata->chip_data[chip]
-						.cell_voltages[cell] =
-						bmsdata->segment_average_volts
-							[chip / 2];
+void calc_cell_faults(bms_t *bmsdata, uint32_t chips, uint32_t flag_chips)
+{
+#ifdef DEBUG_ANALYZER_BENCH
+	static cycle_bench_t bench = { .name = "Cell faults" };
+	uint32_t start = bench_start();
+#endif
+
+	uint32_t now = HAL_GetTick();
+
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		if (chips & (1UL << c)) {
+			const cell_volt_t *ocv = bmsdata->open_cell_voltage[c];
+
+			set_cell_faults(bmsdata, CELL_FAULT_OV, c,
+					mask_cell_volt_above(
+						ocv, CELL_VOLT(MAX_VOLT)),
+					now);
+			set_cell_faults(bmsdata, CELL_FAULT_CHARGE_OV, c,
+					mask_cell_volt_above(
+						ocv, CELL_VOLT(MAX_CHARGE_VOLT)),
+					now);
+			set_cell_faults(bmsdata, CELL_FAULT_UV, c,
+					mask_cell_volt_below(
+						ocv, CELL_VOLT(MIN_VOLT)),
+					now);
+			set_cell_faults(bmsdata, CELL_FAULT_DEEP_UV, c,
+					mask_cell_volt_below(ocv,
+							     CELL_VOLT(0.9)),
+					now);
+			set_cell_faults(bmsdata, CELL_FAULT_OT, c,
+					mask_float_above(bmsdata->cell_temp[c],
+							 MAX_CELL_TEMP),
+					now);
+		}
+
+		// the comparators' flags, read far more often than the cells
+		if (flag_chips & (1UL << c)) {
+			set_cell_faults(bmsdata, CELL_FAULT_HW_OV, c,
+					mask_flags(bmsdata->chips[c].statd.c_ov),
+					now);
+			set_cell_faults(bmsdata, CELL_FAULT_HW_UV, c,
+					mask_flags(bmsdata->chips[c].statd.c_uv),
+					now);
+		}
+
+		// durations grow every pass, whether the chip was rescanned or not
+		for (uint8_t f = 0; f < CELL_FAULTS; f++) {
+			uint32_t longest = 0;
+			for (uint16_t cells = bmsdata->cell_fault_mask[f][c];
+			     cells; cells &= cells - 1) {
+				uint32_t ms =
+					now - cell_fault_onset[f][c]
+							      [__builtin_ctz(cells)];
+				if (ms > longest) {
+					longest = ms;
 				}
-			} else if (bmsdata->current_state == CHARGING) {
-				// in charging state, we read single shot c codes ONLY
-				bmsdata->chip_data[chip].cell_voltages[cell] =
-					getVoltage(bmsdata->chips[chip]
-							   .cell.c_codes[cell]);
-			} else {
-				bmsdata->chip_data[chip].cell_voltages[cell] =
-					getVoltage(
-						bmsdata->chips[chip]
-							.fcell.fc_codes[cell]);
-				// if (chip == 5 && cell == 2)
-				// 	bmsdata->chip_data[chip]
-				// 		.cell_voltages[cell] = 2.4;
 			}
+			bmsdata->cell_fault_ms[f][c] = longest;
 		}
 	}
+
+	mark_updated(bmsdata, ANALYZED_CELL_FAULTS);
+
+#ifdef DEBUG_ANALYZER_BENCH
+	bench_end(&bench, start);
+#endif
 }
 
-void calc_pack_voltage_stats(bms_t *bmsdata)
+void calc_snapshot(bms_t *bmsdata)
 {
-	bmsdata->max_voltage.val = FLT_MIN;
-	bmsdata->max_voltage.cellNum = 0;
-	bmsdata->max_voltage.chipIndex = 0;
+	segment_snapshot_t snap;
+	segment_get_snapshot(&snap);
 
-	bmsdata->max_ocv.val = FLT_MIN;
-	bmsdata->max_ocv.cellNum = 0;
-	bmsdata->max_ocv.chipIndex = 0;
+	uint32_t last_us = bmsdata->snapshot_us;
 
-	bmsdata->min_voltage.val = FLT_MAX;
-	bmsdata->min_voltage.cellNum = 0;
-	bmsdata->min_voltage.chipIndex = 0;
+	bmsdata->snapshot_us = snap.timestamp_us;
+	bmsdata->snapshot_coherent = snap.coherent && snap.has_current;
+	if (snap.has_current) {
+		bmsdata->pack_current = snap.pack_current;
+	}
 
-	bmsdata->min_ocv.val = FLT_MAX;
-	bmsdata->min_ocv.cellNum = 0;
-	bmsdata->min_ocv.chipIndex = 0;
+	// the current is only sampled with the cell voltages, so count charge and rest once per new snapshot
+	if (!last_us || snap.timestamp_us == last_us) {
+		return;
+	}
+	float dt_s = (snap.timestamp_us - last_us) / 1000000.0f;
 
-	float total_volt = 0;
-	float total_ocv = 0;
-	float total_seg_volt = 0;
+	bmsdata->pack_ah += bmsdata->pack_current * dt_s / 3600;
+	if (fabsf(bmsdata->pack_current) > OCV_CURR_THRESH) {
+		bmsdata->rest_s = 0;
+	} else {
+		bmsdata->rest_s += dt_s;
+	}
+}
 
-	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
-		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[c]);
-		for (uint8_t cell = 0; cell < num_cells; cell++) {
-			/* fings out the maximum cell voltage and location */
-			if (bmsdata->chip_data[c].cell_voltages[cell] >
-			    bmsdata->max_voltage.val) {
-				bmsdata->max_voltage.val =
-					bmsdata->chip_data[c]
-						.cell_voltages[cell];
-				bmsdata->max_voltage.chipIndex = c;
-				bmsdata->max_voltage.cellNum = cell;
-			}
+/* impedance estimates of every cell group, and the state they share */
+static impedance_rls_t imp_rls;
+static impedance_cell_t imp_cells[NUM_CHIPS][NUM_CELLS_PER_CHIP];
 
-			if (bmsdata->chip_data[c].open_cell_voltage[cell] >
-			    bmsdata->max_ocv.val) {
-				bmsdata->max_ocv.val =
-					bmsdata->chip_data[c]
-						.open_cell_voltage[cell];
-				bmsdata->max_ocv.chipIndex = c;
-				bmsdata->max_ocv.cellNum = cell;
-			}
+void calc_cell_resistances(bms_t *bmsdata, uint32_t chips)
+{
+	static uint32_t last_us;
+	/* chips whose cells hold voltages from the previous measurement, the others restart their differences */
+	static uint32_t primed_chips = 0;
+	static bool started = false;
 
-			/* finds out the minimum cell voltage and location */
-			if (bmsdata->chip_data[c].cell_voltages[cell] <
-			    bmsdata->min_voltage.val) {
-				bmsdata->min_voltage.val =
-					bmsdata->chip_data[c]
-						.cell_voltages[cell];
-				bmsdata->min_voltage.chipIndex = c;
-				bmsdata->min_voltage.cellNum = cell;
+	if (!chips) {
+		return;
+	}
+
+	if (!started) {
+		impedance_init(&imp_rls, bmsdata->pack_current);
+		for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+			for (uint8_t cell = 0; cell < NUM_CELLS_PER_CHIP;
+			     cell++) {
+				impedance_cell_init(
+					&imp_cells[c][cell],
+					CELL_VOLT_TO_FLOAT(
+						bmsdata->cell_voltages[c][cell]),
+					TYP_IMPDNCE / CELLS_IN_PARALLEL);
 			}
+		}
+		last_us = bmsdata->snapshot_us;
+		primed_chips = chips;
+		started = true;
+	} else {
+		float dt_s = (bmsdata->snapshot_us - last_us) / 1000000.0f;
+		last_us = bmsdata->snapshot_us;
+
+		// a voltage and current from different instants give garbage at high current
+		impedance_step(&imp_rls, bmsdata->pack_current, dt_s,
+			       bmsdata->snapshot_coherent);
 
-			if (bmsdata->chip_data[c].open_cell_voltage[cell] <
-			    bmsdata->min_ocv.val) {
-				bmsdata->min_ocv.val =
-					bmsdata->chip_data[c]
-						.open_cell_voltage[cell];
-				bmsdata->min_ocv.chipIndex = c;
-				bmsdata->min_ocv.cellNum = cell;
+		for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+			uint8_t num_cells =
+				get_num_cells(&bmsdata->chip_data[c]);
+
+			if (!(chips & (1UL << c))) {
+				continue;
 			}
 
-			total_volt += bmsdata->chip_data[c].cell_voltages[cell];
-			total_ocv +=
-				bmsdata->chip_data[c].open_cell_voltage[cell];
+			for (uint8_t cell = 0; cell < num_cells; cell++) {
+				float volts = CELL_VOLT_TO_FLOAT(
+					bmsdata->cell_voltages[c][cell]);
 
-			total_seg_volt +=
-				bmsdata->chip_data[c].open_cell_voltage[cell];
-		}
-		if (c % 2 == 1) {
-			bmsdata->segment_average_volts[c / 2] =
-				total_seg_volt /
-				((float)(NUM_CELLS * 2));
-			total_seg_volt = 0;
+				if (primed_chips & (1UL << c)) {
+					impedance_cell_update(
+						&imp_rls, &imp_cells[c][cell], volts);
+				} else {
+					imp_cells[c][cell].last_volts = volts;
+				}
+			}
 		}
+		primed_chips = chips;
 	}
 
-	/* calculate some voltage stats */
-	// TODO: Make this based on total cells when actual segment is here
-	bmsdata->avg_voltage = total_volt / NUM_CELLS;
-
-	bmsdata->pack_voltage = total_volt;
+	// the groups are in series, so the pack's resistance is their sum
+	bmsdata->pack_res = 0;
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[c]);
 
-	bmsdata->delt_voltage =
-		bmsdata->max_voltage.val - bmsdata->min_voltage.val;
+		for (uint8_t cell = 0; cell < num_cells; cell++) {
+			float res = imp_cells[c][cell].r0;
+
+			bmsdata->cell_resistance[c][cell] = res;
+			bmsdata->cell_polarization[c][cell] =
+				imp_cells[c][cell].r1;
+			bmsdata->pack_res += res;
+
+			if ((c == 0 && cell == 0) ||
+			    res > bmsdata->max_res.val) {
+				bmsdata->max_res.val = res;
+				bmsdata->max_res.chipIndex = c;
+				bmsdata->max_res.cellNum = cell;
+			}
+			if ((c == 0 && cell == 0) ||
+			    res < bmsdata->min_res.val) {
+				bmsdata->min_res.val = res;
+				bmsdata->min_res.chipIndex = c;
+				bmsdata->min_res.cellNum = cell;
+			}
+		}
+	}
 
-	bmsdata->avg_ocv = total_ocv / NUM_CELLS;
-	bmsdata->pack_ocv = total_ocv;
-	bmsdata->delt_ocv = bmsdata->max_ocv.val - bmsdata->min_ocv.val;
+	mark_updated(bmsdata, ANALYZED_RESISTANCES);
 }
 
-void calc_cell_resistances(bms_t *bmsdata)
+void calc_state_of_power(bms_t *bmsdata)
 {
+#ifdef DEBUG_ANALYZER_BENCH
+	static cycle_bench_t bench = { .name = "State of power" };
+	uint32_t start = bench_start();
+#endif
+
+	sop_limits_init(bmsdata->sop_dcl, bmsdata->sop_ccl);
+
 	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
 		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[c]);
 
 		for (uint8_t cell = 0; cell < num_cells; cell++) {
-			if (fabs(bmsdata->pack_current) >= 0.001) {
-				bmsdata->chip_data[c].cell_resistance[cell] =
-					(bmsdata->chip_data[c]
-						 .open_cell_voltage[cell] -
-					 bmsdata->chip_data[c]
-						 .cell_voltages[cell]) /
-					fabs(bmsdata->pack_current);
+			sop_cell_t sop;
+
+			sop.ocv = soc_ocv(bmsdata->cell_soc[c][cell] / 100,
+					  &sop.slope);
+			sop.capacity = bmsdata->cell_capacity[c][cell];
+			// an estimate gone far under the datasheet value would give a wild limit
+			sop.r0 = fmaxf(bmsdata->cell_resistance[c][cell],
+				       TYP_IMPDNCE / CELLS_IN_PARALLEL / 2);
+			sop.r1 = fmaxf(bmsdata->cell_polarization[c][cell], 0);
+
+			// what is left of the drop from the OCV once the ohmic part is taken out
+			if (bmsdata->snapshot_coherent) {
+				sop.polarization =
+					sop.ocv -
+					CELL_VOLT_TO_FLOAT(
+						bmsdata->cell_voltages[c][cell]) -
+					bmsdata->pack_current * sop.r0;
 			} else {
-				bmsdata->chip_data[c].cell_resistance[cell] =
-					0.015; // default resistance from data sheet
+				sop.polarization =
+					bmsdata->pack_current * sop.r1;
 			}
+
+			sop_cell_limits(&sop, bmsdata->sop_dcl,
+					bmsdata->sop_ccl);
 		}
 	}
+
+#ifdef DEBUG_ANALYZER_BENCH
+	bench_end(&bench, start);
+#endif
 }
 
 void calc_cont_dcl(bms_t *bmsdata)
@@ -395,12 +719,16 @@ void calc_cont_dcl(bms_t *bmsdata)
 	float min_cell_voltage = bmsdata->min_ocv.val;
 
 	float temp_derate_factor = 0.0f;
-	float cell_volt_derate_factor = 0.0f;
+
+	mark_updated(bmsdata, ANALYZED_LIMITS);
 
 	// All cell discharge limits were obtained from P45B Datasheet.
 
 	if (min_temp <= MIN_DISCHG_TEMP || max_temp >= MAX_CELL_TEMP ||
 	    min_cell_voltage <= MIN_VOLT) {
+		for (int h = 0; h < SOP_HORIZONS; h++) {
+			bmsdata->sop_dcl[h] = 0.0f;
+		}
 		bmsdata->cont_DCL = 0.0f;
 		return;
 	}
@@ -419,26 +747,21 @@ void calc_cont_dcl(bms_t *bmsdata)
 		temp_derate_factor = 1.0f;
 	}
 
-	/* Cell Voltage Derating: 3.0–2.5V ramp down
-	   Below 3.0V, the pack begins reducing DCL to avoid deep discharge.
-	   DCL drops to 30A at 2.5V, and shuts off completely below MIN_VOLT. */
-	if (min_cell_voltage < 3.0f && min_cell_voltage > 2.5f) {
-		cell_volt_derate_factor =
-			1.0f - ((3.0f - min_cell_voltage) / 0.5f) *
-				       (1.0f - (MIN_DCL /
-						(float)(MAX_PACK_DISCHG_CURR)));
-	} else {
-		cell_volt_derate_factor = 1.0f;
-	}
-
-	float scaled_dcl = MAX_PACK_DISCHG_CURR * temp_derate_factor *
-			   cell_volt_derate_factor;
+	float scaled_dcl = MAX_PACK_DISCHG_CURR * temp_derate_factor;
 
 	if (scaled_dcl < MIN_DCL) {
 		scaled_dcl = MIN_DCL;
 	}
 
-	bmsdata->cont_DCL = 200;
+	/* The cell voltages are kept up by the state of power limits, they go to 0 as the weakest group nears
+	   MIN_VOLT, the temperature and current ratings cap them. */
+	for (int h = 0; h < SOP_HORIZONS; h++) {
+		if (bmsdata->sop_dcl[h] > scaled_dcl) {
+			bmsdata->sop_dcl[h] = scaled_dcl;
+		}
+	}
+
+	bmsdata->cont_DCL = bmsdata->sop_dcl[SOP_CONT];
 }
 
 void calc_cont_ccl(bms_t *bmsdata)
@@ -449,13 +772,18 @@ void calc_cont_ccl(bms_t *bmsdata)
 
 	float temp_cold_factor = 0.0f;
 	float temp_hot_factor = 0.0f;
-	float cell_volt_derate_factor = 0.0f;
+
+	mark_updated(bmsdata, ANALYZED_LIMITS);
 
 	// All cell charge limits were obtained from P45B Datasheet.
 
 	/* Temperature Derating: 0–10°C ramp up, 45–60°C ramp down
 	   10°C and 45°C chosen as safe margins from P45B charge temp limits. */
-	if (min_temp <= MIN_CHG_TEMP || max_temp >= MAX_CELL_TEMP) {
+	if (min_temp <= MIN_CHG_TEMP || max_temp >= MAX_CELL_TEMP ||
+	    max_cell_voltage >= MAX_CHARGE_VOLT) {
+		for (int h = 0; h < SOP_HORIZONS; h++) {
+			bmsdata->sop_ccl[h] = 0.0f;
+		}
 		bmsdata->cont_CCL = 0.0f;
 		return;
 	} else if (min_temp < 10.0f) {
@@ -472,36 +800,33 @@ void calc_cont_ccl(bms_t *bmsdata)
 		temp_hot_factor = 1.0f;
 	}
 
-	/* Cell Voltage Derating: 4.15–4.205V ramp down
-	   4.15V was chosen to reduce current early and avoid overshooting the max limit. */
-	if (max_cell_voltage >= MAX_CHARGE_VOLT) {
-		cell_volt_derate_factor = 0.0f;
-	} else if (max_cell_voltage > 4.15f) {
-		cell_volt_derate_factor = (MAX_CHARGE_VOLT - max_cell_voltage) /
-					  (MAX_CHARGE_VOLT - 4.15f);
-	} else {
-		cell_volt_derate_factor = 1.0f;
+	/* The state of power limits go to 0 as the strongest group nears MAX_CHARGE_VOLT, the temperature and
+	   current ratings cap them. */
+	float scaled_ccl =
+		MAX_PACK_CHG_CURR * temp_cold_factor * temp_hot_factor;
+	for (int h = 0; h < SOP_HORIZONS; h++) {
+		if (bmsdata->sop_ccl[h] > scaled_ccl) {
+			bmsdata->sop_ccl[h] = scaled_ccl;
+		}
 	}
 
-	// bmsdata->cont_CCL = MAX_PACK_CHG_CURR * temp_cold_factor *
-	// 		    temp_hot_factor * cell_volt_derate_factor;
-	bmsdata->cont_CCL = 40;
+	bmsdata->cont_CCL = bmsdata->sop_ccl[SOP_CONT];
 }
 
-void calc_open_cell_voltage(bms_t *bmsdata)
+uint32_t calc_open_cell_voltage(bms_t *bmsdata, uint32_t chips)
 {
 	static bool is_first_reading = true;
 	/* if there is no previous data point, set inital open cell voltage to current reading */
 	if (is_first_reading) {
 		// sanity check the last cell that the reading is good, oftentimes the first readings are bad
-		float last_cell =
-			bmsdata->chip_data[NUM_CHIPS - 1].cell_voltages
-				[get_num_cells(
-					 &bmsdata->chip_data[NUM_CHIPS - 1]) -
-				 1];
-		if (last_cell > 1 && last_cell < 5) {
+		cell_volt_t last_cell =
+			bmsdata->cell_voltages[NUM_CHIPS - 1]
+					      [get_num_cells(
+						       &bmsdata->chip_data[NUM_CHIPS -
+									   1]) -
+					       1];
+		if (last_cell > CELL_VOLT(1) && last_cell < CELL_VOLT(5)) {
 			is_first_reading = false;
-			start_timer(&ocvTimer, 750);
 		}
 
 		for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
@@ -509,66 +834,678 @@ void calc_open_cell_voltage(bms_t *bmsdata)
 			uint8_t num_cells =
 				get_num_cells(&bmsdata->chip_data[chip]);
 			for (uint8_t cell = 0; cell < num_cells; cell++) {
-				bmsdata->chip_data[chip]
-					.open_cell_voltage[cell] =
-					bmsdata->chip_data[chip]
-						.cell_voltages[cell];
+				bmsdata->open_cell_voltage[chip][cell] =
+					bmsdata->cell_voltages[chip][cell];
 			}
 		}
-		return;
+		mark_updated(bmsdata, ANALYZED_OCV);
+		return SEGMENT_ALL_CHIPS;
 	}
-	// If we are within the current threshold for open voltage measurments (1.5 mA)
-	if (bmsdata->pack_current < OCV_CURR_THRESH &&
-	    bmsdata->pack_current > -1 * OCV_CURR_THRESH) {
-		// Timer expired or not active
-		if (is_timer_expired(&ocvTimer) ||
-		    !is_timer_active(&ocvTimer)) {
-			for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
-				// Number of cells in the chip
-				uint8_t num_cells = get_num_cells(
-					&bmsdata->chip_data[chip]);
-				for (uint8_t cell = 0; cell < num_cells;
-				     cell++) {
-					// Set current OCV value, ensure value is true OCV
-					if (bmsdata->chip_data[chip]
-							    .cell_voltages[cell] <
-						    4.5 &&
-					    bmsdata->chip_data[chip]
-							    .cell_voltages[cell] >
-						    2) {
-						bmsdata->chip_data[chip]
-							.open_cell_voltage[cell] =
-							bmsdata->chip_data[chip]
-								.cell_voltages
-									[cell];
-					} else {
-						bmsdata->chip_data[chip]
-							.open_cell_voltage[cell] =
-							bmsdata->segment_average_volts
-								[chip / 2];
-					}
-				}
+
+	/*
+	 * Add back the ohmic drop and polarization the impedance model gives for the current history.  At rest
+	 * both decay away, so the estimate settles onto the measured rest voltage on its own.
+	 */
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		// the rest have not changed since their OCV was last taken
+		if (!(chips & (1UL << chip))) {
+			continue;
+		}
+
+		// Number of cells in the chip
+		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[chip]);
+		for (uint8_t cell = 0; cell < num_cells; cell++) {
+			float ocv = impedance_ocv(
+				&imp_rls, &imp_cells[chip][cell],
+				CELL_VOLT_TO_FLOAT(
+					bmsdata->cell_voltages[chip][cell]));
+
+			// ensure value is a plausible OCV
+			if (ocv < 4.5f && ocv > 2.0f) {
+				bmsdata->open_cell_voltage[chip][cell] =
+					CELL_VOLT_FROM_FLOAT(ocv);
+			} else {
+				bmsdata->open_cell_voltage[chip][cell] =
+					CELL_VOLT_FROM_FLOAT(
+						bmsdata->segment_average_volts
+							[chip / 2]);
 			}
-		} else {
-			start_timer(&ocvTimer, 750);
 		}
 	}
+
+	if (chips) {
+		mark_updated(bmsdata, ANALYZED_OCV);
+	}
+	return chips;
 }
 
 void calc_state_of_charge(bms_t *bmsdata)
 {
-	double volts = (double)bmsdata->min_ocv.val;
+	static soc_ekf_t ekf;
+	static bool started = false;
+	static uint32_t last_us;
+
+	/*
+	 * Track the weakest cell group, the pack is empty when it is.  Its rest voltage is only trustworthy once
+	 * the pack statistics have seen a sane reading.
+	 */
+	if (!started) {
+		if (!bmsdata->updated_ms[ANALYZED_PACK_STATS] ||
+		    bmsdata->min_ocv.val < 2 || bmsdata->min_ocv.val > 4.5) {
+			return;
+		}
+		soc_ekf_init(&ekf, bmsdata->min_ocv.val);
+		last_us = bmsdata->snapshot_us;
+		started = true;
+	}
+
+	// the pack current is sampled with the cell voltages, so integrate it once per cell measurement
+	if (bmsdata->snapshot_us != last_us) {
+		float dt_s = (bmsdata->snapshot_us - last_us) / 1000000.0f;
+		last_us = bmsdata->snapshot_us;
+
+		soc_ekf_predict(&ekf, bmsdata->pack_current, dt_s,
+				TYP_CAPICITY_AH * CELLS_IN_PARALLEL);
+
+		// a voltage under load is useless without the current from the same instant
+		if (bmsdata->snapshot_coherent ||
+		    fabsf(bmsdata->pack_current) < OCV_CURR_THRESH) {
+			soc_ekf_correct(&ekf, bmsdata->min_voltage.val,
+					bmsdata->pack_current,
+					bmsdata->cell_resistance
+						[bmsdata->min_voltage.chipIndex]
+						[bmsdata->min_voltage.cellNum],
+					soc_voltage_noise(bmsdata->pack_current,
+							  bmsdata->rest_s));
+		}
+	}
+
+	bmsdata->soc = ekf.soc * 100;
+	mark_updated(bmsdata, ANALYZED_SOC);
+}
+
+/* Rest before the OCV is trusted to anchor a capacity measurement, in s */
+#define CAPACITY_ANCHOR_REST_S 600
+/* Smallest swing in state of charge between anchors a capacity is measured over */
+#define CAPACITY_MIN_DSOC 0.2f
+/* Weight of each new capacity measurement */
+#define CAPACITY_GAIN 0.25f
+
+/* state of charge filter of every cell group, stepped with its chip's cell measurements */
+static soc_ekf_t cell_ekf[NUM_CHIPS][NUM_CELLS_PER_CHIP];
+/* snapshot_us each chip's filters were last stepped at */
+static uint32_t cell_ekf_us[NUM_CHIPS];
+
+/**
+ * @brief Measure the capacity of each group from the charge drawn between two rest OCVs.  The groups are in
+ * series, so they all see the same charge, and the state of charge each lost over it gives its capacity.
+ *
+ * @param bmsdata Pointer to BMS data struct.
+ */
+static void calc_cell_capacity(bms_t *bmsdata)
+{
+	static float anchor_soc[NUM_CHIPS][NUM_CELLS_PER_CHIP];
+	static float anchor_ah;
+	static bool anchored = false;
+	/* one anchor per rest */
+	static bool rested = false;
+
+	if (bmsdata->rest_s < CAPACITY_ANCHOR_REST_S) {
+		rested = false;
+		return;
+	}
+	if (rested) {
+		return;
+	}
+	rested = true;
+
+	// keep the old anchor if too little charge has moved to measure over
+	float ah = bmsdata->pack_ah - anchor_ah;
+	if (anchored && fabsf(ah) < CAPACITY_MIN_DSOC * TYP_CAPICITY_AH *
+					    CELLS_IN_PARALLEL) {
+		return;
+	}
+
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[c]);
+
+		for (uint8_t cell = 0; cell < num_cells; cell++) {
+			float soc = soc_from_ocv(CELL_VOLT_TO_FLOAT(
+				bmsdata->open_cell_voltage[c][cell]));
+			float dsoc = anchor_soc[c][cell] - soc;
+			anchor_soc[c][cell] = soc;
+
+			if (!anchored || fabsf(dsoc) < CAPACITY_MIN_DSOC) {
+				continue;
+			}
+
+			// a reading off the flat of the curve can give nonsense, ignore it
+			float capacity = ah / dsoc;
+			float *est = &bmsdata->cell_capacity[c][cell];
+			if (capacity > TYP_CAPICITY_AH * CELLS_IN_PARALLEL / 2 &&
+			    capacity < TYP_CAPICITY_AH * CELLS_IN_PARALLEL * 1.5f) {
+				*est += CAPACITY_GAIN * (capacity - *est);
+			}
+		}
+	}
+
+	anchor_ah = bmsdata->pack_ah;
+	anchored = true;
+}
+
+/**
+ * @brief Find the charge and energy the pack has left.  Discharge stops when the group with the least charge
+ * left is empty, so every group gives that much charge, each at its own point on the OCV curve.
+ *
+ * @param bmsdata Pointer to BMS data struct.
+ */
+static void calc_available_energy(bms_t *bmsdata)
+{
+	bmsdata->discharge_ah = FLT_MAX;
+	bmsdata->charge_ah = FLT_MAX;
+
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[c]);
+
+		for (uint8_t cell = 0; cell < num_cells; cell++) {
+			float capacity = bmsdata->cell_capacity[c][cell];
+			float left = cell_ekf[c][cell].soc * capacity;
+			float room = capacity - left;
+
+			if (left < bmsdata->discharge_ah) {
+				bmsdata->discharge_ah = left;
+				bmsdata->weakest_cell.val = left;
+				bmsdata->weakest_cell.chipIndex = c;
+				bmsdata->weakest_cell.cellNum = cell;
+			}
+			if (room < bmsdata->charge_ah) {
+				bmsdata->charge_ah = room;
+				bmsdata->strongest_cell.val = room;
+				bmsdata->strongest_cell.chipIndex = c;
+				bmsdata->strongest_cell.cellNum = cell;
+			}
+		}
+	}
+
+	float wh = 0;
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[c]);
+
+		for (uint8_t cell = 0; cell < num_cells; cell++) {
+			float capacity = bmsdata->cell_capacity[c][cell];
+			float soc = cell_ekf[c][cell].soc;
+
+			wh += capacity *
+			      (soc_energy(soc) -
+			       soc_energy(soc - bmsdata->discharge_ah / capacity));
+		}
+	}
+	bmsdata->pack_energy_wh = wh;
+}
+
+void calc_cell_soc(bms_t *bmsdata, uint32_t chips)
+{
+	static bool started = false;
+#ifdef DEBUG_ANALYZER_BENCH
+	static cycle_bench_t bench = { .name = "Cell SoC" };
+	uint32_t start = bench_start();
+#endif
+
+	// start every group from its rest voltage, once there is one
+	if (!started) {
+		if (!bmsdata->updated_ms[ANALYZED_OCV]) {
+			return;
+		}
+		for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+			for (uint8_t cell = 0; cell < NUM_CELLS_PER_CHIP;
+			     cell++) {
+				soc_ekf_init(&cell_ekf[c][cell],
+					     CELL_VOLT_TO_FLOAT(
+						     bmsdata->open_cell_voltage
+							     [c][cell]));
+				bmsdata->cell_capacity[c][cell] =
+					TYP_CAPICITY_AH * CELLS_IN_PARALLEL;
+			}
+			cell_ekf_us[c] = bmsdata->snapshot_us;
+		}
+		started = true;
+		chips = SEGMENT_ALL_CHIPS;
+	}
+
+	// the noise of a reading depends only on the pack current and rest, so it is the same for every group
+	float amps = bmsdata->pack_current;
+	bool correct = bmsdata->snapshot_coherent ||
+		       fabsf(amps) < OCV_CURR_THRESH;
+	float noise = soc_voltage_noise(amps, bmsdata->rest_s);
+
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[c]);
+
+		if (!(chips & (1UL << c))) {
+			continue;
+		}
+
+		float dt_s = (bmsdata->snapshot_us - cell_ekf_us[c]) /
+			     1000000.0f;
+		cell_ekf_us[c] = bmsdata->snapshot_us;
+
+		for (uint8_t cell = 0; cell < num_cells; cell++) {
+			soc_ekf_t *ekf = &cell_ekf[c][cell];
+
+			soc_ekf_predict(ekf, amps, dt_s,
+					bmsdata->cell_capacity[c][cell]);
+			if (correct) {
+				soc_ekf_correct(
+					ekf,
+					CELL_VOLT_TO_FLOAT(
+						bmsdata->cell_voltages[c][cell]),
+					amps, bmsdata->cell_resistance[c][cell],
+					noise);
+			}
+			bmsdata->cell_soc[c][cell] = ekf->soc * 100;
+		}
+	}
+
+	calc_cell_capacity(bmsdata);
+	calc_available_energy(bmsdata);
+	mark_updated(bmsdata, ANALYZED_CELL_SOC);
+
+#ifdef DEBUG_ANALYZER_BENCH
+	bench_end(&bench, start);
+#endif
+}
+
+#ifdef DEBUG_ANALYZER_BENCH
+
+/* Scratch copy of the pack the path comparisons run on, so they never touch the live one */
+static bms_t bench_bms;
+
+/**
+ * @brief Calculates pack temp, and avg, min, and max cell temperatures, one cell at a time.  The scalar
+ * reference calc_pack_stats() is checked against.
+ */
+static void calc_pack_temps(bms_t *bmsdata)
+{
+	bmsdata->max_temp.val = -FLT_MAX;
+	bmsdata->max_temp.cellNum = 0;
+	bmsdata->max_temp.chipIndex = 0;
+
+	bmsdata->min_temp.val = FLT_MAX;
+	bmsdata->min_temp.cellNum = 0;
+	bmsdata->min_temp.chipIndex = 0;
+
+	bmsdata->max_chiptemp.val = 0;
+
+	float total_temp = 0;
+	float total_seg_temp = 0;
+
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[c]);
+
+		for (uint8_t cell = 0; cell < num_cells; cell++) {
+			if (bmsdata->cell_temp[c][cell] >
+			    bmsdata->max_temp.val) {
+				bmsdata->max_temp.val =
+					bmsdata->cell_temp[c][cell];
+				bmsdata->max_temp.cellNum = cell;
+				bmsdata->max_temp.chipIndex = c;
+			}
+
+			/* finds out the minimum cell temp and location */
+			if (bmsdata->cell_temp[c][cell] <
+			    bmsdata->min_temp.val) {
+				bmsdata->min_temp.val =
+					bmsdata->cell_temp[c][cell];
+				bmsdata->min_temp.cellNum = cell;
+				bmsdata->min_temp.chipIndex = c;
+			}
+
+			total_temp += bmsdata->cell_temp[c][cell];
+			total_seg_temp += bmsdata->cell_temp[c][cell];
+		}
+		/* only for NERO */
+		if (c % 2 == 1) {
+			bmsdata->segment_average_temps[c / 2] =
+				total_seg_temp /
+				((float)(NUM_CELLS_PER_CHIP * 2));
+			total_seg_temp = 0;
+		}
+
+		if (bmsdata->max_chiptemp.val <
+		    bmsdata->chip_data[c].die_temp) {
+			bmsdata->max_chiptemp = (crit_chipval_t){
+				.chipNum = c,
+				.val = bmsdata->chip_data[c].die_temp
+			};
+		}
+	}
+
+	/* Takes the average of all the cell temperatures. */
+	bmsdata->avg_temp = total_temp / NUM_CELLS;
+}
+
+/**
+ * @brief Set a critical cell voltage as a cell_volt_t, its val in volts is filled once the whole pack is scanned.
+ */
+static inline void set_crit_volt(crit_cellval_t *crit, cell_volt_t raw,
+				 uint8_t chip, uint8_t cell)
+{
+	crit->raw = raw;
+	crit->chipIndex = chip;
+	crit->cellNum = cell;
+}
+
+/**
+ * @brief Calculate statistics about pack voltage, such as min and max cell volt, pack and avg voltage, pack and
+ * avg OCV, and deltas, one cell at a time.  The scalar reference calc_pack_stats() is checked against.
+ */
+static void calc_pack_voltage_stats(bms_t *bmsdata)
+{
+	set_crit_volt(&bmsdata->max_voltage, CELL_VOLT_LOWEST, 0, 0);
+	set_crit_volt(&bmsdata->max_ocv, CELL_VOLT_LOWEST, 0, 0);
+	set_crit_volt(&bmsdata->min_voltage, CELL_VOLT_HIGHEST, 0, 0);
+	set_crit_volt(&bmsdata->min_ocv, CELL_VOLT_HIGHEST, 0, 0);
+
+	cell_volt_sum_t total_volt = 0;
+	cell_volt_sum_t total_ocv = 0;
+	cell_volt_sum_t total_seg_volt = 0;
+	uint16_t total_cells = 0;
+	uint16_t seg_cells = 0;
+
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		uint8_t num_cells = get_num_cells(&bmsdata->chip_data[c]);
+		for (uint8_t cell = 0; cell < num_cells; cell++) {
+			cell_volt_t volt = bmsdata->cell_voltages[c][cell];
+			cell_volt_t ocv = bmsdata->open_cell_voltage[c][cell];
+
+			/* finds out the maximum cell voltage and location */
+			if (volt > bmsdata->max_voltage.raw) {
+				set_crit_volt(&bmsdata->max_voltage, volt, c,
+					      cell);
+			}
+
+			if (ocv > bmsdata->max_ocv.raw) {
+				set_crit_volt(&bmsdata->max_ocv, ocv, c, cell);
+			}
+
+			/* finds out the minimum cell voltage and location */
+			if (volt < bmsdata->min_voltage.raw) {
+				set_crit_volt(&bmsdata->min_voltage, volt, c,
+					      cell);
+			}
+
+			if (ocv < bmsdata->min_ocv.raw) {
+				set_crit_volt(&bmsdata->min_ocv, ocv, c, cell);
+			}
+
+			total_volt += volt;
+			total_ocv += ocv;
+			total_seg_volt += ocv;
+		}
+		total_cells += num_cells;
+		seg_cells += num_cells;
+		if (c % 2 == 1) {
+			bmsdata->segment_average_volts[c / 2] =
+				CELL_VOLT_SUM_TO_FLOAT(total_seg_volt,
+						       seg_cells) /
+				seg_cells;
+			total_seg_volt = 0;
+			seg_cells = 0;
+		}
+	}
+
+	/* convert to volts once the whole pack is in */
+	bmsdata->max_voltage.val = CELL_VOLT_TO_FLOAT(bmsdata->max_voltage.raw);
+	bmsdata->min_voltage.val = CELL_VOLT_TO_FLOAT(bmsdata->min_voltage.raw);
+	bmsdata->max_ocv.val = CELL_VOLT_TO_FLOAT(bmsdata->max_ocv.raw);
+	bmsdata->min_ocv.val = CELL_VOLT_TO_FLOAT(bmsdata->min_ocv.raw);
+
+	/* calculate some voltage stats */
+	bmsdata->pack_voltage = CELL_VOLT_SUM_TO_FLOAT(total_volt, total_cells);
+	bmsdata->avg_voltage = bmsdata->pack_voltage / total_cells;
+
+	bmsdata->delt_voltage =
+		bmsdata->max_voltage.val - bmsdata->min_voltage.val;
+
+	bmsdata->pack_ocv = CELL_VOLT_SUM_TO_FLOAT(total_ocv, total_cells);
+	bmsdata->avg_ocv = bmsdata->pack_ocv / total_cells;
+	bmsdata->delt_ocv = bmsdata->max_ocv.val - bmsdata->min_ocv.val;
+}
+
+void analyzer_compare_stats_paths(const bms_t *bmsdata)
+{
+	static nertimer_t compare_timer = { 0 };
+
+	if (!bench_due(&compare_timer)) {
+		return;
+	}
+
+	bench_bms = *bmsdata;
+
+	uint32_t start = bench_start();
+	calc_pack_temps(&bench_bms);
+	calc_pack_voltage_stats(&bench_bms);
+	uint32_t scalar_cycles = DWT->CYCCNT - start;
+
+	crit_cellval_t *crit[] = { &bench_bms.max_temp,	   &bench_bms.min_temp,
+				   &bench_bms.max_voltage, &bench_bms.min_voltage,
+				   &bench_bms.max_ocv,	   &bench_bms.min_ocv };
+	crit_cellval_t scalar[sizeof(crit) / sizeof(crit[0])];
+	for (uint8_t i = 0; i < sizeof(crit) / sizeof(crit[0]); i++) {
+		scalar[i] = *crit[i];
+	}
+	float avg_temp = bench_bms.avg_temp;
+	float pack_voltage = bench_bms.pack_voltage;
+	float pack_ocv = bench_bms.pack_ocv;
+
+	// the whole pack, as the first pass scans it.  The copy holds the cells the live segments were last
+	// scanned from, so the segments it leaves cached are the same.
+	start = DWT->CYCCNT;
+	calc_pack_stats(&bench_bms, SEGMENT_ALL_CHIPS);
+	uint32_t fused_cycles = DWT->CYCCNT - start;
+
+	bool match = fabsf(avg_temp - bench_bms.avg_temp) < 0.001f &&
+		     fabsf(pack_voltage - bench_bms.pack_voltage) < 0.001f &&
+		     fabsf(pack_ocv - bench_bms.pack_ocv) < 0.001f;
+	for (uint8_t i = 0; i < sizeof(crit) / sizeof(crit[0]); i++) {
+		match = match && scalar[i].chipIndex == crit[i]->chipIndex &&
+			scalar[i].cellNum == crit[i]->cellNum &&
+			fabsf(scalar[i].val - crit[i]->val) < 0.00001f;
+	}
+
+	printf("Pack stats paths: scalar %lu cycles, fused %lu cycles, %s\n",
+	       scalar_cycles, fused_cycles, match ? "match" : "MISMATCH");
+}
+
+void analyzer_compare_fault_paths(const bms_t *bmsdata)
+{
+	static nertimer_t compare_timer = { 0 };
+
+	if (!bench_due(&compare_timer)) {
+		return;
+	}
+
+	bench_bms = *bmsdata;
+
+	// the aggregate path has to find the extremes before it can compare them
+	uint32_t start = bench_start();
+	calc_pack_stats(&bench_bms, SEGMENT_ALL_CHIPS);
+	const bool aggregate[CELL_FAULT_HW_OV] = {
+		[CELL_FAULT_OV] = bench_bms.max_ocv.raw > CELL_VOLT(MAX_VOLT),
+		[CELL_FAULT_CHARGE_OV] = bench_bms.max_ocv.raw >
+					 CELL_VOLT(MAX_CHARGE_VOLT),
+		[CELL_FAULT_UV] = bench_bms.min_ocv.raw < CELL_VOLT(MIN_VOLT),
+		[CELL_FAULT_DEEP_UV] = bench_bms.min_ocv.raw < CELL_VOLT(0.9),
+		[CELL_FAULT_OT] = bench_bms.max_temp.val > MAX_CELL_TEMP,
+	};
+	uint32_t aggregate_cycles = DWT->CYCCNT - start;
+
+	// the copy's masks are the ones the live pass just took from the same cells, so no cell is stamped as a
+	// new onset, and the comparator flags are left alone
+	start = DWT->CYCCNT;
+	calc_cell_faults(&bench_bms, SEGMENT_ALL_CHIPS, 0);
+	bool per_cell[CELL_FAULT_HW_OV];
+	for (uint8_t f = 0; f < CELL_FAULT_HW_OV; f++) {
+		per_cell[f] = cell_faults_any(bench_bms.cell_fault_mask[f]);
+	}
+	uint32_t per_cell_cycles = DWT->CYCCNT - start;
+
+	// the comparator flags have no aggregate to check against
+	bool match = true;
+	for (uint8_t f = 0; f < CELL_FAULT_HW_OV; f++) {
+		match = match && aggregate[f] == per_cell[f];
+	}
+
+	printf("Cell fault paths: aggregate %lu cycles, per cell %lu cycles, %s\n",
+	       aggregate_cycles, per_cell_cycles,
+	       match ? "match" : "MISMATCH");
+}
+
+/**
+ * @brief Calculate a thermistor temperature from the curve fit, the way it was done before the lookup tables.
+ *
+ * @param code The raw aux ADC code of the thermistor.
+ * @param supply The voltage feeding the divider.
+ * @return float The temperature in degrees Celsius.
+ */
+static float calc_temp_fit(int16_t code, float supply)
+{
+	float voltage = getVoltage(code);
+	float coef = (THERM_PULLUP_OHMS * (supply - voltage)) / voltage /
+		     THERM_NOMINAL_OHMS;
+	return THERM_FIT_A8 * (pow(coef, 1.0 / 8)) +
+	       THERM_FIT_A4 * (pow(coef, 1.0 / 4)) +
+	       THERM_FIT_A2 * (pow(coef, 1.0 / 2)) + THERM_FIT_A1 * coef +
+	       THERM_FIT_A0;
+}
+
+void analyzer_compare_temp_paths(const bms_t *bmsdata)
+{
+	static nertimer_t compare_timer = { 0 };
+	static int16_t codes[NUM_CHIPS * NUM_CELLS_PER_CHIP];
+	static float fit[NUM_CHIPS * NUM_CELLS_PER_CHIP];
+	static float table[NUM_CHIPS * NUM_CELLS_PER_CHIP];
+
+	if (!bench_due(&compare_timer)) {
+		return;
+	}
+
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		for (uint8_t cell = 0; cell < NUM_CELLS_PER_CHIP; cell++) {
+			codes[chip * NUM_CELLS_PER_CHIP + cell] =
+				bmsdata->chips[chip]
+					.raux.ra_codes[THERM_MAP[cell]];
+		}
+	}
+
+	uint32_t start = bench_start();
+	for (uint16_t i = 0; i < NUM_CHIPS * NUM_CELLS_PER_CHIP; i++) {
+		fit[i] = calc_temp_fit(codes[i], THERM_CELL_SUPPLY_V);
+	}
+	uint32_t fit_cycles = DWT->CYCCNT - start;
+
+	start = DWT->CYCCNT;
+	for (uint16_t i = 0; i < NUM_CHIPS * NUM_CELLS_PER_CHIP; i++) {
+		table[i] = calc_cell_temp(codes[i]);
+	}
+	uint32_t table_cycles = DWT->CYCCNT - start;
+
+	// the table clamps where the fit runs away, only compare where neither is clamped
+	float max_diff = 0;
+	for (uint16_t i = 0; i < NUM_CHIPS * NUM_CELLS_PER_CHIP; i++) {
+		if (fit[i] >= -40 && fit[i] < THERM_LUT_MAX_C &&
+		    table[i] >= -40 && table[i] < THERM_LUT_MAX_C) {
+			max_diff = fmaxf(max_diff, fabsf(fit[i] - table[i]));
+		}
+	}
+
+	printf("Cell temp paths: fit %lu cycles, table %lu cycles, max diff %f C\n",
+	       fit_cycles, table_cycles, max_diff);
+}
+
+/**
+ * @brief Voltage statistics of the pack, as computed by both analysis paths.
+ */
+typedef struct {
+	float min;
+	float max;
+	float sum;
+	uint16_t min_at;
+	uint16_t max_at;
+	uint32_t cycles;
+} volt_stats_t;
+
+void analyzer_compare_voltage_paths(const bms_t *bmsdata)
+{
+	static nertimer_t compare_timer = { 0 };
+	static int16_t codes[NUM_CHIPS * NUM_CELLS_PER_CHIP];
 
-	double soc = (-55.919476 * pow(16.1336555, volts)) +
-		     (55.9296372 * pow(16.1330198, volts)) - 6.3330011;
+	if (!bench_due(&compare_timer)) {
+		return;
+	}
 
-	if (soc > 100) {
-		soc = 100;
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		for (uint8_t cell = 0; cell < NUM_CELLS_PER_CHIP; cell++) {
+			codes[chip * NUM_CELLS_PER_CHIP + cell] =
+				bmsdata->current_state == CHARGING ?
+					bmsdata->chips[chip].cell.c_codes[cell] :
+					bmsdata->chips[chip].fcell.fc_codes[cell];
+		}
 	}
 
-	else if (soc < 0) {
-		soc = 0;
+	// float path: convert every cell, then compare floats
+	volt_stats_t flt = { .min = FLT_MAX, .max = -FLT_MAX };
+	uint32_t start = bench_start();
+	for (uint16_t i = 0; i < NUM_CHIPS * NUM_CELLS_PER_CHIP; i++) {
+		float volts = getVoltage(codes[i]);
+		if (volts > flt.max) {
+			flt.max = volts;
+			flt.max_at = i;
+		}
+		if (volts < flt.min) {
+			flt.min = volts;
+			flt.min_at = i;
+		}
+		flt.sum += volts;
 	}
+	flt.cycles = DWT->CYCCNT - start;
+
+	// fixed path: compare codes, convert the results only
+	volt_stats_t fix = { 0 };
+	start = DWT->CYCCNT;
+	int16_t min_code = INT16_MAX;
+	int16_t max_code = INT16_MIN;
+	int32_t sum_code = 0;
+	for (uint16_t i = 0; i < NUM_CHIPS * NUM_CELLS_PER_CHIP; i++) {
+		if (codes[i] > max_code) {
+			max_code = codes[i];
+			fix.max_at = i;
+		}
+		if (codes[i] < min_code) {
+			min_code = codes[i];
+			fix.min_at = i;
+		}
+		sum_code += codes[i];
+	}
+	fix.min = min_code * CELL_CODE_LSB_V + CELL_CODE_OFFSET_V;
+	fix.max = max_code * CELL_CODE_LSB_V + CELL_CODE_OFFSET_V;
+	fix.sum = sum_code * CELL_CODE_LSB_V +
+		  NUM_CHIPS * NUM_CELLS_PER_CHIP * CELL_CODE_OFFSET_V;
+	fix.cycles = DWT->CYCCNT - start;
+
+	// the paths agree to float rounding, the sum drifts by the float path's accumulated error only
+	bool match = flt.min_at == fix.min_at && flt.max_at == fix.max_at &&
+		     fabsf(flt.min - fix.min) < 0.00001f &&
+		     fabsf(flt.max - fix.max) < 0.00001f &&
+		     fabsf(flt.sum - fix.sum) < 0.001f;
+
+	printf("Voltage stats paths: float %lu cycles, fixed %lu cycles, %s\n",
+	       flt.cycles, fix.cycles, match ? "match" : "MISMATCH");
+	if (!match) {
+		printf("float min %f@%u max %f@%u sum %f, fixed min %f@%u max %f@%u sum %f\n",
+		       flt.min, flt.min_at, flt.max, flt.max_at, flt.sum,
+		       fix.min, fix.min_at, fix.max, fix.max_at, fix.sum);
+	}
+}
 
-	bmsdata->soc = (float)soc;
-}
\ No newline at end of file
+#endif
@@ -4,6 +4,14 @@
 #include "bitstream.h"
 #include "shep_queues.h"
 #include "c_utils.h"
+#include "fault_trace.h"
+
+/* cell voltages go out in 100 uV units, cell codes are 150 uV from a 1.5 V offset */
+#ifdef ANALYZER_FIXED_POINT
+#define CELL_VOLT_TO_CAN(x) ((int32_t)(x) * 3 / 2 + 15000)
+#else
+#define CELL_VOLT_TO_CAN(x) ((x) * 10000)
+#endif
 
 static uint8_t queue_can_msg(can_msg_t can_msg) {
     return queue_send(&can_outgoing, &can_msg);
@@ -248,10 +256,10 @@ void send_cell_voltage_message(crit_cellval_t max_voltage,
 	uint8_t bitstream_data[8];
 	bitstream_init(&cell_voltage_msg, bitstream_data,
 		       8); // Create 7-byte bitstream
-	bitstream_add(&cell_voltage_msg, max_voltage.val * 10000, 16);
+	bitstream_add(&cell_voltage_msg, CELL_VOLT_TO_CAN(max_voltage.raw), 16);
 	bitstream_add(&cell_voltage_msg, max_voltage.chipIndex, 4);
 	bitstream_add(&cell_voltage_msg, max_voltage.cellNum, 4);
-	bitstream_add(&cell_voltage_msg, min_voltage.val * 10000, 16);
+	bitstream_add(&cell_voltage_msg, CELL_VOLT_TO_CAN(min_voltage.raw), 16);
 	bitstream_add(&cell_voltage_msg, min_voltage.chipIndex, 4);
 	bitstream_add(&cell_voltage_msg, min_voltage.cellNum, 4);
 	bitstream_add(&cell_voltage_msg, avg_voltage * 10000, 16);
@@ -715,30 +723,117 @@ void send_alpha_status_b_message(float v_res, uint8_t chip, float vref2,
 	// clang-format on
 }
 
-/**
- * @brief Sends a CAN message containing the PEC error count for a specific chip.
- *
- * @param chip_num The index of the chip that reported PEC errors.
- * @param pec_count The total number of PEC errors detected for the specified chip.
- */
-void send_pec_error_message(uint8_t chip_num, uint16_t pec_count)
+void send_link_quality_message(uint16_t stale_chips, uint16_t pack_error_rate,
+			       uint8_t worst_chip, uint16_t worst_error_rate,
+			       uint8_t retries)
+{
+	struct __attribute__((__packed__)) {
+		uint16_t stale_chips;
+		uint16_t pack_error_rate;
+		uint8_t worst_chip;
+		uint16_t worst_error_rate;
+		uint8_t retries;
+	} link_data;
+
+	link_data.stale_chips = stale_chips;
+	link_data.pack_error_rate = pack_error_rate;
+	link_data.worst_chip = worst_chip;
+	link_data.worst_error_rate = worst_error_rate;
+	link_data.retries = retries;
+
+	/* convert to big endian */
+	endian_swap(&link_data.stale_chips, sizeof(link_data.stale_chips));
+	endian_swap(&link_data.pack_error_rate,
+		    sizeof(link_data.pack_error_rate));
+	endian_swap(&link_data.worst_error_rate,
+		    sizeof(link_data.worst_error_rate));
+
+	can_msg_t msg = { .id = LINK_QUALITY_CANID,
+			  .len = LINK_QUALITY_SIZE,
+			  .data = { 0 } };
+
+	memcpy(&msg.data, &link_data, sizeof(link_data));
+
+	queue_can_msg(msg);
+}
+
+void send_cell_fault_message(uint32_t fault_code, uint8_t chip, uint16_t cells,
+			     uint32_t duration_ms)
 {
 	struct __attribute__((__packed__)) {
-		uint8_t chip_number;
-		uint16_t pec_error_count;
-	} pec_data;
+		uint8_t fault_code;
+		uint8_t chip;
+		uint16_t cells;
+		uint32_t duration_ms;
+	} cell_fault_data;
 
-	pec_data.chip_number = chip_num;
-	pec_data.pec_error_count = pec_count;
+	cell_fault_data.fault_code = log2(fault_code);
+	cell_fault_data.chip = chip;
+	cell_fault_data.cells = cells;
+	cell_fault_data.duration_ms = duration_ms;
+
+	/* convert to big endian */
+	endian_swap(&cell_fault_data.cells, sizeof(cell_fault_data.cells));
+	endian_swap(&cell_fault_data.duration_ms,
+		    sizeof(cell_fault_data.duration_ms));
 
-	endian_swap(&pec_data.pec_error_count,
-		    sizeof(pec_data.pec_error_count));
+	can_msg_t msg = { .id = CELL_FAULT_CANID,
+			  .len = CELL_FAULT_SIZE,
+			  .data = { 0 } };
+
+	memcpy(&msg.data, &cell_fault_data, sizeof(cell_fault_data));
+
+	queue_can_msg(msg);
+}
+
+void send_fault_trace_message(uint8_t hist, uint8_t first_bin,
+			      const uint16_t counts[3])
+{
+	struct __attribute__((__packed__)) {
+		uint8_t hist;
+		uint8_t first_bin;
+		uint16_t counts[3];
+	} fault_trace_data;
+
+	fault_trace_data.hist = hist;
+	fault_trace_data.first_bin = first_bin;
+	for (uint8_t i = 0; i < 3; i++) {
+		fault_trace_data.counts[i] = counts[i];
+		/* convert to big endian */
+		endian_swap(&fault_trace_data.counts[i],
+			    sizeof(fault_trace_data.counts[i]));
+	}
+
+	can_msg_t msg = { .id = FAULT_TRACE_CANID,
+			  .len = FAULT_TRACE_SIZE,
+			  .data = { 0 } };
+
+	memcpy(&msg.data, &fault_trace_data, sizeof(fault_trace_data));
+
+	queue_can_msg(msg);
+}
+
+void send_fault_trace_worst_message(uint8_t hist, uint32_t worst_us)
+{
+	struct __attribute__((__packed__)) {
+		uint8_t hist;
+		uint8_t first_bin;
+		uint32_t worst_us;
+	} fault_trace_data;
+
+	fault_trace_data.hist = hist;
+	fault_trace_data.first_bin = FAULT_TRACE_BINS;
+	fault_trace_data.worst_us = worst_us;
+
+	/* convert to big endian */
+	endian_swap(&fault_trace_data.worst_us,
+		    sizeof(fault_trace_data.worst_us));
 
-	can_msg_t msg = { .id = PEC_ERROR_CANID,
-			  .len = PEC_ERROR_SIZE,
+	can_msg_t msg = { .id = FAULT_TRACE_CANID,
+			  .len = FAULT_TRACE_SIZE,
 			  .data = { 0 } };
 
-	memcpy(&msg.data, &pec_data, sizeof(pec_data));
+	memcpy(&msg.data, &fault_trace_data, sizeof(fault_trace_data));
 
 	queue_can_msg(msg);
 }
@@ -168,10 +168,10 @@ int cell_data_log_measurement(struct BMSLogger *logger, bms_t *bms_data)
 
 		for (int cell = 0; cell < cell_count; cell++) {
 			entry->cell_voltages[chip_num][cell] =
-				bms_data->chip_data[chip_num]
-					.cell_voltages[cell];
+				CELL_VOLT_TO_FLOAT(
+					bms_data->cell_voltages[chip_num][cell]);
 			entry->cell_temperatures[chip_num][cell] =
-				bms_data->chip_data[chip_num].cell_temp[cell];
+				bms_data->cell_temp[chip_num][cell];
 		}
 	}
 
@@ -0,0 +1,83 @@
+/**
+ * @file cell_faults.c
+ * @brief Cell fault threshold kernels, on the DSP extension or in portable C.
+ */
+
+#include "cell_faults.h"
+
+#if defined(__ARM_ARCH) && !defined(CELL_FAULTS_PORTABLE)
+#include "arm_math.h"
+#if defined(ARM_MATH_DSP) && defined(ANALYZER_FIXED_POINT)
+#define CELL_FAULTS_SIMD
+#endif
+#endif
+
+#ifdef CELL_FAULTS_SIMD
+
+/**
+ * @brief Mark the cells of a chip past a limit, two cells per instruction.
+ */
+static inline uint16_t mask_q15(const int16_t *data, int16_t lim, bool above)
+{
+	uint32_t lim2 = __PKHBT(lim, lim, 16);
+	uint16_t mask = 0;
+
+	for (uint8_t i = 0; i < NUM_CELLS_PER_CHIP; i += 2) {
+		uint32_t cells = read_q15x2(&data[i]);
+		// saturating, so the sign of each half is right across the whole range of codes
+		uint32_t d = above ? __QSUB16(lim2, cells) :
+				     __QSUB16(cells, lim2);
+		mask |= ((d >> 15 & 1) | (d >> 30 & 2)) << i;
+	}
+	return mask;
+}
+
+uint16_t mask_cell_volt_above(const cell_volt_t *data, cell_volt_t lim)
+{
+	return mask_q15(data, lim, true);
+}
+
+uint16_t mask_cell_volt_below(const cell_volt_t *data, cell_volt_t lim)
+{
+	return mask_q15(data, lim, false);
+}
+
+#else
+
+uint16_t mask_cell_volt_above(const cell_volt_t *data, cell_volt_t lim)
+{
+	uint16_t mask = 0;
+	for (uint8_t i = 0; i < NUM_CELLS_PER_CHIP; i++) {
+		mask |= (uint16_t)(data[i] > lim) << i;
+	}
+	return mask;
+}
+
+uint16_t mask_cell_volt_below(const cell_volt_t *data, cell_volt_t lim)
+{
+	uint16_t mask = 0;
+	for (uint8_t i = 0; i < NUM_CELLS_PER_CHIP; i++) {
+		mask |= (uint16_t)(data[i] < lim) << i;
+	}
+	return mask;
+}
+
+#endif
+
+uint16_t mask_float_above(const float *data, float lim)
+{
+	uint16_t mask = 0;
+	for (uint8_t i = 0; i < NUM_CELLS_PER_CHIP; i++) {
+		mask |= (uint16_t)(data[i] > lim) << i;
+	}
+	return mask;
+}
+
+uint16_t mask_flags(const uint8_t *flags)
+{
+	uint16_t mask = 0;
+	for (uint8_t i = 0; i < NUM_CELLS_PER_CHIP; i++) {
+		mask |= (uint16_t)(flags[i] != 0) << i;
+	}
+	return mask;
+}
@@ -27,8 +27,8 @@ void chipsSelectionSort(bms_t *bmsdata,
 		for (int i = 0; i < cells; i++) {
 			replaced_val[chip][i] = (val_idexed_t){
 				.idex = i,
-				.val = bmsdata->chip_data[chip]
-					       .open_cell_voltage[i]
+				.val = CELL_VOLT_TO_FLOAT(
+					bmsdata->open_cell_voltage[chip][i])
 			};
 		}
 
@@ -0,0 +1,65 @@
+/**
+ * @file fault_table.c
+ * @brief The faults of fault_table.h, their conditions, and the timer each one trips on.
+ */
+
+#include "fault_table.h"
+#include <stdio.h>
+#include "can_messages.h"
+
+/* Every fault's description, expanded from fault_table.h */
+const fault_eval_t fault_table[NUM_FAULTS] = {
+#define FAULT_ENTRY(name, label, fault_code, critical, timeout_ms, cell_limit, \
+		    value, condition)                                         \
+	[FAULT_##name] = { .id = label,                                       \
+			   .code = fault_code,                                \
+			   .timeout = timeout_ms,                             \
+			   .is_critical = critical,                           \
+			   .cells = cell_limit },
+	FAULT_TABLE(FAULT_ENTRY)
+#undef FAULT_ENTRY
+};
+
+void fault_table_eval(const bms_t *b, bool present[NUM_FAULTS],
+		      float values[NUM_FAULTS])
+{
+	// each condition is compiled in place, and reads the pack state as it is now
+#define FAULT_EVAL(name, label, fault_code, critical, timeout_ms, cell_limit, \
+		   value, condition)                                         \
+	present[FAULT_##name] = (condition);                                  \
+	values[FAULT_##name] = (value);
+	FAULT_TABLE(FAULT_EVAL)
+#undef FAULT_EVAL
+}
+
+fault_stat_t sm_fault_eval(const fault_eval_t *item, nertimer_t *timer,
+			   bool fault_present, float value)
+{
+	if ((!(is_timer_active(timer))) && !fault_present) {
+		return 0;
+	}
+
+	if (is_timer_active(timer)) {
+		if (!fault_present) {
+			printf("\t\t\t*******Fault cleared: %s\n", item->id);
+			cancel_timer(timer);
+			send_fault_timer_message(0, item->code, value);
+			return FAULT_STAT_CLEARED;
+		}
+
+		if (is_timer_expired(timer) && fault_present) {
+			printf("\t\t\t*******Faulted: %s\n", item->id);
+			send_fault_timer_message(2, item->code, value);
+			return FAULT_STAT_FAULTED;
+		}
+
+		return 0;
+	}
+
+	printf("\t\t\t*******Starting fault timer: %s\n", item->id);
+	start_timer(timer, item->timeout);
+	send_fault_timer_message(1, item->code, value);
+
+	return 0;
+}
+
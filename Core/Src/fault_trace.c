@@ -0,0 +1,245 @@
+/**
+ * @file fault_trace.c
+ * @brief Fault pipeline trace points and latency histograms.
+ */
+
+#include "fault_trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "adi6830_interation.h"
+#include "can_messages.h"
+#include "shep_mutexes.h"
+
+/* Samples in flight at once, a record is reused this many samples after it was started */
+#define FAULT_TRACE_RECORDS 4
+
+/* Bins each CAN message carries */
+#define FAULT_TRACE_BINS_PER_MSG 3
+
+typedef struct {
+	uint32_t sample_us;
+	uint32_t stamp_us[FAULT_TRACE_STAGES];
+	/* bit per fault_trace_stage_t stamped */
+	uint8_t marked;
+} trace_record_t;
+
+typedef struct {
+	uint16_t bins[FAULT_TRACE_BINS];
+	uint32_t worst_us;
+} trace_hist_t;
+
+static const char *const HIST_NAMES[FAULT_HISTS] = {
+	[FAULT_HIST_READOUT] = "conversion to readout",
+	[FAULT_HIST_PUBLISH] = "readout to publish",
+	[FAULT_HIST_EVAL] = "publish to evaluation",
+	[FAULT_HIST_TRANSITION] = "evaluation to transition",
+	[FAULT_HIST_CAN_TX] = "transition to CAN",
+	[FAULT_HIST_DECISION] = "conversion to evaluation",
+	[FAULT_HIST_RESPONSE] = "conversion to CAN",
+};
+
+/* records, fault_record and hists are written from the segment, analyzer, state machine and CAN threads, under
+   fault_trace_mutex */
+static trace_record_t records[FAULT_TRACE_RECORDS];
+static uint8_t next_record;
+
+/* the faulting sample, copied so it outlives its record, until its zero discharge limit leaves */
+static trace_record_t fault_record;
+static volatile bool fault_pending;
+
+static trace_hist_t hists[FAULT_HISTS];
+
+/**
+ * @brief Bin a latency.
+ */
+static void hist_add(fault_hist_t hist, uint32_t us)
+{
+	trace_hist_t *h = &hists[hist];
+	uint8_t bin = 0;
+
+	if (us >> FAULT_TRACE_MIN_SHIFT) {
+		bin = 32 - __builtin_clz(us) - FAULT_TRACE_MIN_SHIFT;
+		if (bin >= FAULT_TRACE_BINS) {
+			bin = FAULT_TRACE_BINS - 1;
+		}
+	}
+
+	if (h->bins[bin] < UINT16_MAX) {
+		h->bins[bin]++;
+	}
+	if (us > h->worst_us) {
+		h->worst_us = us;
+	}
+}
+
+/**
+ * @brief Bin the latency between two trace points of a sample, if it reached both.
+ */
+static void hist_add_span(fault_hist_t hist, const trace_record_t *record,
+			  fault_trace_stage_t from, fault_trace_stage_t to)
+{
+	uint8_t both = (1 << from) | (1 << to);
+	if ((record->marked & both) == both) {
+		hist_add(hist,
+			 record->stamp_us[to] - record->stamp_us[from]);
+	}
+}
+
+void fault_trace_sample(uint32_t conversion_us, uint32_t sample_us)
+{
+	uint32_t readout_us = adbms_get_us();
+
+	mutex_get(&fault_trace_mutex);
+	trace_record_t *record = &records[next_record];
+	next_record = (next_record + 1) % FAULT_TRACE_RECORDS;
+
+	record->sample_us = sample_us;
+	record->stamp_us[FAULT_TRACE_CONVERSION] = conversion_us;
+	record->stamp_us[FAULT_TRACE_READOUT] = readout_us;
+	record->marked = (1 << FAULT_TRACE_CONVERSION) |
+			 (1 << FAULT_TRACE_READOUT);
+	mutex_put(&fault_trace_mutex);
+}
+
+void fault_trace_mark(fault_trace_stage_t stage, uint32_t sample_us)
+{
+	uint32_t now_us = adbms_get_us();
+
+	mutex_get(&fault_trace_mutex);
+	trace_record_t *record = NULL;
+	for (uint8_t i = 0; i < FAULT_TRACE_RECORDS; i++) {
+		if (records[i].marked && records[i].sample_us == sample_us) {
+			record = &records[i];
+			break;
+		}
+	}
+
+	// a sample is only timed the first time it reaches a trace point, later passes over it are not news
+	if (!record || record->marked & (1 << stage)) {
+		mutex_put(&fault_trace_mutex);
+		return;
+	}
+	record->stamp_us[stage] = now_us;
+	record->marked |= 1 << stage;
+
+	switch (stage) {
+	case FAULT_TRACE_EVAL:
+		hist_add_span(FAULT_HIST_READOUT, record,
+			      FAULT_TRACE_CONVERSION, FAULT_TRACE_READOUT);
+		hist_add_span(FAULT_HIST_PUBLISH, record, FAULT_TRACE_READOUT,
+			      FAULT_TRACE_PUBLISH);
+		hist_add_span(FAULT_HIST_EVAL, record, FAULT_TRACE_PUBLISH,
+			      FAULT_TRACE_EVAL);
+		hist_add_span(FAULT_HIST_DECISION, record,
+			      FAULT_TRACE_CONVERSION, FAULT_TRACE_EVAL);
+		break;
+	case FAULT_TRACE_TRANSITION:
+		hist_add_span(FAULT_HIST_TRANSITION, record, FAULT_TRACE_EVAL,
+			      FAULT_TRACE_TRANSITION);
+		fault_record = *record;
+		fault_pending = true;
+		break;
+	default:
+		break;
+	}
+	mutex_put(&fault_trace_mutex);
+}
+
+void fault_trace_can_tx(uint32_t id, const uint8_t *data)
+{
+	// the first zero discharge limit after the transition is the one it queued
+	if (!fault_pending || id != DISCHARGE_CANID || data[0] || data[1]) {
+		return;
+	}
+
+	uint32_t now_us = adbms_get_us();
+
+	mutex_get(&fault_trace_mutex);
+	if (!fault_pending) {
+		mutex_put(&fault_trace_mutex);
+		return;
+	}
+	fault_record.stamp_us[FAULT_TRACE_CAN_TX] = now_us;
+	fault_record.marked |= 1 << FAULT_TRACE_CAN_TX;
+	hist_add_span(FAULT_HIST_CAN_TX, &fault_record, FAULT_TRACE_TRANSITION,
+		      FAULT_TRACE_CAN_TX);
+	hist_add_span(FAULT_HIST_RESPONSE, &fault_record,
+		      FAULT_TRACE_CONVERSION, FAULT_TRACE_CAN_TX);
+	fault_pending = false;
+	mutex_put(&fault_trace_mutex);
+}
+
+uint32_t fault_trace_get(fault_hist_t hist, uint16_t bins[FAULT_TRACE_BINS])
+{
+	mutex_get(&fault_trace_mutex);
+	memcpy(bins, hists[hist].bins, sizeof(hists[hist].bins));
+	uint32_t worst_us = hists[hist].worst_us;
+	mutex_put(&fault_trace_mutex);
+
+	return worst_us;
+}
+
+void fault_trace_send(fault_hist_t hist)
+{
+	uint16_t bins[FAULT_TRACE_BINS + FAULT_TRACE_BINS_PER_MSG - 1] = { 0 };
+
+	// sent from a copy, queueing can block and the CAN dispatch thread takes the lock
+	uint32_t worst_us = fault_trace_get(hist, bins);
+
+	for (uint8_t bin = 0; bin < FAULT_TRACE_BINS;
+	     bin += FAULT_TRACE_BINS_PER_MSG) {
+		send_fault_trace_message(hist, bin, &bins[bin]);
+	}
+	send_fault_trace_worst_message(hist, worst_us);
+}
+
+void fault_trace_print(void)
+{
+	// printed from a copy, the UART is far too slow to hold the lock over
+	static trace_hist_t copy[FAULT_HISTS];
+	mutex_get(&fault_trace_mutex);
+	memcpy(copy, hists, sizeof(hists));
+	mutex_put(&fault_trace_mutex);
+
+	for (uint8_t h = 0; h < FAULT_HISTS; h++) {
+		printf("Fault trace, %s: worst %lu us\n", HIST_NAMES[h],
+		       copy[h].worst_us);
+		for (uint8_t bin = 0; bin < FAULT_TRACE_BINS; bin++) {
+			if (!copy[h].bins[bin]) {
+				continue;
+			}
+			if (bin == FAULT_TRACE_BINS - 1) {
+				printf("\tfrom %lu us: %u\n",
+				       1UL << (FAULT_TRACE_MIN_SHIFT + bin - 1),
+				       copy[h].bins[bin]);
+			} else {
+				printf("\tunder %lu us: %u\n",
+				       1UL << (FAULT_TRACE_MIN_SHIFT + bin),
+				       copy[h].bins[bin]);
+			}
+		}
+	}
+}
+
+void fault_trace_reset(void)
+{
+	mutex_get(&fault_trace_mutex);
+	memset(hists, 0, sizeof(hists));
+	mutex_put(&fault_trace_mutex);
+}
+
+void fault_trace_request(const uint8_t *data)
+{
+	// one histogram a request, all of them at once would overrun the outgoing CAN queue
+	if (data[0] & 0x1 && data[1] < FAULT_HISTS) {
+		fault_trace_send(data[1]);
+	}
+	if (data[0] & 0x2) {
+		fault_trace_print();
+	}
+	if (data[0] & 0x4) {
+		fault_trace_reset();
+	}
+}
@@ -0,0 +1,102 @@
+/**
+ * @file impedance.c
+ * @brief Recursive least squares impedance estimation, with the gain shared across the pack.
+ */
+
+#include "impedance.h"
+
+#include <math.h>
+
+/* Forgetting factor, the estimate remembers about 1 / (1 - IMPEDANCE_FORGET) excited measurements */
+#define IMPEDANCE_FORGET 0.995f
+/* Smallest change in the regressors, in A, a measurement updates the estimates with */
+#define IMPEDANCE_MIN_AMPS 0.3f
+/* Covariance the estimator starts with, and is held under when the current stays flat for long */
+#define IMPEDANCE_P0	 1e-2f
+#define IMPEDANCE_P_MAX	 1.0f
+
+void impedance_init(impedance_rls_t *rls, float amps)
+{
+	rls->p[0][0] = IMPEDANCE_P0;
+	rls->p[0][1] = 0;
+	rls->p[1][0] = 0;
+	rls->p[1][1] = IMPEDANCE_P0;
+	rls->update = false;
+	rls->last_amps = amps;
+	rls->polar_amps = amps;
+}
+
+void impedance_cell_init(impedance_cell_t *cell, float volts, float ohms)
+{
+	cell->r0 = ohms;
+	cell->r1 = ohms;
+	cell->last_volts = volts;
+}
+
+bool impedance_step(impedance_rls_t *rls, float amps, float dt_s,
+		    bool trusted)
+{
+	// the RC pair charges towards R1 times the current of the last interval
+	float decay = expf(-dt_s / IMPEDANCE_TAU_S);
+	float polar_amps = decay * rls->polar_amps + (1 - decay) * rls->last_amps;
+
+	rls->phi[0] = -(amps - rls->last_amps);
+	rls->phi[1] = -(polar_amps - rls->polar_amps);
+	rls->last_amps = amps;
+	rls->polar_amps = polar_amps;
+
+	// without a change in current there is nothing to learn, and forgetting would only wind up p
+	rls->update = trusted && rls->phi[0] * rls->phi[0] +
+						 rls->phi[1] * rls->phi[1] >=
+					 IMPEDANCE_MIN_AMPS * IMPEDANCE_MIN_AMPS;
+	if (!rls->update) {
+		return false;
+	}
+
+	float p_phi[2] = {
+		rls->p[0][0] * rls->phi[0] + rls->p[0][1] * rls->phi[1],
+		rls->p[1][0] * rls->phi[0] + rls->p[1][1] * rls->phi[1],
+	};
+	float denom = IMPEDANCE_FORGET + rls->phi[0] * p_phi[0] +
+		      rls->phi[1] * p_phi[1];
+
+	rls->gain[0] = p_phi[0] / denom;
+	rls->gain[1] = p_phi[1] / denom;
+
+	// p is symmetric, so phi' p is p_phi'
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 2; j++) {
+			rls->p[i][j] = (rls->p[i][j] - rls->gain[i] * p_phi[j]) /
+				       IMPEDANCE_FORGET;
+		}
+	}
+
+	if (rls->p[0][0] + rls->p[1][1] > IMPEDANCE_P_MAX) {
+		float scale = IMPEDANCE_P_MAX / (rls->p[0][0] + rls->p[1][1]);
+		for (int i = 0; i < 2; i++) {
+			for (int j = 0; j < 2; j++) {
+				rls->p[i][j] *= scale;
+			}
+		}
+	}
+
+	return true;
+}
+
+void impedance_cell_update(const impedance_rls_t *rls, impedance_cell_t *cell,
+			   float volts)
+{
+	if (rls->update) {
+		float error = (volts - cell->last_volts) -
+			      (rls->phi[0] * cell->r0 + rls->phi[1] * cell->r1);
+		cell->r0 += rls->gain[0] * error;
+		cell->r1 += rls->gain[1] * error;
+	}
+	cell->last_volts = volts;
+}
+
+float impedance_ocv(const impedance_rls_t *rls, const impedance_cell_t *cell,
+		    float volts)
+{
+	return volts + rls->last_amps * cell->r0 + rls->polar_amps * cell->r1;
+}
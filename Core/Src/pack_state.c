@@ -0,0 +1,111 @@
+/**
+ * @file pack_state.c
+ * @brief Double buffered pack state, published with a sequence counter.
+ */
+
+#include "pack_state.h"
+
+#include <string.h>
+
+#include "main.h"
+
+#ifdef DEBUG_STATS
+#include <stdio.h>
+#include "adi6830_interation.h"
+#endif
+
+static bms_t buffers[2];
+
+/*
+ * Number of publishes so far, buffer (published & 1) holds the latest.  A publish fills the other buffer and
+ * only then bumps the count, so the buffer a reader copies is only written to once the count has moved on.
+ */
+static volatile uint32_t published = 0;
+
+#ifdef DEBUG_STATS
+static struct {
+	uint32_t hold_max_us;
+	uint32_t hold_last_us;
+	uint32_t read_max_us;
+	uint32_t read_last_us;
+	uint32_t reads;
+	uint32_t retries;
+} stats;
+#endif
+
+void pack_state_publish(const bms_t *bmsdata)
+{
+	uint32_t next = published + 1;
+
+	memcpy(&buffers[next & 1], bmsdata, sizeof(bms_t));
+	// the copy must land before readers are pointed at it
+	__DMB();
+	published = next;
+}
+
+uint32_t pack_state_read(bms_t *bmsdata)
+{
+#ifdef DEBUG_STATS
+	uint32_t start = adbms_get_us();
+#endif
+	uint32_t seq;
+
+	for (;;) {
+		seq = published;
+		if (seq == 0) {
+			return 0;
+		}
+		__DMB();
+		memcpy(bmsdata, &buffers[seq & 1], sizeof(bms_t));
+		__DMB();
+
+		// no publish since the copy started, so the buffer was never written to under it
+		if (published == seq) {
+			break;
+		}
+#ifdef DEBUG_STATS
+		stats.retries++;
+#endif
+	}
+
+#ifdef DEBUG_STATS
+	stats.read_last_us = adbms_get_us() - start;
+	if (stats.read_last_us > stats.read_max_us) {
+		stats.read_max_us = stats.read_last_us;
+	}
+	stats.reads++;
+#endif
+	return seq;
+}
+
+void pack_state_commit_sm(bms_t *bmsdata, const bms_t *sm)
+{
+	bmsdata->current_state = sm->current_state;
+	bmsdata->fault_code_crit = sm->fault_code_crit;
+	bmsdata->fault_code_noncrit = sm->fault_code_noncrit;
+	bmsdata->is_charger_connected = sm->is_charger_connected;
+	bmsdata->is_charging_enabled = sm->is_charging_enabled;
+	bmsdata->should_balance = sm->should_balance;
+	memcpy(bmsdata->discharge_config, sm->discharge_config,
+	       sizeof(bmsdata->discharge_config));
+}
+
+#ifdef DEBUG_STATS
+
+void pack_state_log_hold(uint32_t start_us)
+{
+	stats.hold_last_us = adbms_get_us() - start_us;
+	if (stats.hold_last_us > stats.hold_max_us) {
+		stats.hold_max_us = stats.hold_last_us;
+	}
+}
+
+void pack_state_print_stats(void)
+{
+	printf("BMS mutex held %lu us (max %lu), snapshot read %lu us (max %lu), %lu retries in %lu reads\n",
+	       stats.hold_last_us, stats.hold_max_us, stats.read_last_us,
+	       stats.read_max_us, stats.retries, stats.reads);
+	memset(&stats, 0, sizeof(stats));
+}
+
+#endif
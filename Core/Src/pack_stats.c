@@ -0,0 +1,119 @@
+/**
+ * @file pack_stats.c
+ * @brief Block statistics kernels, on CMSIS-DSP or in portable C.
+ */
+
+#include "pack_stats.h"
+
+#if defined(__ARM_ARCH) && !defined(PACK_STATS_PORTABLE)
+#define PACK_STATS_CMSIS
+#include "arm_math.h"
+#endif
+
+void stats_float(const float *data, uint16_t len, float_stats_t *stats)
+{
+#ifdef PACK_STATS_CMSIS
+	uint32_t at;
+	float mean;
+
+	arm_max_f32(data, len, &stats->max, &at);
+	stats->max_at = at;
+	arm_min_f32(data, len, &stats->min, &at);
+	stats->min_at = at;
+	// there is no plain sum, the mean is the sum divided by len
+	arm_mean_f32(data, len, &mean);
+	stats->sum = mean * len;
+#else
+	stats->max = data[0];
+	stats->min = data[0];
+	stats->sum = data[0];
+	stats->max_at = 0;
+	stats->min_at = 0;
+
+	for (uint16_t i = 1; i < len; i++) {
+		if (data[i] > stats->max) {
+			stats->max = data[i];
+			stats->max_at = i;
+		}
+		if (data[i] < stats->min) {
+			stats->min = data[i];
+			stats->min_at = i;
+		}
+		stats->sum += data[i];
+	}
+#endif
+}
+
+#ifdef ANALYZER_FIXED_POINT
+
+/**
+ * @brief Sum a block of int16s exactly.
+ *
+ * @param data Block to sum.
+ * @param len Number of values.
+ * @return int32_t The sum.
+ */
+static int32_t sum_q15(const int16_t *data, uint16_t len)
+{
+	int32_t sum = 0;
+	uint16_t i = 0;
+
+#if defined(PACK_STATS_CMSIS) && defined(ARM_MATH_DSP)
+	// SMLAD against 1 in both halves adds two cells per instruction
+	for (; i + 1 < len; i += 2) {
+		sum = __SMLAD(read_q15x2(&data[i]), 0x00010001, sum);
+	}
+#endif
+	for (; i < len; i++) {
+		sum += data[i];
+	}
+
+	return sum;
+}
+
+void stats_cell_volt(const cell_volt_t *data, uint16_t len,
+		     cell_volt_stats_t *stats)
+{
+#ifdef PACK_STATS_CMSIS
+	uint32_t at;
+
+	arm_max_q15(data, len, &stats->max, &at);
+	stats->max_at = at;
+	arm_min_q15(data, len, &stats->min, &at);
+	stats->min_at = at;
+#else
+	stats->max = data[0];
+	stats->min = data[0];
+	stats->max_at = 0;
+	stats->min_at = 0;
+
+	for (uint16_t i = 1; i < len; i++) {
+		if (data[i] > stats->max) {
+			stats->max = data[i];
+			stats->max_at = i;
+		}
+		if (data[i] < stats->min) {
+			stats->min = data[i];
+			stats->min_at = i;
+		}
+	}
+#endif
+	stats->sum = sum_q15(data, len);
+}
+
+#else
+
+void stats_cell_volt(const cell_volt_t *data, uint16_t len,
+		     cell_volt_stats_t *stats)
+{
+	float_stats_t f;
+
+	stats_float(data, len, &f);
+	stats->max = f.max;
+	stats->min = f.min;
+	stats->sum = f.sum;
+	stats->max_at = f.max_at;
+	stats->min_at = f.min_at;
+}
+
+#endif
@@ -3,6 +3,138 @@
 #include "c_utils.h"
 #include "serialPrintResult.h"
 #include "adi6830_interation.h"
+#include "fault_trace.h"
+
+/* Time spent by one full wake sequence, 500us low + 500us high per chip */
+#define WAKE_SEQUENCE_US (1000 * NUM_CHIPS)
+
+static segment_scan_stats_t scan_stats = { 0 };
+static uint32_t last_scan_start_us = 0;
+
+/* overlap conversions with register readout, see segment_set_pipelined() */
+static bool pipelined = true;
+
+/* freeze the cell registers around cell reads, see segment_set_snapshots() */
+static bool snapshots = true;
+static float (*current_sampler)(void) = NULL;
+static segment_snapshot_t snapshot = { 0 };
+
+/* the C-ADC is converting continuously, rather than single shot for charging */
+static bool c_adc_continuous = false;
+
+/**
+ * @brief Start timing an acquisition cycle.
+ * 
+ * @return uint32_t The start timestamp, pass to scan_end().
+ */
+static uint32_t scan_begin(void)
+{
+	uint32_t start_us = adbms_get_us();
+
+	adbms_reset_link_stats();
+	scan_stats.last_period_us = start_us - last_scan_start_us;
+	last_scan_start_us = start_us;
+
+	return start_us;
+}
+
+/**
+ * @brief Finish timing an acquisition cycle and record the stats.
+ * 
+ * @param start_us Timestamp returned by scan_begin().
+ * @param print Print the stats, with DEBUG_SCAN_STATS.
+ */
+static void scan_end(uint32_t start_us, bool print)
+{
+	scan_stats.last_cycle_us = adbms_get_us() - start_us;
+	if (scan_stats.last_cycle_us > scan_stats.max_cycle_us) {
+		scan_stats.max_cycle_us = scan_stats.last_cycle_us;
+	}
+
+	adbms_get_link_stats(&scan_stats.link);
+	scan_stats.last_cycle_always_wake_us =
+		scan_stats.last_cycle_us +
+		scan_stats.link.wakes_skipped * WAKE_SEQUENCE_US;
+
+#ifdef DEBUG_SCAN_STATS
+	if (!print) {
+		return;
+	}
+	printf("Scan: %lu us (%lu us always waking), wakes %lu, skipped %lu\n",
+	       scan_stats.last_cycle_us, scan_stats.last_cycle_always_wake_us,
+	       scan_stats.link.wakes_sent, scan_stats.link.wakes_skipped);
+	printf("Scan: period %lu us, %s\n", scan_stats.last_period_us,
+	       pipelined ? "pipelined" : "sequential");
+	printf("Scan: %lu transactions, %lu bytes, %lu PEC fallbacks, %lu PEC retries\n",
+	       scan_stats.link.transactions, scan_stats.link.bytes,
+	       scan_stats.link.pec_fallbacks, scan_stats.link.pec_retries);
+
+	static const char *const adc_names[ADBMS_ADC_MODES] = { "C", "S", "AUX",
+								"AUX2" };
+	for (uint8_t mode = 0; mode < ADBMS_ADC_MODES; mode++) {
+		adbms_adc_stats_t adc;
+		adbms_get_adc_stats(mode, &adc);
+		if (adc.conversions == 0) {
+			continue;
+		}
+		printf("ADC %s: last %lu us, min %lu us, max %lu us, mean %lu us, late %lu/%lu\n",
+		       adc_names[mode], adc.last_us, adc.min_us, adc.max_us,
+		       (uint32_t)(adc.total_us / adc.conversions), adc.late,
+		       adc.conversions);
+	}
+#endif
+}
+
+void segment_get_scan_stats(segment_scan_stats_t *stats)
+{
+	*stats = scan_stats;
+}
+
+void segment_set_pipelined(bool enabled)
+{
+	pipelined = enabled;
+}
+
+void segment_set_snapshots(bool enabled)
+{
+	snapshots = enabled;
+}
+
+void segment_set_current_sampler(float (*sample)(void))
+{
+	current_sampler = sample;
+}
+
+void segment_get_snapshot(segment_snapshot_t *snap)
+{
+	*snap = snapshot;
+}
+
+/**
+ * @brief Timestamp the cell voltages, and sample the pack current at the same instant.
+ * 
+ * @param coherent true if every cell register group holds the same conversion.
+ */
+static void snapshot_take(bool coherent)
+{
+	snapshot.timestamp_us = adbms_get_us();
+	snapshot.has_current = current_sampler != NULL;
+	snapshot.pack_current = current_sampler ? current_sampler() : 0;
+	snapshot.coherent = coherent;
+	snapshot.seq++;
+}
+
+/**
+ * @brief Make sure a conversion is in flight, starting one if the previous scan did not.
+ * 
+ * @param mode ADC to have converting.
+ */
+static void pipeline_prime(adbms_adc_mode_t mode, SPI_HandleTypeDef *hspi)
+{
+	if (!adbms_adc_pending(mode)) {
+		adbms_adc_start(mode, hspi);
+	}
+}
 
 /**
  * @brief Get the num cells using the order of the chip, for functions without chipdata access.
@@ -65,8 +197,9 @@ void init_chip(cell_asic *chip)
 	// Init config B
 
 	// If the corresponding fault bits are sent high, it does not affect the IC
-	chip->tx_cfgb.vov = SetOverVoltageThreshold(4.2);
-	chip->tx_cfgb.vuv = SetUnderVoltageThreshold(2.5);
+	// outside the cell voltage limits, the OV/UV fast path reads back what these trip
+	chip->tx_cfgb.vov = SetOverVoltageThreshold(HW_OV_VOLT);
+	chip->tx_cfgb.vuv = SetUnderVoltageThreshold(HW_UV_VOLT);
 
 	// Discharge timer monitor off
 	set_discharge_timer_monitor(chip, DTMEN_OFF);
@@ -94,6 +227,7 @@ void segment_init(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 	mute_chips(chips, hspi);
 
 	start_c_adc_conv(hspi);
+	c_adc_continuous = true;
 }
 
 void segment_mute(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
@@ -197,61 +331,324 @@ void segment_monitor_flts(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 	write_clear_flags(chips, hspi);
 }
 
-// ensure stuff used is in the correctfunction
-void segment_retrieve_active_data(cell_asic chips[NUM_CHIPS],
-				  SPI_HandleTypeDef *hspi)
+/* set by the entry point of the scan, charging reads single shot cell conversions */
+static bool charging = false;
 
+static void measure_cells(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
-	// read all therms using AUX 2
-	adc_and_read_aux2_registers(chips, hspi);
+	uint32_t conversion_us = adbms_get_us();
+
+	if (charging) {
+		// in charging state, the analyzer uses single shot c codes ONLY
+		// the comparators flag every conversion, clear them so they hold this one until the next
+		clear_ovuv_flags(chips, hspi);
+		adbms_adc_start(ADBMS_ADC_C, hspi);
+		c_adc_continuous = false;
+		// the registers will hold this conversion until the next one is started, sample the current with it
+		snapshot_take(true);
+
+		// Read configuration registers to monitor burning status and the like, while the cells convert
+		read_config_register_a(chips, hspi);
+		read_config_register_b(chips, hspi);
+
+		adbms_adc_wait(ADBMS_ADC_C, hspi);
+		read_c_voltage_registers(chips, hspi);
+		fault_trace_sample(conversion_us, snapshot.timestamp_us);
+		return;
+	}
 
-	// read from ADC convs
+	// back from charging, the filtered registers need the continuous conversion again
+	if (!c_adc_continuous) {
+		start_c_adc_conv(hspi);
+		c_adc_continuous = true;
+	}
+
+	// the C-ADC converts continuously, without a snapshot groups can update mid readout
+	if (!snapshots) {
+		snapshot_take(false);
+		read_filtered_voltage_registers(chips, hspi);
+		fault_trace_sample(conversion_us, snapshot.timestamp_us);
+		return;
+	}
+
+	segment_snap(chips, hspi);
+	snapshot_take(true);
 	read_filtered_voltage_registers(chips, hspi);
+	segment_unsnap(chips, hspi);
+	fault_trace_sample(conversion_us, snapshot.timestamp_us);
 }
 
-// ensure stuff used is in the correctfunction
-void segment_retrieve_charging_data(cell_asic chips[NUM_CHIPS],
-				    SPI_HandleTypeDef *hspi)
+/**
+ * @brief Read back which cells the chips' comparators found past the OV and UV thresholds.  One register group,
+ * so a gross over or under voltage is seen between full cell readouts.
+ * 
+ * The flags are only cleared once a new conversion will set them again.  Converting continuously that is right
+ * after each read, a single shot conversion clears them as it is started, so the reads between two charging
+ * conversions keep seeing the last one.
+ */
+static void measure_ovuv(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
+{
+	read_status_register_d(chips, hspi);
+	if (c_adc_continuous) {
+		clear_ovuv_flags(chips, hspi);
+	}
+}
 
+static void measure_therms(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
-	// read all therms using AUX 2
-	adc_and_read_aux2_registers(chips, hspi);
+	if (!pipelined) {
+		adc_and_read_aux2_registers(chips, hspi);
+		return;
+	}
 
-	// poll stuff like vref, etc.
-	adc_and_read_aux_registers(chips, hspi);
+	// AUX2 was started by the previous measurement, only the first one waits out a whole conversion
+	pipeline_prime(ADBMS_ADC_AUX2, hspi);
+	adbms_adc_wait(ADBMS_ADC_AUX2, hspi);
+	read_raux_registers(chips, hspi);
 
-	// read from ADC convs
-	get_c_adc_voltages(chips, hspi);
+	// convert the therms for the next measurement
+	adbms_adc_start(ADBMS_ADC_AUX2, hspi);
+}
 
-	read_status_registers(chips, hspi);
+static void measure_status(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
+{
+	// poll stuff like vref, etc.
+	adbms_adc_start(ADBMS_ADC_AUX, hspi);
+
+	// Read configuration registers to monitor burning status and the like, while AUX converts.  Charging reads
+	// them behind every cell conversion instead
+	if (!charging) {
+		read_config_register_a(chips, hspi);
+		read_config_register_b(chips, hspi);
+	}
 
-	// Read configuration registers to monitor burning status and the like
-	read_config_register_a(chips, hspi);
-	read_config_register_b(chips, hspi);
+	adbms_adc_wait(ADBMS_ADC_AUX, hspi);
+	read_status_aux_registers(chips, hspi);
 
-	//segment_adc_comparison(bmsdata);
 	// check our fault flags
 	segment_monitor_flts(chips, hspi);
 }
 
-void segment_retrieve_debug_data(cell_asic chips[NUM_CHIPS],
-				 SPI_HandleTypeDef *hspi)
+static void measure_s_adc(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
 {
-	// poll stuff like vref, etc.
-	adc_and_read_aux_registers(chips, hspi);
+	// the continuous C-ADC conversion runs with redundancy, the S-ADC registers are always fresh
+	read_s_voltage_registers(chips, hspi);
 
-	// read the above into status registers
-	read_status_registers(chips, hspi);
+	//segment_adc_comparison(bmsdata);
+}
 
-	// Read configuration registers to monitor burning status and the like
-	read_config_register_a(chips, hspi);
-	read_config_register_b(chips, hspi);
+static uint16_t open_wires[NUM_CHIPS] = { 0 };
 
-	//segment_adc_comparison(bmsdata);
-	// check our fault flags
-	segment_monitor_flts(chips, hspi);
+/**
+ * @brief Flag cells whose S-ADC reading with the open wire current on strays from the C-ADC.
+ * 
+ */
+static void check_open_wires(cell_asic chips[NUM_CHIPS])
+{
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		// compare against the C-ADC registers the cell measurement read, charging leaves the filtered ones stale
+		const int16_t *c_codes = charging ? chips[chip].cell.c_codes :
+						    chips[chip].fcell.fc_codes;
+		uint8_t cells = get_num_cells_seg(chip);
+		for (uint8_t cell = 0; cell < cells; cell++) {
+			float delta =
+				getVoltage(chips[chip].scell.sc_codes[cell]) -
+				getVoltage(c_codes[cell]);
+			if (delta > OPEN_WIRE_DELTA_V ||
+			    delta < -OPEN_WIRE_DELTA_V) {
+				open_wires[chip] |= 1 << cell;
+			}
+		}
+	}
+}
 
-	read_s_voltage_registers(chips, hspi);
+static void measure_open_wire(cell_asic chips[NUM_CHIPS],
+			      SPI_HandleTypeDef *hspi)
+{
+	memset(open_wires, 0, sizeof(open_wires));
+
+	get_s_adc_open_wire_voltages(chips, OW_ON_EVEN_CH, hspi);
+	check_open_wires(chips);
+	get_s_adc_open_wire_voltages(chips, OW_ON_ODD_CH, hspi);
+	check_open_wires(chips);
+
+	// the S-ADC conversions above stopped the continuous conversion, charging converts single shot anyway
+	if (c_adc_continuous) {
+		start_c_adc_conv(hspi);
+	}
+}
+
+static void measure_serial_id(cell_asic chips[NUM_CHIPS],
+			      SPI_HandleTypeDef *hspi)
+{
+	read_serial_id(chips, hspi);
+}
+
+/**
+ * @brief A quantity measured by the sequencer, and how often.
+ */
+typedef struct {
+	const char *name;
+	uint32_t period_ms;
+	void (*measure)(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi);
+	/* register whose PEC decides if a chip's measurement is fresh */
+	adbms_reg_t reg;
+} seq_entry_t;
+
+/* The OV/UV flags and cell voltages come first in every scan, they matter most for fault latency */
+static const seq_entry_t sequence[SEQ_QUANTITIES] = {
+	[SEQ_OVUV] = { "ov/uv", OVUV_PERIOD_MS, measure_ovuv, ADBMS_REG_STAT },
+	[SEQ_CELLS] = { "cells", CELL_PERIOD_MS, measure_cells,
+			ADBMS_REG_FCELL },
+	[SEQ_THERMS] = { "therms", THERM_PERIOD_MS, measure_therms,
+			 ADBMS_REG_RAUX },
+	[SEQ_STATUS] = { "status", STATUS_PERIOD_MS, measure_status,
+			 ADBMS_REG_STAT },
+	[SEQ_S_ADC] = { "s-adc", S_ADC_PERIOD_MS, measure_s_adc,
+			ADBMS_REG_SCELL },
+	[SEQ_OPEN_WIRE] = { "open wire", OPEN_WIRE_PERIOD_MS,
+			    measure_open_wire, ADBMS_REG_SCELL },
+	[SEQ_SERIAL_ID] = { "serial id", SERIAL_ID_PERIOD_MS,
+			    measure_serial_id, ADBMS_REG_SID },
+};
+
+static struct {
+	/* HAL tick of the first and last measurement */
+	uint32_t first_ms;
+	uint32_t last_ms;
+	uint32_t last_interval_ms;
+	uint32_t last_duration_us;
+	uint32_t runs;
+} seq_state[SEQ_QUANTITIES] = { 0 };
+
+/* chips whose measurement of each quantity is fresh and not yet taken by the analyzer */
+static uint32_t dirty_chips[SEQ_QUANTITIES] = { 0 };
+
+/**
+ * @brief Get the chips whose registers of a quantity passed PEC on its last measurement.
+ * 
+ * @param quantity The quantity just measured.
+ * @return uint32_t Bit per chip.
+ */
+static uint32_t fresh_chips(segment_quantity_t quantity)
+{
+	// charging reads the single shot conversions into the plain cell registers
+	adbms_reg_t reg = quantity == SEQ_CELLS && charging ?
+				  ADBMS_REG_CELL :
+				  sequence[quantity].reg;
+	uint32_t chips = 0;
+
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		if (!(adbms_get_stale_regs(chip) & (1 << reg))) {
+			chips |= 1UL << chip;
+		}
+	}
+
+	return chips;
+}
+
+/**
+ * @brief Measure every quantity that is due, in table order.
+ * 
+ * @param force Measure every quantity, due or not.
+ */
+static void sequencer_scan(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi,
+			   bool force)
+{
+	uint32_t start = scan_begin();
+	// a scan of the OV/UV flags alone runs every OVUV_PERIOD_MS, too often to print
+	bool print = false;
+
+	for (uint8_t q = 0; q < SEQ_QUANTITIES; q++) {
+		uint32_t now_ms = HAL_GetTick();
+
+		if (!force && seq_state[q].runs > 0 &&
+		    now_ms - seq_state[q].last_ms < sequence[q].period_ms) {
+			continue;
+		}
+
+		uint32_t measure_start = adbms_get_us();
+		sequence[q].measure(chips, hspi);
+		seq_state[q].last_duration_us = adbms_get_us() - measure_start;
+		// the analyzer takes these from its own thread
+		__atomic_fetch_or(&dirty_chips[q], fresh_chips(q),
+				  __ATOMIC_RELEASE);
+
+		if (seq_state[q].runs == 0) {
+			seq_state[q].first_ms = now_ms;
+		} else {
+			seq_state[q].last_interval_ms =
+				now_ms - seq_state[q].last_ms;
+		}
+		seq_state[q].last_ms = now_ms;
+		seq_state[q].runs++;
+		print |= q != SEQ_OVUV;
+
+#ifdef DEBUG_SCAN_STATS
+		// the OV/UV flags are read too often to print every time
+		if (q == SEQ_OVUV) {
+			continue;
+		}
+		segment_seq_stats_t stats;
+		segment_get_seq_stats(q, &stats);
+		printf("Seq %s: %lu us, %lu/%lu mHz\n", stats.name,
+		       stats.last_duration_us, stats.achieved_mhz,
+		       stats.requested_mhz);
+#endif
+	}
+
+	scan_end(start, print);
+}
+
+void segment_get_seq_stats(segment_quantity_t quantity,
+			   segment_seq_stats_t *stats)
+{
+	stats->name = sequence[quantity].name;
+	stats->requested_mhz = 1000000 / sequence[quantity].period_ms;
+	stats->last_interval_ms = seq_state[quantity].last_interval_ms;
+	stats->last_duration_us = seq_state[quantity].last_duration_us;
+	stats->runs = seq_state[quantity].runs;
+
+	// mean rate since the first measurement
+	uint32_t span_ms =
+		seq_state[quantity].last_ms - seq_state[quantity].first_ms;
+	stats->achieved_mhz =
+		span_ms ? (uint32_t)((uint64_t)(seq_state[quantity].runs - 1) *
+				     1000000 / span_ms) :
+			  0;
+}
+
+uint32_t segment_take_dirty(segment_quantity_t quantity)
+{
+	// in one exchange, so chips marked by the scan between a read and a clear are not lost
+	return __atomic_exchange_n(&dirty_chips[quantity], 0, __ATOMIC_ACQUIRE);
+}
+
+uint16_t segment_get_open_wires(uint8_t chip)
+{
+	return open_wires[chip];
+}
+
+// ensure stuff used is in the correctfunction
+void segment_retrieve_active_data(cell_asic chips[NUM_CHIPS],
+				  SPI_HandleTypeDef *hspi)
+{
+	charging = false;
+	sequencer_scan(chips, hspi, false);
+}
+
+// ensure stuff used is in the correctfunction
+void segment_retrieve_charging_data(cell_asic chips[NUM_CHIPS],
+				    SPI_HandleTypeDef *hspi)
+{
+	charging = true;
+	sequencer_scan(chips, hspi, false);
+}
+
+void segment_retrieve_debug_data(cell_asic chips[NUM_CHIPS],
+				 SPI_HandleTypeDef *hspi)
+{
+	sequencer_scan(chips, hspi, true);
 }
 
 void segment_restart(cell_asic chips[NUM_CHIPS], SPI_HandleTypeDef *hspi)
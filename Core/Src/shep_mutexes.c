@@ -13,11 +13,18 @@ mutex_t bms_mutex = {
     .priority_inherit = TX_INHERIT 
 };
 
+/* Fault Trace Mutex */
+mutex_t fault_trace_mutex = {
+    .name = "Fault Trace Mutex",
+    .priority_inherit = TX_INHERIT
+};
+
 /* Initializes all ThreadX mutexes. */
 uint8_t mutexes_init() {
     /* Create Mutexes. */
     CATCH_ERROR(create_mutex(&logger_mutex), U_SUCCESS); // Create Logger Mutex.
     CATCH_ERROR(create_mutex(&bms_mutex), U_SUCCESS); // Create BMS Mutex.
+    CATCH_ERROR(create_mutex(&fault_trace_mutex), U_SUCCESS); // Create Fault Trace Mutex.
 
     DEBUG_PRINTLN("Ran mutexes_init().");
     return U_SUCCESS;
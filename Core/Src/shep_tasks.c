@@ -5,17 +5,24 @@
 #include "u_tx_can.h"
 #include "shep_queues.h"
 #include "can_messages.h"
+#include "adi6830_interation.h"
+#include "segment.h"
+#include "pack_state.h"
+#include "fault_trace.h"
 <<<<<<< HEAD
 #include "shep_mutexes.h"
 #include "shep_tasks.h"
+#include "state_machine.h"
 #include "timer.h"
 
 // TODO: Fill in threads
 
 TX_EVENT_FLAGS_GROUP analyzer_event;
+TX_EVENT_FLAGS_GROUP state_machine_event;
 
 uint8_t shep_flags_init() {
     tx_event_flags_create(&analyzer_event, "Analyzer Event");
+    tx_event_flags_create(&state_machine_event, "State Machine Event");
 }
 
 extern bms_t bms;
@@ -28,7 +35,7 @@ extern bms_t bms;
 static thread_t _state_machine_thread = {
         .name       = "State Machine Thread", /* Name */
         .size       = 2048,             /* Stack Size (in bytes) */
-        .priority   = 4,               /* Priority */
+        .priority   = 3,               /* Priority, above the analyzer so a published pass is decided on at once */
         .threshold  = 0,               /* Preemption Threshold */
         .time_slice = TX_NO_TIME_SLICE, /* Time Slice */
         .auto_start = TX_AUTO_START,    /* Auto Start */
@@ -44,21 +51,67 @@ void vStateMachine(ULONG thread_input) {
 	// sends unimportant telemetry messages every 500ms
 	start_timer(&telem_timer, 500);
 
+	// the state machine runs on a published copy, too big for the stack
+	static bms_t sm_bms;
+
 	for (;;) {
-		sm_handle_state(bms);
+		// wake on each published analysis pass, the watchdog only fires if the analyzer stalls
+		ULONG received_flags;
+		bool fresh = tx_event_flags_get(&state_machine_event,
+						STATE_MACHINE_FLAG, TX_OR_CLEAR,
+						&received_flags,
+						SM_WATCHDOG_MS *
+							TX_TIMER_TICKS_PER_SECOND /
+							1000) == TX_SUCCESS;
+		if (!fresh) {
+			printf("No analysis in %d ms, running on the last one\n",
+			       SM_WATCHDOG_MS);
+		}
+#ifdef DEBUG_STATS
+		uint32_t wake_us = adbms_get_us();
+#endif
+
+		if (pack_state_read(&sm_bms)) {
+			sm_handle_state(&sm_bms);
+#ifdef DEBUG_STATS
+			sm_log_latency(&sm_bms, wake_us, fresh);
+#endif
+
+			// hand what the state machine decided back to the working state, and to readers
+			mutex_get(&bms_mutex);
+#ifdef DEBUG_STATS
+			uint32_t hold_start = adbms_get_us();
+#endif
+			pack_state_commit_sm(&bms, &sm_bms);
+			pack_state_publish(&bms);
+#ifdef DEBUG_STATS
+			pack_state_log_hold(hold_start);
+#endif
+			mutex_put(&bms_mutex);
+		}
 
 		if (is_timer_expired(&telem_timer)) {
 			// these are unimportant telemetry messages so they can be sent infrequently
 			send_bms_status_message(
-				bms.avg_temp, bms.internal_temp,
-				bms.current_state,
-				segment_is_balancing(bms.chips));
-			send_fault_status_message(bms.fault_code_crit,
-						  bms.fault_code_noncrit);
+				sm_bms.avg_temp, sm_bms.internal_temp,
+				sm_bms.current_state,
+				segment_is_balancing(sm_bms.chips));
+			send_fault_status_message(sm_bms.fault_code_crit,
+						  sm_bms.fault_code_noncrit);
+#ifdef DEBUG_STATS
+			pack_state_print_stats();
+			sm_print_latency();
+#endif
+
+			adbms_link_quality_t link;
+			adbms_get_link_quality(&link);
+			send_link_quality_message(link.stale_chips,
+						  link.pack_error_rate,
+						  link.worst_chip,
+						  link.worst_error_rate,
+						  link.retries);
 			start_timer(&telem_timer, 500);
 		}
-
-		osDelay(100);
 	}
 }
 
@@ -87,6 +140,9 @@ void vCanReceive(ULONG thred_input)
 			case DTI_CURRENT_CANID:
                 // TODO process charger can message
 				break;
+			case FAULT_TRACE_REQ_CANID:
+				fault_trace_request(message.data);
+				break;
 			default:
 				break;
 			}
@@ -125,6 +181,8 @@ void vCanDispatch(ULONG thread_input) {
             if(status != U_SUCCESS) {
                 DEBUG_PRINTLN("WARNING: Failed to send message (on can1) after removing from outgoing queue (Message ID: %ld).", message.id);
                 // u_TODO - maybe add the message back into the queue if it fails to send? not sure if this is a good idea tho
+            } else {
+                fault_trace_can_tx(message.id, message.data);
             }
         }	
         
@@ -151,38 +209,92 @@ void vAnalyzer(ULONG thread_input)
 		bms.chip_data[i].alpha = i % 2 == 0;
 	}
 
+#ifdef DEBUG_STATS
+	printf("bms_t is %u bytes, %u of them per cell values\n",
+	       (unsigned)sizeof(bms_t),
+	       (unsigned)(sizeof(bms.cell_temp) + sizeof(bms.cell_resistance) +
+			  sizeof(bms.open_cell_voltage) +
+			  sizeof(bms.cell_voltages)));
+#endif
+
+	// what the telemetry is sent from, too big for the stack
+	static bms_t telem_bms;
+
 	for (;;) {
 
         ULONG recevied_flags;
         tx_event_flags_get(&analyzer_event, ANALYZER_FLAG, TX_OR_CLEAR, &recevied_flags, TX_WAIT_FOREVER);
 
         mutex_get(&bms_mutex);
+#ifdef DEBUG_STATS
+		uint32_t hold_start = adbms_get_us();
+#endif
+
+		// only recompute the cells, and the aggregates over them, that were measured since the last pass
+		uint32_t therm_chips = segment_take_dirty(SEQ_THERMS);
+		uint32_t status_chips = segment_take_dirty(SEQ_STATUS);
+		uint32_t volt_chips = segment_take_dirty(SEQ_CELLS);
+		uint32_t flag_chips = segment_take_dirty(SEQ_OVUV);
 
 		// calculate base values for later safety calcs
-		calc_cell_temps(bms);
-		calc_pack_temps(bms);
-		calc_cell_voltages(bms);
-		calc_open_cell_voltage(bms);
-		calc_pack_voltage_stats(bms);
-		calc_cell_resistances(bms);
+		calc_snapshot(bms);
+		if (therm_chips | status_chips) {
+			calc_cell_temps(bms, therm_chips, status_chips);
+		}
+
+		uint32_t ocv_chips = 0;
+		if (volt_chips) {
+			calc_cell_voltages(bms, volt_chips);
+			calc_cell_resistances(bms, volt_chips);
+			ocv_chips = calc_open_cell_voltage(bms, volt_chips);
+		}
+
+		calc_cell_faults(bms, therm_chips | ocv_chips, flag_chips);
+
+		uint32_t stats_chips = therm_chips | volt_chips | ocv_chips;
+		if (stats_chips | status_chips) {
+			calc_pack_stats(bms, stats_chips);
+		}
+#ifdef DEBUG_ANALYZER_BENCH
+		analyzer_compare_voltage_paths(bms);
+		analyzer_compare_stats_paths(bms);
+		analyzer_compare_fault_paths(bms);
+		analyzer_compare_temp_paths(bms);
+#endif
+		if (volt_chips) {
+			calc_cell_soc(bms, volt_chips);
+		}
 
 		// these are dependent on above calculations
-		calc_cont_dcl(bms);
-		calc_cont_ccl(bms);
-		calc_state_of_charge(bms);
-
-		// send out telemetry data sourced from the above functions
-		send_acc_status_message(bms.pack_ocv,
-					bms.pack_current, bms.soc);
-		send_cell_voltage_message(bms.max_ocv, bms.min_ocv,
-					  bms.avg_ocv);
-		send_segment_average_volt_message(&bms);
-		send_segment_total_volt_message(&bms);
-		send_cell_temp_message(bms.max_temp, bms.min_temp,
-				       bms.avg_temp);
-		send_segment_temp_message(&bms);
+		if (stats_chips | status_chips) {
+			calc_state_of_power(bms);
+			calc_cont_dcl(bms);
+			calc_cont_ccl(bms);
+			calc_state_of_charge(bms);
+		}
 
+		pack_state_publish(&bms);
+		fault_trace_mark(FAULT_TRACE_PUBLISH, bms.snapshot_us);
+#ifdef DEBUG_STATS
+		pack_state_log_hold(hold_start);
+#endif
 		mutex_put(&bms_mutex);
+
+		// off the mutex, so the state machine can commit as soon as it has decided
+		tx_event_flags_set(&state_machine_event, STATE_MACHINE_FLAG,
+				   TX_OR);
+
+		// send out telemetry data sourced from the above functions, off the mutex
+		pack_state_read(&telem_bms);
+		send_acc_status_message(telem_bms.pack_ocv,
+					telem_bms.pack_current, telem_bms.soc);
+		send_cell_voltage_message(telem_bms.max_ocv, telem_bms.min_ocv,
+					  telem_bms.avg_ocv);
+		send_segment_average_volt_message(&telem_bms);
+		send_segment_total_volt_message(&telem_bms);
+		send_cell_temp_message(telem_bms.max_temp, telem_bms.min_temp,
+				       telem_bms.avg_temp);
+		send_segment_temp_message(&telem_bms);
 	}
 =======
 
@@ -208,25 +320,31 @@ void vGetSegmentData(ULONG thread_input)
 	// the number of ms each chip should be sent in (DONT CHANGE)
 	const uint16_t CHIP_TIME = ((1 / REFRESH_RATE) * 1000) / NUM_CHIPS;
 
+	// what the cell data is sent from, too big for the stack
+	static bms_t seg_bms;
+
 	for (;;) {
 		for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+			// each chip's messages come from one analysis pass
+			pack_state_read(&seg_bms);
 			uint8_t num_cells =
-				get_num_cells(&bms.chip_data[chip]);
+				get_num_cells(&seg_bms.chip_data[chip]);
 			// dont send the 11th cell of beta as it goes in a beta stat msg
-			if (!bms.chip_data[chip].alpha) {
+			if (!seg_bms.chip_data[chip].alpha) {
 				num_cells -= 1;
 			}
 			for (int cell = 0; cell < num_cells; cell += 2) {
 				send_cell_data_message(
-					bms.chip_data[chip].alpha,
+					seg_bms.chip_data[chip].alpha,
 
-					bms.chip_data[chip].cell_temp[cell],
+					seg_bms.cell_temp[chip][cell],
 
-					bms.chip_data[chip]
-						.cell_voltages[cell],
+					CELL_VOLT_TO_FLOAT(
+						seg_bms.cell_voltages[chip][cell]),
 
-					bms.chip_data[chip]
-						.cell_voltages[cell + 1],
+					CELL_VOLT_TO_FLOAT(
+						seg_bms.cell_voltages[chip]
+								 [cell + 1]),
 
 					chip,
 
@@ -234,15 +352,15 @@ void vGetSegmentData(ULONG thread_input)
 
 					cell + 1,
 
-					(bms.chips[chip].tx_cfgb.dcc >>
+					(seg_bms.chips[chip].tx_cfgb.dcc >>
 					 cell) & 1,
 
-					(bms.chips[chip].tx_cfgb.dcc >>
+					(seg_bms.chips[chip].tx_cfgb.dcc >>
 					 (cell + 1)) &
 						1,
-					(bms.chips[chip].statc.cs_flt >>
+					(seg_bms.chips[chip].statc.cs_flt >>
 					 cell) & 1,
-					(bms.chips[chip].statc.cs_flt >>
+					(seg_bms.chips[chip].statc.cs_flt >>
 					 (cell + 1)) &
 						1);
 				// wait for a fraction of the chip time alotted between each cell
@@ -253,71 +371,71 @@ void vGetSegmentData(ULONG thread_input)
 			}
 
 			// Send chip status messages
-			if (!bms.chip_data[chip].alpha) {
+			if (!seg_bms.chip_data[chip].alpha) {
 				send_beta_status_a_message(
-					bms.chip_data[chip].cell_temp[10],
-					bms.chip_data[chip]
-						.cell_voltages[10],
+					seg_bms.cell_temp[chip][10],
+					CELL_VOLT_TO_FLOAT(
+						seg_bms.cell_voltages[chip][10]),
 					NER_GET_BIT(
-						bms.chips[chip].tx_cfgb.dcc,
+						seg_bms.chips[chip].tx_cfgb.dcc,
 						10),
 					chip,
 
-					bms.chip_data[chip].on_board_temp,
+					seg_bms.chip_data[chip].on_board_temp,
 
-					(getVoltage(bms.chips[chip]
+					(getVoltage(seg_bms.chips[chip]
 							    .stata.itmp) /
 					 0.0075) -
 						273,
 					20.0 * getVoltage( // VPV is ra_code 11 w/ different scale
-						       bms.chips[chip]
+						       seg_bms.chips[chip]
 							       .aux
 							       .a_codes[11]));
 
 				send_beta_status_b_message(
-					getVoltage(bms.chips[chip]
+					getVoltage(seg_bms.chips[chip]
 							   .stata.vref2),
 					getVoltage(
-						bms.chips[chip].statb.va),
+						seg_bms.chips[chip].statb.va),
 					getVoltage(
-						bms.chips[chip].statb.vd),
+						seg_bms.chips[chip].statb.vd),
 					chip,
 					getVoltage(
-						bms.chips[chip].statb.vr4k),
+						seg_bms.chips[chip].statb.vr4k),
 					20.0 * getVoltage( // VMV is ra_code 10
-						       bms.chips[chip]
+						       seg_bms.chips[chip]
 							       .aux.a_codes[10]),
-					(bms.chips[chip].statc.cs_flt >>
+					(seg_bms.chips[chip].statc.cs_flt >>
 					 10) & 1);
 				send_beta_status_c_message(
-					chip, &bms.chips[chip].statc);
+					chip, &seg_bms.chips[chip].statc);
 			} else {
 				send_alpha_status_a_message(
-					bms.chip_data->on_board_temp, chip,
-					((getVoltage(bms.chips[chip]
+					seg_bms.chip_data->on_board_temp, chip,
+					((getVoltage(seg_bms.chips[chip]
 							     .stata.itmp) /
 					  0.0075) -
 					 273),
 					(20.0 *
 					 getVoltage( // VPV is ra_code 11 w/ different scale
-						 bms.chips[chip]
+						 seg_bms.chips[chip]
 							 .aux.a_codes[11])),
 					(20.0 *
 					 getVoltage( // VMV is ra_code 10
-						 bms.chips[chip]
+						 seg_bms.chips[chip]
 							 .aux.a_codes[10])),
-					&bms.chips[chip].statc);
+					&seg_bms.chips[chip].statc);
 				send_alpha_status_b_message(
 					getVoltage(
-						bms.chips[chip].statb.vr4k),
+						seg_bms.chips[chip].statb.vr4k),
 					chip,
-					getVoltage(bms.chips[chip]
+					getVoltage(seg_bms.chips[chip]
 							   .stata.vref2),
 					getVoltage(
-						bms.chips[chip].statb.va),
+						seg_bms.chips[chip].statb.va),
 					getVoltage(
-						bms.chips[chip].statb.vd),
-					&bms.chips[chip].statc);
+						seg_bms.chips[chip].statb.vd),
+					&seg_bms.chips[chip].statc);
 			}
 			// wait for the remaining time
 			osDelay(0.15 * CHIP_TIME);
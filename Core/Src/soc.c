@@ -0,0 +1,135 @@
+/**
+ * @file soc.c
+ * @brief Extended Kalman filter state of charge estimation.
+ */
+
+#include "soc.h"
+
+#include <math.h>
+#include <stddef.h>
+
+/* Variance the state of charge drifts by per second of coulomb counting, from current sensor offset */
+#define SOC_PROCESS_VAR_PER_S 1e-7f
+/* Variance of the state of charge a filter starts with, 10% */
+#define SOC_INIT_VAR 0.01f
+/* Error of the OCV curve itself, in V */
+#define SOC_CURVE_NOISE_V 0.010f
+/* Error of the ohmic drop per amp, from the impedance being a typical value, in ohms */
+#define SOC_OHMS_NOISE 0.01f
+/* Polarization left right after load is taken off, in V, decaying with SOC_RELAX_TAU_S */
+#define SOC_RELAX_NOISE_V 0.050f
+#define SOC_RELAX_TAU_S	  60.0f
+
+/*
+ * OCV of the P45B every 5% state of charge, 0 to 100%.  Taken from the inverse of the two exponential fit
+ * of the datasheet discharge curve that was used before the filter.
+ */
+#define SOC_OCV_NODES 21
+static const float OCV_CURVE[SOC_OCV_NODES] = {
+	2.6151, 2.8744, 3.0424, 3.1686, 3.2707, 3.3572, 3.4328,
+	3.5004, 3.5620, 3.6189, 3.6721, 3.7226, 3.7708, 3.8175,
+	3.8632, 3.9085, 3.9540, 4.0008, 4.0506, 4.1067, 4.1829
+};
+
+/* Running integral of OCV_CURVE from 0%, at each of its nodes */
+static const float OCV_ENERGY[SOC_OCV_NODES] = {
+	0.00000, 0.13724, 0.28516, 0.44043, 0.60142, 0.76711, 0.93686,
+	1.11019, 1.28675, 1.46628, 1.64855, 1.83342, 2.02075, 2.21046,
+	2.40248, 2.59677, 2.79333, 2.99220, 3.19349, 3.39742, 3.60466
+};
+
+/**
+ * @brief Clamp a state of charge to 0..1.
+ */
+static float clamp_soc(float soc)
+{
+	if (soc > 1) {
+		return 1;
+	}
+	if (soc < 0) {
+		return 0;
+	}
+	return soc;
+}
+
+float soc_ocv(float soc, float *slope)
+{
+	float pos = clamp_soc(soc) * (SOC_OCV_NODES - 1);
+	uint8_t i = (uint8_t)pos;
+
+	if (i >= SOC_OCV_NODES - 1) {
+		i = SOC_OCV_NODES - 2;
+	}
+
+	float step = OCV_CURVE[i + 1] - OCV_CURVE[i];
+	if (slope) {
+		*slope = step * (SOC_OCV_NODES - 1);
+	}
+	return OCV_CURVE[i] + step * (pos - i);
+}
+
+float soc_from_ocv(float ocv)
+{
+	if (ocv <= OCV_CURVE[0]) {
+		return 0;
+	}
+
+	for (uint8_t i = 1; i < SOC_OCV_NODES; i++) {
+		if (ocv < OCV_CURVE[i]) {
+			float frac = (ocv - OCV_CURVE[i - 1]) /
+				     (OCV_CURVE[i] - OCV_CURVE[i - 1]);
+			return (i - 1 + frac) / (SOC_OCV_NODES - 1);
+		}
+	}
+
+	return 1;
+}
+
+float soc_energy(float soc)
+{
+	float pos = clamp_soc(soc) * (SOC_OCV_NODES - 1);
+	uint8_t i = (uint8_t)pos;
+
+	if (i >= SOC_OCV_NODES - 1) {
+		return OCV_ENERGY[SOC_OCV_NODES - 1];
+	}
+
+	// trapezoid from the node up to soc
+	float frac = pos - i;
+	float ocv = OCV_CURVE[i] + (OCV_CURVE[i + 1] - OCV_CURVE[i]) * frac;
+	return OCV_ENERGY[i] +
+	       (OCV_CURVE[i] + ocv) / 2 * frac / (SOC_OCV_NODES - 1);
+}
+
+void soc_ekf_init(soc_ekf_t *ekf, float ocv)
+{
+	ekf->soc = soc_from_ocv(ocv);
+	ekf->var = SOC_INIT_VAR;
+}
+
+void soc_ekf_predict(soc_ekf_t *ekf, float amps, float dt_s,
+		     float capacity_ah)
+{
+	ekf->soc = clamp_soc(ekf->soc - amps * dt_s / (capacity_ah * 3600));
+	ekf->var += SOC_PROCESS_VAR_PER_S * dt_s;
+}
+
+float soc_voltage_noise(float amps, float rest_s)
+{
+	// under load the ohmic drop is only known roughly, and after it the voltage takes a while to relax
+	float ohmic = amps * SOC_OHMS_NOISE;
+	float relax = SOC_RELAX_NOISE_V * expf(-rest_s / SOC_RELAX_TAU_S);
+	return SOC_CURVE_NOISE_V * SOC_CURVE_NOISE_V + ohmic * ohmic +
+	       relax * relax;
+}
+
+void soc_ekf_correct(soc_ekf_t *ekf, float volts, float amps, float ohms,
+		     float noise)
+{
+	float slope;
+	float predicted = soc_ocv(ekf->soc, &slope) - amps * ohms;
+
+	float gain = ekf->var * slope / (slope * ekf->var * slope + noise);
+	ekf->soc = clamp_soc(ekf->soc + gain * (volts - predicted));
+	ekf->var *= 1 - gain * slope;
+}
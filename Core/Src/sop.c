@@ -0,0 +1,60 @@
+/**
+ * @file sop.c
+ * @brief State of power limits of the cell groups.
+ */
+
+#include "sop.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "impedance.h"
+
+static const float HORIZON_S[SOP_HORIZONS] = {
+	[SOP_2S] = 2.0f,
+	[SOP_10S] = 10.0f,
+	[SOP_CONT] = SOP_CONT_S,
+};
+
+/* e^(-T / tau) of each horizon, the share of the polarization left at its end */
+static float decay[SOP_HORIZONS];
+
+void sop_limits_init(float dcl[SOP_HORIZONS], float ccl[SOP_HORIZONS])
+{
+	static bool ready = false;
+
+	if (!ready) {
+		for (int h = 0; h < SOP_HORIZONS; h++) {
+			decay[h] = expf(-HORIZON_S[h] / IMPEDANCE_TAU_S);
+		}
+		ready = true;
+	}
+
+	for (int h = 0; h < SOP_HORIZONS; h++) {
+		dcl[h] = FLT_MAX;
+		ccl[h] = FLT_MAX;
+	}
+}
+
+void sop_cell_limits(const sop_cell_t *cell, float dcl[SOP_HORIZONS],
+		     float ccl[SOP_HORIZONS])
+{
+	for (int h = 0; h < SOP_HORIZONS; h++) {
+		// volts per amp the group moves by the end of the horizon, along the OCV curve and through R0 and R1
+		float ohms = cell->r0 + cell->r1 * (1 - decay[h]) +
+			     cell->slope * HORIZON_S[h] /
+				     (cell->capacity * 3600);
+		float rest = cell->ocv - cell->polarization * decay[h];
+
+		float discharge = (rest - (MIN_VOLT + VOLT_SAG_MARGIN)) / ohms;
+		float charge = (MAX_CHARGE_VOLT - rest) / ohms;
+
+		if (discharge < dcl[h]) {
+			dcl[h] = discharge > 0 ? discharge : 0;
+		}
+		if (charge < ccl[h]) {
+			ccl[h] = charge > 0 ? charge : 0;
+		}
+	}
+}
@@ -4,6 +4,10 @@
 #include "segment.h"
 #include "charging.h"
 #include "c_utils.h"
+#include "fault_trace.h"
+#ifdef DEBUG_STATS
+#include "adi6830_interation.h"
+#endif
 
 // the countup timer for settling rest
 nertimer_t charger_settle_countup = { .active = false };
@@ -66,7 +70,7 @@ void init_ready(bms_t *bmsdata)
 
 void handle_ready(bms_t *bmsdata)
 {
-	// send our DCL and CCL to motors
+	// send our DCL and CCL to motors, the continuous ones the limit enforcement faults are checked against
 	send_mc_charge_message(bmsdata->cont_CCL);
 	send_mc_discharge_message(bmsdata->cont_DCL);
 	compute_set_fault(false);
@@ -120,6 +124,9 @@ void charger_message_recieved(bms_t *bmsdata)
 
 void init_faulted(bms_t *bmsdata)
 {
+	// handle_faulted() asserts the fault line in the same pass, right after
+	fault_trace_mark(FAULT_TRACE_TRANSITION, bmsdata->snapshot_us);
+
 	// never balance when faulted
 	bmsdata->should_balance = false;
 
@@ -155,9 +162,9 @@ void handle_faulted(bms_t *bmsdata)
 
 void sm_handle_state(bms_t *bmsdata)
 {
-	printf("FAULT STATUS: %d\n", bmsdata->current_state);
 	// always check for faults no matter the current state
 	sm_fault_return(bmsdata);
+	fault_trace_mark(FAULT_TRACE_EVAL, bmsdata->snapshot_us);
 
 	if (bmsdata->fault_code_crit != FAULTS_CLEAR) {
 		request_transition(bmsdata, FAULTED);
@@ -173,160 +180,80 @@ void request_transition(bms_t *bmsdata, state_t next_state)
 	if (!valid_transition_from_to[bmsdata->current_state][next_state])
 		return;
 
+	printf("STATE: %d -> %d\n", bmsdata->current_state, next_state);
 	init_LUT[next_state](bmsdata);
 	bmsdata->current_state = next_state;
 }
 
-void sm_fault_return(bms_t *bmsdata)
+/* the timer of each fault, running while its condition holds */
+static nertimer_t fault_timers[NUM_FAULTS];
+
+/**
+ * @brief Report every cell past the limit a fault was raised on.
+ *
+ * @param bmsdata Pointer to BMS data struct.
+ * @param item The fault.
+ */
+static void sm_fault_report_cells(const bms_t *bmsdata,
+				  const fault_eval_t *item)
 {
-	/* FAULT CHECK (Check for fuckies) */
-
-	static nertimer_t ovr_curr_timer = { 0 };
-	static nertimer_t ovr_chgcurr_timer = { 0 };
-	static nertimer_t undr_volt_timer = { 0 };
-	static nertimer_t ovr_chgvolt_timer = { 0 };
-	static nertimer_t ovr_volt_timer = { 0 };
-	static nertimer_t low_cell_timer = { 0 };
-	static nertimer_t high_temp_timer = { 0 };
-	static nertimer_t die_overtemp_timer = { 0 };
-	static fault_eval_t *fault_table = NULL;
-	static bms_t *fault_data = NULL;
-
-	if (!fault_data)
-		fault_data = bmsdata;
-
-	if (!fault_table) {
-		/* Note that we are only allocating this table once at runtime, so there is
-         * no need to free it */
-		fault_table = (fault_eval_t *)malloc(NUM_FAULTS *
-						     sizeof(fault_eval_t));
-
-		// clang-format off
-    											// ___________FAULT ID____________   __________TIMER___________   _____________DATA________________    __OPERATOR__   ____________________________________THRESHOLD____________________________  _______TIMER LENGTH_________  _____________FAULT CODE_________________    	___OPERATOR 2__ ________________________DATA 2______________   __THRESHOLD 2_____ ______CRITICAL________
-        fault_table[0]  = (fault_eval_t) {.id = "Discharge Current Limit", .timer =       ovr_curr_timer, .data_1 =     fault_data->pack_current,  .optype_1 = GT, .lim_1 = fault_data->cont_DCL ,                                                .timeout =      OVER_CURR_TIME, .code = DISCHARGE_LIMIT_ENFORCEMENT_FAULT,  .optype_2 = NOP/* ------------------------------UNUSED-------------------------*/, .is_critical = true  };
-        fault_table[1]  = (fault_eval_t) {.id = "Charge Current Limit",    .timer =    ovr_chgcurr_timer, .data_1 =     fault_data->pack_current,  .optype_1 = GT, .lim_1 =                                        fault_data->cont_CCL,          .timeout =  OVER_CHG_CURR_TIME, .code =    CHARGE_LIMIT_ENFORCEMENT_FAULT,  .optype_2 = LT,  .data_2 =         fault_data->pack_current,  .lim_2 =          0, .is_critical = true  };
-        fault_table[2]  = (fault_eval_t) {.id = "Low Cell Voltage",        .timer =      undr_volt_timer, .data_1 =  fault_data->min_ocv.val,      .optype_1 = LT, .lim_1 =                                                     MIN_VOLT,         .timeout =     UNDER_VOLT_TIME, .code =              CELL_VOLTAGE_TOO_LOW,  .optype_2 = NOP/* ------------------------------UNUSED-------------------------*/, .is_critical = true  };
-        fault_table[3]  = (fault_eval_t) {.id = "High Charge Voltage",     .timer =    ovr_chgvolt_timer, .data_1 =  fault_data->max_ocv.val,      .optype_1 = GT, .lim_1 =                                              MAX_CHARGE_VOLT,         .timeout =  OVER_VOLT_TIME,     .code =             CELL_VOLTAGE_TOO_HIGH,  .optype_2 = EQ, .data_2 = fault_data->is_charger_connected,  .lim_2 =      true,   .is_critical = true  };
-        fault_table[4]  = (fault_eval_t) {.id = "High Cell Voltage",       .timer =       ovr_volt_timer, .data_1 =  fault_data->max_ocv.val,      .optype_1 = GT, .lim_1 =                                                     MAX_VOLT,         .timeout =      OVER_VOLT_TIME, .code =             CELL_VOLTAGE_TOO_HIGH,  .optype_2 = NOP/* ------------------------------UNUSED-------------------------*/, .is_critical = true  };
-        fault_table[5]  = (fault_eval_t) {.id = "High Temp",               .timer =      high_temp_timer, .data_1 =     fault_data->max_temp.val,  .optype_1 = GT, .lim_1 =                                                        MAX_CELL_TEMP, .timeout =      HIGH_TEMP_TIME, .code =                      PACK_TOO_HOT,  .optype_2 = NOP/* ------------------------------UNUSED-------------------------*/, .is_critical = true  };
-    	fault_table[6]  = (fault_eval_t) {.id = "Extremely Low Voltage",   .timer =       low_cell_timer, .data_1 =  fault_data->min_ocv.val,      .optype_1 = LT, .lim_1 =                                                                  0.9, .timeout =       LOW_CELL_TIME, .code =                  LOW_CELL_VOLTAGE,  .optype_2 = NOP/* ------------------------------UNUSED-------------------------*/, .is_critical = true  };
-		fault_table[7]  = (fault_eval_t) {.id = "Die Overtemp",            .timer =   die_overtemp_timer, .data_1 = fault_data->max_chiptemp.val,  .optype_1 = GT, .lim_1 = 													   MAX_CHIP_TEMP, .timeout =   MAX_CHIPTEMP_TIME, .code =            DIE_TEMP_MAXIMUM_FAULT,  .optype_2 = NOP/* ------------------------------UNUSED-------------------------*/, .is_critical = true  };
-
-		cancel_timer(&ovr_curr_timer);
-		cancel_timer(&ovr_chgcurr_timer);
-		cancel_timer(&undr_volt_timer);
-		cancel_timer(&ovr_chgvolt_timer);
-		cancel_timer(&ovr_volt_timer);
-		cancel_timer(&low_cell_timer);
-		cancel_timer(&high_temp_timer);
-		cancel_timer(&die_overtemp_timer);
-		// clang-format on
-	} else {
-		fault_table[0].data_1 = fault_data->pack_current;
-		fault_table[0].lim_1 = fault_data->cont_DCL;
-		fault_table[1].data_1 = fault_data->pack_current;
-		fault_table[1].lim_1 = fault_data->cont_CCL;
-		fault_table[2].data_1 = fault_data->min_ocv.val;
-		fault_table[3].data_1 = fault_data->max_ocv.val;
-		fault_table[4].data_2 = fault_data->is_charger_connected;
-		fault_table[4].data_1 = fault_data->max_ocv.val;
-		fault_table[5].data_1 = fault_data->max_temp.val;
-		fault_table[6].data_1 = fault_data->min_ocv.val;
-		fault_table[7].data_1 = fault_data->max_chiptemp.val;
+	if (item->cells == CELL_FAULTS) {
+		return;
 	}
 
-	//printf("MIN VOLTS: %f", fault_data->min_voltage.val);
-	fault_stat_t status;
-	for (int i = 0; i < NUM_FAULTS; i++) {
-		uint32_t item_code = fault_table[i].code;
-		status = sm_fault_eval(&fault_table[i]);
-		if (status == FAULT_STAT_FAULTED) {
-			if (fault_table[i].is_critical) {
-				bmsdata->fault_code_crit |= item_code;
-			} else {
-				bmsdata->fault_code_noncrit |= item_code;
-			}
-		} else if (status == FAULT_STAT_CLEARED) {
-			// Clear bit for non-critical faults
-			if (fault_table[i].is_critical) {
-				bmsdata->fault_code_crit &= ~item_code;
-			} else {
-				bmsdata->fault_code_noncrit &= ~item_code;
-			}
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		uint16_t cells = bmsdata->cell_fault_mask[item->cells][c];
+		if (!cells) {
+			continue;
 		}
+
+		printf("\t\t\t*******%s: chip %u cells 0x%04x for %lu ms\n",
+		       item->id, c, cells,
+		       bmsdata->cell_fault_ms[item->cells][c]);
+		send_cell_fault_message(item->code, c, cells,
+					bmsdata->cell_fault_ms[item->cells][c]);
 	}
 }
 
-fault_stat_t sm_fault_eval(fault_eval_t *item)
+/**
+ * @brief Run a fault's timer, and set or clear its code when it trips or clears.
+ *
+ * @param bmsdata Pointer to BMS data struct, holding the fault codes.
+ * @param fault The fault.
+ * @param fault_present Whether its condition holds.
+ * @param value The value its condition tested.
+ */
+static void sm_fault_update(bms_t *bmsdata, fault_index_t fault,
+			    bool fault_present, float value)
 {
-	bool condition1;
-	bool condition2;
-
-	// clang-format off
-    switch (item->optype_1)
-    {
-        case GT: condition1 = item->data_1 > item->lim_1; break;
-        case LT: condition1 = item->data_1 < item->lim_1; break;
-        case GE: condition1 = item->data_1 >= item->lim_1; break;
-        case LE: condition1 = item->data_1 <= item->lim_1; break;
-        case EQ: condition1 = item->data_1 == item->lim_1; break;
-		case NEQ: condition1 = item->data_1 != item->lim_1; break;
-        case NOP: condition1 = false;
-		default: condition1 = false;
-    }
-
-    switch (item->optype_2)
-    {
-        case GT: condition2 = item->data_2 > item->lim_2; break;
-        case LT: condition2 = item->data_2 < item->lim_2; break;
-        case GE: condition2 = item->data_2 >= item->lim_2; break;
-        case LE: condition2 = item->data_2 <= item->lim_2; break;
-        case EQ: condition2 = item->data_2 == item->lim_2; break;
-		case NEQ: condition2 = item->data_2 != item->lim_2; break;
-        case NOP: condition2 = false;
-		default: condition2 = false;
-    }
-	// clang-format on
-
-	bool fault_present = ((condition1 && condition2) ||
-			      (condition1 && (item->optype_2 == NOP)));
-
-	if ((!(is_timer_active(&item->timer))) && !fault_present) {
-		return 0;
-	}
-
-	if (is_timer_active(&item->timer)) {
-		if (!fault_present) {
-			printf("\t\t\t*******Fault cleared: %s\n", item->id);
-			cancel_timer(&item->timer);
-			send_fault_timer_message(0, item->code, item->data_1);
-			return FAULT_STAT_CLEARED;
-		}
-
-		if (is_timer_expired(&item->timer) && fault_present) {
-			printf("\t\t\t*******Faulted: %s\n", item->id);
-			send_fault_timer_message(2, item->code, item->data_1);
-			return FAULT_STAT_FAULTED;
-		}
-
-		return 0;
-
+	const fault_eval_t *item = &fault_table[fault];
+	uint32_t *codes = item->is_critical ? &bmsdata->fault_code_crit :
+					      &bmsdata->fault_code_noncrit;
+
+	switch (sm_fault_eval(item, &fault_timers[fault], fault_present,
+			      value)) {
+	case FAULT_STAT_FAULTED:
+		*codes |= item->code;
+		sm_fault_report_cells(bmsdata, item);
+		break;
+	case FAULT_STAT_CLEARED:
+		*codes &= ~item->code;
+		break;
+	default:
+		break;
 	}
+}
 
-	else if (!is_timer_active(&item->timer) && fault_present) {
-		printf("\t\t\t*******Starting fault timer: %s\n", item->id);
-		start_timer(&item->timer, item->timeout);
-		send_fault_timer_message(1, item->code, item->data_1);
+void sm_fault_return(bms_t *bmsdata)
+{
+	/* FAULT CHECK (Check for fuckies) */
+	bool present[NUM_FAULTS];
+	float values[NUM_FAULTS];
 
-		return 0;
+	fault_table_eval(bmsdata, present, values);
+	for (fault_index_t fault = 0; fault < NUM_FAULTS; fault++) {
+		sm_fault_update(bmsdata, fault, present[fault], values[fault]);
 	}
-	/* if (item->code == CELL_VOLTAGE_TOO_LOW) {
-          printf("\t\t\t*******Not fautled!!!!!\t%d\r\n",
-  !is_timer_active(&item->timer) && condition1 && condition2); printf("More
-  stats...\t:%d\t%d\r\n", is_timer_expired(&item->timer), item->timer.active);
-  } */
-	printf("err should not get here");
-	return 0;
 }
 
 /* charger settle countup =  1 minute pause to let readings settle and get good
@@ -390,3 +317,58 @@ void sm_balance_cells(bms_t *bmsdata)
 	handle_balance_cells(bmsdata);
 	bmsdata->should_balance = true;
 }
+
+#ifdef DEBUG_STATS
+
+/* Latency of the decisions since the last print, in us */
+static struct {
+	uint32_t sample_to_wake;
+	uint32_t sample_to_wake_max;
+	uint32_t wake_to_decision;
+	uint32_t wake_to_decision_max;
+	uint32_t sample_to_decision;
+	uint32_t sample_to_decision_max;
+	uint32_t wakeups;
+	uint32_t watchdog_wakeups;
+} sm_latency;
+
+void sm_log_latency(const bms_t *bmsdata, uint32_t wake_us, bool fresh)
+{
+	uint32_t now = adbms_get_us();
+
+	sm_latency.wakeups++;
+	// a watchdog wakeup decides on an old sample, its latency says nothing about the pipeline
+	if (!fresh) {
+		sm_latency.watchdog_wakeups++;
+		return;
+	}
+
+	sm_latency.sample_to_wake = wake_us - bmsdata->snapshot_us;
+	sm_latency.wake_to_decision = now - wake_us;
+	sm_latency.sample_to_decision = now - bmsdata->snapshot_us;
+
+	if (sm_latency.sample_to_wake > sm_latency.sample_to_wake_max) {
+		sm_latency.sample_to_wake_max = sm_latency.sample_to_wake;
+	}
+	if (sm_latency.wake_to_decision > sm_latency.wake_to_decision_max) {
+		sm_latency.wake_to_decision_max = sm_latency.wake_to_decision;
+	}
+	if (sm_latency.sample_to_decision >
+	    sm_latency.sample_to_decision_max) {
+		sm_latency.sample_to_decision_max =
+			sm_latency.sample_to_decision;
+	}
+}
+
+void sm_print_latency(void)
+{
+	printf("State machine: sample to wake %lu us (worst %lu), wake to decision %lu us (worst %lu), sample to decision %lu us (worst %lu), %lu wakeups, %lu by watchdog\n",
+	       sm_latency.sample_to_wake, sm_latency.sample_to_wake_max,
+	       sm_latency.wake_to_decision, sm_latency.wake_to_decision_max,
+	       sm_latency.sample_to_decision,
+	       sm_latency.sample_to_decision_max, sm_latency.wakeups,
+	       sm_latency.watchdog_wakeups);
+	sm_latency = (typeof(sm_latency)){ 0 };
+}
+
+#endif
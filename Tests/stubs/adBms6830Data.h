@@ -0,0 +1,18 @@
+/**
+ * @file adBms6830Data.h
+ * @brief Host stand-in for the ADBMS6830 driver's chip data, the host tests do not look inside a chip.
+ */
+
+#ifndef _ADBMS6830DATA_H
+#define _ADBMS6830DATA_H
+
+#include <stdint.h>
+
+typedef struct {
+	uint8_t unused;
+} cell_asic;
+
+/* status register C, only passed by pointer */
+typedef struct stc_ stc_;
+
+#endif
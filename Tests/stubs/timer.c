@@ -0,0 +1,35 @@
+/**
+ * @file timer.c
+ * @brief Host stand-in for the Embedded-Base timers, running on a clock the tests set.
+ */
+
+#include "timer.h"
+
+static uint32_t now = 0;
+
+void timer_stub_set_ms(uint32_t now_ms)
+{
+	now = now_ms;
+}
+
+void start_timer(nertimer_t *timer, uint32_t duration)
+{
+	timer->start_time = now;
+	timer->end_time = now + duration;
+	timer->active = true;
+}
+
+void cancel_timer(nertimer_t *timer)
+{
+	timer->active = false;
+}
+
+bool is_timer_expired(nertimer_t *timer)
+{
+	return timer->active && (int32_t)(now - timer->end_time) >= 0;
+}
+
+bool is_timer_active(nertimer_t *timer)
+{
+	return timer->active;
+}
@@ -0,0 +1,30 @@
+/**
+ * @file timer.h
+ * @brief Host stand-in for the Embedded-Base timers, running on a clock the tests set.
+ */
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+	uint32_t start_time;
+	uint32_t end_time;
+	bool active;
+} nertimer_t;
+
+void start_timer(nertimer_t *timer, uint32_t duration);
+void cancel_timer(nertimer_t *timer);
+bool is_timer_expired(nertimer_t *timer);
+bool is_timer_active(nertimer_t *timer);
+
+/**
+ * @brief Set the time the timers run on.
+ *
+ * @param now_ms The time in ms.
+ */
+void timer_stub_set_ms(uint32_t now_ms);
+
+#endif
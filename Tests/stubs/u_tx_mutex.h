@@ -0,0 +1,9 @@
+/**
+ * @file u_tx_mutex.h
+ * @brief Host stand-in for the Embedded-Base header datastructs.h includes, the host tests take no mutexes.
+ */
+
+#ifndef _U_TX_MUTEX_H
+#define _U_TX_MUTEX_H
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ * @file test.h
+ * @brief Minimal assertions for the host tests.
+ */
+
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+/* Record a failure and carry on, so one run reports every broken check */
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__,    \
+			       __LINE__, #cond);                         \
+			test_failures++;                                 \
+		}                                                        \
+	} while (0)
+
+#define CHECK_EQ(a, b)                                                     \
+	do {                                                               \
+		long long _a = (long long)(a), _b = (long long)(b);        \
+		if (_a != _b) {                                            \
+			printf("%s:%d: CHECK_EQ(%s, %s) failed, %lld != %lld\n", \
+			       __FILE__, __LINE__, #a, #b, _a, _b);        \
+			test_failures++;                                   \
+		}                                                          \
+	} while (0)
+
+#define RUN(test)                           \
+	do {                                \
+		int _before = test_failures; \
+		test();                     \
+		printf("%s %s\n",            \
+		       test_failures == _before ? "ok  " : "FAIL", #test); \
+	} while (0)
+
+#define TEST_RESULT() (test_failures ? 1 : 0)
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * @file test_adbms_spi.c
+ * @brief ADBMS transaction engine against a simulated chain.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "adbms_spi.h"
+
+/* RDCVA, and its PEC15 from the datasheet */
+static const uint8_t RDCVA[2] = { 0x00, 0x04 };
+static const uint16_t RDCVA_PEC = 0x07C2;
+/* ADCV */
+static const uint8_t ADCV[2] = { 0x02, 0x60 };
+
+#define GROUP_IC_BYTES 8
+#define CHAIN_CHIPS    4
+
+static void fill_regs(adbms_spi_mock_t *mock, uint8_t seed)
+{
+	for (uint8_t chip = 0; chip < NUM_CHIPS; chip++) {
+		for (uint8_t i = 0; i < RDASALL_FRAME_BYTES - 2; i++) {
+			mock->regs[chip][i] = (uint8_t)(seed + chip * 16 + i);
+		}
+	}
+}
+
+static void test_pec15(void)
+{
+	CHECK_EQ(adbms_pec15(RDCVA, 2), RDCVA_PEC);
+}
+
+static void test_read(void)
+{
+	static adbms_spi_mock_t mock;
+	static adbms_spi_t spi;
+	uint8_t rx[CHAIN_CHIPS * GROUP_IC_BYTES];
+
+	CHECK_EQ(adbms_spi_mock_init(&mock, &spi, CHAIN_CHIPS), 0);
+	fill_regs(&mock, 0x10);
+
+	CHECK_EQ(adbms_spi_queue_read(&spi, RDCVA, rx, GROUP_IC_BYTES), 0);
+	CHECK_EQ(adbms_spi_queued(&spi), 1);
+	CHECK_EQ(adbms_spi_run(&spi), 0);
+	CHECK_EQ(adbms_spi_queued(&spi), 0);
+
+	// the command went out with its PEC, and CS was released after the response
+	CHECK_EQ(mock.cmds_seen, 1);
+	CHECK_EQ(mock.last_cmd[0], RDCVA[0]);
+	CHECK_EQ(mock.last_cmd[1], RDCVA[1]);
+	CHECK_EQ((mock.last_cmd[2] << 8) | mock.last_cmd[3], RDCVA_PEC);
+	CHECK(!mock.selected);
+
+	for (uint8_t chip = 0; chip < CHAIN_CHIPS; chip++) {
+		const uint8_t *ic = &rx[chip * GROUP_IC_BYTES];
+		CHECK(memcmp(ic, mock.regs[chip], GROUP_IC_BYTES - 2) == 0);
+		CHECK(adbms_pec10_check(ic, GROUP_IC_BYTES));
+	}
+
+	// a corrupted response is caught on that chip alone
+	mock.corrupt_chip = 2;
+	CHECK_EQ(adbms_spi_queue_read(&spi, RDCVA, rx, GROUP_IC_BYTES), 0);
+	CHECK_EQ(adbms_spi_run(&spi), 0);
+	for (uint8_t chip = 0; chip < CHAIN_CHIPS; chip++) {
+		CHECK_EQ(adbms_pec10_check(&rx[chip * GROUP_IC_BYTES],
+					   GROUP_IC_BYTES),
+			 chip != 2);
+	}
+	CHECK_EQ(mock.corrupt_chip, -1);
+}
+
+static void test_queue(void)
+{
+	static adbms_spi_mock_t mock;
+	static adbms_spi_t spi;
+	static uint8_t rx[ADBMS_SPI_MAX_RESPONSE];
+
+	CHECK_EQ(adbms_spi_mock_init(&mock, &spi, CHAIN_CHIPS), 0);
+
+	// running an empty queue is not an error, and puts nothing on the wire
+	CHECK_EQ(adbms_spi_run(&spi), 0);
+	CHECK_EQ(mock.cmds_seen, 0);
+
+	for (uint8_t i = 0; i < ADBMS_SPI_QUEUE_LEN; i++) {
+		CHECK_EQ(adbms_spi_queue_cmd(&spi, ADCV), 0);
+	}
+	CHECK_EQ(adbms_spi_queue_cmd(&spi, ADCV), -1);
+	CHECK_EQ(adbms_spi_queued(&spi), ADBMS_SPI_QUEUE_LEN);
+
+	CHECK_EQ(adbms_spi_run(&spi), 0);
+	CHECK_EQ(mock.cmds_seen, ADBMS_SPI_QUEUE_LEN);
+
+	// a response larger than the chain can answer with is refused
+	CHECK_EQ(adbms_spi_queue_read(&spi, RDCVA, rx,
+				      ADBMS_SPI_MAX_RESPONSE / CHAIN_CHIPS + 1),
+		 -1);
+	CHECK_EQ(adbms_spi_queued(&spi), 0);
+}
+
+int main(void)
+{
+	RUN(test_pec15);
+	RUN(test_read);
+	RUN(test_queue);
+	return TEST_RESULT();
+}
@@ -0,0 +1,202 @@
+/**
+ * @file test_cell_volt.c
+ * @brief Cell voltage statistics and fault masks against a float reference.
+ *
+ * Built twice, as test_cell_volt with cell_volt_t in volts, and as test_cell_volt_fixed with
+ * ANALYZER_FIXED_POINT and cell_volt_t as raw codes.  Both have to agree with the reference on the same codes.
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "test.h"
+#include "pack_stats.h"
+#include "cell_faults.h"
+
+/* A segment, the block calc_pack_stats() scans */
+#define BLOCK_LEN (2 * NUM_CELLS_PER_CHIP)
+
+/**
+ * @brief A cell code in volts, the way the float path converts it.
+ */
+static float code_volts(int16_t code)
+{
+	return code * CELL_CODE_LSB_V + CELL_CODE_OFFSET_V;
+}
+
+/**
+ * @brief A cell code as the analyzer keeps it.
+ */
+static cell_volt_t code_cell_volt(int16_t code)
+{
+#ifdef ANALYZER_FIXED_POINT
+	return CELL_VOLT_FROM_CODE(code);
+#else
+	return code_volts(code);
+#endif
+}
+
+/**
+ * @brief Scan a block of codes in volts, first cell wins a tie.
+ */
+static void reference_stats(const int16_t *codes, uint16_t len,
+			    float_stats_t *ref, double *sum)
+{
+	*ref = (float_stats_t){ .max = code_volts(codes[0]),
+				.min = code_volts(codes[0]) };
+	*sum = 0;
+
+	for (uint16_t i = 0; i < len; i++) {
+		float volts = code_volts(codes[i]);
+		if (volts > ref->max) {
+			ref->max = volts;
+			ref->max_at = i;
+		}
+		if (volts < ref->min) {
+			ref->min = volts;
+			ref->min_at = i;
+		}
+		*sum += volts;
+	}
+}
+
+static void check_stats(const int16_t *codes, uint16_t len)
+{
+	cell_volt_t cells[BLOCK_LEN];
+	cell_volt_stats_t stats;
+	float_stats_t ref;
+	double ref_sum;
+
+	for (uint16_t i = 0; i < len; i++) {
+		cells[i] = code_cell_volt(codes[i]);
+	}
+
+	stats_cell_volt(cells, len, &stats);
+	reference_stats(codes, len, &ref, &ref_sum);
+
+	CHECK_EQ(stats.max_at, ref.max_at);
+	CHECK_EQ(stats.min_at, ref.min_at);
+	CHECK(fabsf(CELL_VOLT_TO_FLOAT(stats.max) - ref.max) < 0.00001f);
+	CHECK(fabsf(CELL_VOLT_TO_FLOAT(stats.min) - ref.min) < 0.00001f);
+	// float accumulates its rounding over the block, codes sum exactly
+	CHECK(fabs(CELL_VOLT_SUM_TO_FLOAT(stats.sum, len) - ref_sum) < 0.001);
+}
+
+static void check_masks(const int16_t codes[NUM_CELLS_PER_CHIP],
+			int16_t lim_code)
+{
+	cell_volt_t cells[NUM_CELLS_PER_CHIP];
+	uint16_t above = 0;
+	uint16_t below = 0;
+	float lim = code_volts(lim_code);
+
+	for (uint8_t i = 0; i < NUM_CELLS_PER_CHIP; i++) {
+		cells[i] = code_cell_volt(codes[i]);
+		above |= (uint16_t)(code_volts(codes[i]) > lim) << i;
+		below |= (uint16_t)(code_volts(codes[i]) < lim) << i;
+	}
+
+	CHECK_EQ(mask_cell_volt_above(cells, code_cell_volt(lim_code)), above);
+	CHECK_EQ(mask_cell_volt_below(cells, code_cell_volt(lim_code)), below);
+}
+
+static void test_stats_ties(void)
+{
+	int16_t codes[BLOCK_LEN];
+
+	for (uint16_t i = 0; i < BLOCK_LEN; i++) {
+		codes[i] = 15000;
+	}
+	// the same extreme on both chips of the segment, the first one is reported
+	codes[3] = 18000;
+	codes[NUM_CELLS_PER_CHIP + 3] = 18000;
+	codes[5] = 9000;
+	codes[BLOCK_LEN - 1] = 9000;
+	check_stats(codes, BLOCK_LEN);
+
+	// a flat block reports its first cell for both
+	for (uint16_t i = 0; i < BLOCK_LEN; i++) {
+		codes[i] = 12345;
+	}
+	check_stats(codes, BLOCK_LEN);
+}
+
+static void test_stats_negative(void)
+{
+	int16_t codes[BLOCK_LEN];
+
+	// codes go negative under 1.5 V, a dead or disconnected cell
+	for (uint16_t i = 0; i < BLOCK_LEN; i++) {
+		codes[i] = (int16_t)(16000 - i * 1500);
+	}
+	check_stats(codes, BLOCK_LEN);
+
+	// the ends of the code range
+	codes[7] = INT16_MIN;
+	codes[20] = INT16_MAX;
+	check_stats(codes, BLOCK_LEN);
+}
+
+static void test_stats_lengths(void)
+{
+	int16_t codes[BLOCK_LEN];
+	uint32_t seed = 1;
+
+	for (uint16_t i = 0; i < BLOCK_LEN; i++) {
+		seed = seed * 1103515245 + 12345;
+		codes[i] = (int16_t)(seed >> 16);
+	}
+
+	// an odd length leaves a single cell after the pairs
+	for (uint16_t len = 1; len <= BLOCK_LEN; len++) {
+		check_stats(codes, len);
+	}
+}
+
+static void test_masks_boundary(void)
+{
+	int16_t codes[NUM_CELLS_PER_CHIP];
+	const int16_t lim = VOLTS_TO_CELL_CODE(MAX_VOLT);
+
+	// a cell at the limit is not past it, one code either side is
+	for (uint8_t i = 0; i < NUM_CELLS_PER_CHIP; i++) {
+		codes[i] = (int16_t)(lim + (i % 3) - 1);
+	}
+	check_masks(codes, lim);
+
+	cell_volt_t cells[NUM_CELLS_PER_CHIP];
+	for (uint8_t i = 0; i < NUM_CELLS_PER_CHIP; i++) {
+		cells[i] = code_cell_volt(lim);
+	}
+	CHECK_EQ(mask_cell_volt_above(cells, code_cell_volt(lim)), 0);
+	CHECK_EQ(mask_cell_volt_below(cells, code_cell_volt(lim)), 0);
+}
+
+static void test_masks_negative(void)
+{
+	int16_t codes[NUM_CELLS_PER_CHIP];
+
+	for (uint8_t i = 0; i < NUM_CELLS_PER_CHIP; i++) {
+		codes[i] = (int16_t)(-12000 + i * 2000);
+	}
+	check_masks(codes, VOLTS_TO_CELL_CODE(0.9));
+	check_masks(codes, 0);
+
+	// the ends of the code range, where a plain 16 bit difference would overflow
+	codes[0] = INT16_MIN;
+	codes[1] = INT16_MAX;
+	codes[NUM_CELLS_PER_CHIP - 1] = INT16_MIN;
+	check_masks(codes, INT16_MAX);
+	check_masks(codes, INT16_MIN);
+	check_masks(codes, VOLTS_TO_CELL_CODE(MIN_VOLT));
+}
+
+int main(void)
+{
+	RUN(test_stats_ties);
+	RUN(test_stats_negative);
+	RUN(test_stats_lengths);
+	RUN(test_masks_boundary);
+	RUN(test_masks_negative);
+	return TEST_RESULT();
+}
@@ -0,0 +1,262 @@
+/**
+ * @file test_fault_table.c
+ * @brief Fault conditions of fault_table.h, and the timer each fault trips on.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "fault_table.h"
+#include "timer.h"
+
+/* the last fault timer message, as sent over CAN */
+static struct {
+	uint32_t count;
+	uint8_t start_stop;
+	uint32_t code;
+	float value;
+} timer_msgs;
+
+void send_fault_timer_message(uint8_t start_stop, uint32_t fault_code,
+			      float value)
+{
+	timer_msgs.count++;
+	timer_msgs.start_stop = start_stop;
+	timer_msgs.code = fault_code;
+	timer_msgs.value = value;
+}
+
+static bms_t bms;
+
+static void eval(bool present[NUM_FAULTS], float values[NUM_FAULTS])
+{
+	fault_table_eval(&bms, present, values);
+}
+
+static void test_table(void)
+{
+	for (fault_index_t f = 0; f < NUM_FAULTS; f++) {
+		CHECK(fault_table[f].id != NULL);
+		CHECK(fault_table[f].code != 0);
+		CHECK(fault_table[f].timeout > 0);
+		CHECK(fault_table[f].cells <= CELL_FAULTS);
+	}
+
+	// the comparators are the fast path, they trip well before the readings they back up
+	CHECK(fault_table[FAULT_HW_OVER_VOLTAGE].timeout <
+	      fault_table[FAULT_HIGH_CELL_VOLTAGE].timeout);
+	CHECK(fault_table[FAULT_HW_UNDER_VOLTAGE].timeout <
+	      fault_table[FAULT_LOW_CELL_VOLTAGE].timeout);
+}
+
+static void test_conditions_clear(void)
+{
+	bool present[NUM_FAULTS];
+	float values[NUM_FAULTS];
+
+	// a healthy pack, with room under its limits
+	memset(&bms, 0, sizeof(bms));
+	bms.cont_DCL = 100;
+	bms.cont_CCL = 20;
+	bms.pack_current = 10;
+	bms.max_chiptemp.val = MAX_CHIP_TEMP - 1;
+
+	eval(present, values);
+	for (fault_index_t f = 0; f < NUM_FAULTS; f++) {
+		CHECK(!present[f]);
+	}
+}
+
+static void test_conditions_cells(void)
+{
+	bool present[NUM_FAULTS];
+	float values[NUM_FAULTS];
+
+	memset(&bms, 0, sizeof(bms));
+	bms.cont_DCL = 100;
+	bms.min_ocv.val = 2.4f;
+	bms.max_ocv.val = 4.25f;
+	bms.min_voltage.val = 2.3f;
+	bms.max_voltage.val = 4.3f;
+	bms.cell_fault_mask[CELL_FAULT_UV][3] = 0x4;
+	bms.cell_fault_mask[CELL_FAULT_HW_OV][NUM_CHIPS - 1] = 0x2000;
+
+	eval(present, values);
+	CHECK(present[FAULT_LOW_CELL_VOLTAGE]);
+	CHECK(present[FAULT_HW_OVER_VOLTAGE]);
+	CHECK(!present[FAULT_HIGH_CELL_VOLTAGE]);
+	CHECK(!present[FAULT_HW_UNDER_VOLTAGE]);
+
+	// reported in volts, whatever the analyzer keeps the cells in
+	CHECK(values[FAULT_LOW_CELL_VOLTAGE] == 2.4f);
+	CHECK(values[FAULT_HIGH_CELL_VOLTAGE] == 4.25f);
+	CHECK(values[FAULT_HW_OVER_VOLTAGE] == 4.3f);
+	CHECK(values[FAULT_HW_UNDER_VOLTAGE] == 2.3f);
+
+	// the charge limit only counts with a charger on the pack
+	bms.cell_fault_mask[CELL_FAULT_CHARGE_OV][0] = 0x1;
+	eval(present, values);
+	CHECK(!present[FAULT_HIGH_CHARGE_VOLTAGE]);
+	bms.is_charger_connected = true;
+	eval(present, values);
+	CHECK(present[FAULT_HIGH_CHARGE_VOLTAGE]);
+}
+
+static void test_conditions_pack(void)
+{
+	bool present[NUM_FAULTS];
+	float values[NUM_FAULTS];
+
+	memset(&bms, 0, sizeof(bms));
+	bms.cont_DCL = 40;
+	bms.pack_current = 50;
+	bms.max_chiptemp.val = MAX_CHIP_TEMP + 1;
+
+	eval(present, values);
+	CHECK(present[FAULT_DISCHARGE_CURRENT]);
+	CHECK(values[FAULT_DISCHARGE_CURRENT] == 50);
+	CHECK(present[FAULT_DIE_OVERTEMP]);
+	CHECK(!present[FAULT_CHARGE_CURRENT]);
+
+	bms.pack_current = 40;
+	eval(present, values);
+	CHECK(!present[FAULT_DISCHARGE_CURRENT]);
+}
+
+static void test_eval(void)
+{
+	const fault_eval_t *item = &fault_table[FAULT_LOW_CELL_VOLTAGE];
+	nertimer_t timer = { 0 };
+
+	memset(&timer_msgs, 0, sizeof(timer_msgs));
+	timer_stub_set_ms(1000);
+
+	// nothing happens while the condition does not hold
+	CHECK_EQ(sm_fault_eval(item, &timer, false, 3.6f), 0);
+	CHECK(!is_timer_active(&timer));
+	CHECK_EQ(timer_msgs.count, 0);
+
+	// the timer starts on the condition, and is reported
+	CHECK_EQ(sm_fault_eval(item, &timer, true, 2.4f), 0);
+	CHECK(is_timer_active(&timer));
+	CHECK_EQ(timer_msgs.count, 1);
+	CHECK_EQ(timer_msgs.start_stop, 1);
+	CHECK_EQ(timer_msgs.code, item->code);
+	CHECK(timer_msgs.value == 2.4f);
+
+	// holding short of the timeout does not trip
+	timer_stub_set_ms(1000 + item->timeout - 1);
+	CHECK_EQ(sm_fault_eval(item, &timer, true, 2.4f), 0);
+	CHECK_EQ(timer_msgs.count, 1);
+
+	timer_stub_set_ms(1000 + item->timeout);
+	CHECK_EQ(sm_fault_eval(item, &timer, true, 2.4f), FAULT_STAT_FAULTED);
+	CHECK_EQ(timer_msgs.start_stop, 2);
+
+	// clearing cancels the timer, the next onset starts a full timeout again
+	CHECK_EQ(sm_fault_eval(item, &timer, false, 3.6f), FAULT_STAT_CLEARED);
+	CHECK(!is_timer_active(&timer));
+	CHECK_EQ(timer_msgs.start_stop, 0);
+
+	CHECK_EQ(sm_fault_eval(item, &timer, true, 2.4f), 0);
+	timer_stub_set_ms(1000 + 2 * item->timeout - 1);
+	CHECK_EQ(sm_fault_eval(item, &timer, true, 2.4f), 0);
+}
+
+/**
+ * @brief Hold one cell of a healthy pack at a terminal voltage for a while, running the comparator faults every
+ * OV/UV period as the firmware does.
+ *
+ * @return fault_stat_t FAULT_STAT_FAULTED if either comparator fault tripped.
+ */
+static fault_stat_t hold_cell(nertimer_t timers[NUM_FAULTS], float volts,
+			      uint32_t *now, uint32_t hold_ms)
+{
+	cell_volt_t cells[NUM_CHIPS][NUM_CELLS_PER_CHIP];
+	bool present[NUM_FAULTS];
+	float values[NUM_FAULTS];
+	const fault_index_t hw[] = { FAULT_HW_OVER_VOLTAGE,
+				     FAULT_HW_UNDER_VOLTAGE };
+	fault_stat_t stat = 0;
+
+	for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+		for (uint8_t cell = 0; cell < NUM_CELLS_PER_CHIP; cell++) {
+			cells[c][cell] = CELL_VOLT(NOM_VOLT);
+		}
+	}
+	cells[3][5] = CELL_VOLT(volts);
+
+	for (uint32_t end = *now + hold_ms; *now <= end;
+	     *now += OVUV_PERIOD_MS) {
+		timer_stub_set_ms(*now);
+
+		// what the chips' comparators flag with VOV and VUV programmed at the HW limits
+		for (uint8_t c = 0; c < NUM_CHIPS; c++) {
+			bms.cell_fault_mask[CELL_FAULT_HW_OV][c] =
+				mask_cell_volt_above(cells[c],
+						     CELL_VOLT(HW_OV_VOLT));
+			bms.cell_fault_mask[CELL_FAULT_HW_UV][c] =
+				mask_cell_volt_below(cells[c],
+						     CELL_VOLT(HW_UV_VOLT));
+		}
+
+		eval(present, values);
+		for (uint8_t i = 0; i < sizeof(hw) / sizeof(hw[0]); i++) {
+			if (sm_fault_eval(&fault_table[hw[i]], &timers[hw[i]],
+					  present[hw[i]], values[hw[i]]) ==
+			    FAULT_STAT_FAULTED) {
+				stat = FAULT_STAT_FAULTED;
+			}
+		}
+	}
+
+	return stat;
+}
+
+static void test_comparator_limits(void)
+{
+	nertimer_t timers[NUM_FAULTS] = { 0 };
+	uint32_t now = 1000;
+
+	// the comparators see terminal voltage, their thresholds sit past anything a healthy cell reaches
+	CHECK(HW_OV_VOLT > MAX_CHARGE_VOLT_FLT);
+	CHECK(HW_UV_VOLT < MIN_VOLT);
+
+	memset(&bms, 0, sizeof(bms));
+	bms.cont_DCL = 100;
+
+	// a cell sagging under load, below the cell limit, for longer than the comparator timeout
+	CHECK_EQ(hold_cell(timers, MIN_VOLT - 0.2f, &now,
+			   10 * HW_UNDER_VOLT_TIME),
+		 0);
+	CHECK(!is_timer_active(&timers[FAULT_HW_UNDER_VOLTAGE]));
+
+	// and one charged into its IR rise
+	CHECK_EQ(hold_cell(timers, MAX_CHARGE_VOLT_FLT - 0.01f, &now,
+			   10 * HW_OVER_VOLT_TIME),
+		 0);
+	CHECK(!is_timer_active(&timers[FAULT_HW_OVER_VOLTAGE]));
+
+	// a dead cell trips once it has held past the threshold for the timeout, not before
+	CHECK_EQ(hold_cell(timers, HW_UV_VOLT - 0.2f, &now,
+			   HW_UNDER_VOLT_TIME - OVUV_PERIOD_MS),
+		 0);
+	CHECK(is_timer_active(&timers[FAULT_HW_UNDER_VOLTAGE]));
+	CHECK_EQ(hold_cell(timers, HW_UV_VOLT - 0.2f, &now, OVUV_PERIOD_MS),
+		 FAULT_STAT_FAULTED);
+
+	// as does an overcharged one
+	CHECK_EQ(hold_cell(timers, HW_OV_VOLT + 0.1f, &now, HW_OVER_VOLT_TIME),
+		 FAULT_STAT_FAULTED);
+}
+
+int main(void)
+{
+	RUN(test_table);
+	RUN(test_conditions_clear);
+	RUN(test_conditions_cells);
+	RUN(test_conditions_pack);
+	RUN(test_eval);
+	RUN(test_comparator_limits);
+	return TEST_RESULT();
+}
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""Generate the thermistor temperature lookup tables from the curve fit.
+
+The curve coefficients and divider values are read from Core/Inc/therm_curve.h, and the ADC code
+scaling from Core/Inc/datastructs.h, so the tables always match what the firmware was built with.
+Each table maps an aux ADC code to centidegrees Celsius, with nodes 2^THERM_LUT_SHIFT codes apart.
+The firmware interpolates linearly between nodes.
+
+The accuracy of the interpolated table against the double precision fit is checked at every ADC
+code that maps to -40..THERM_LUT_MAX_C, and written into the generated header and a report file.
+
+Usage: gen_therm_lut.py <Core/Inc> <output dir>
+"""
+
+import math
+import os
+import re
+import sys
+
+INT16_MIN = -32768
+INT16_MAX = 32767
+# Coldest temperature the accuracy report covers, and the coldest the fit is trusted at
+REPORT_MIN_C = -40.0
+
+
+def read_defines(path):
+    """Read the numeric object-like macros of a header."""
+    defines = {}
+    pattern = re.compile(r"^#define\s+(\w+)\s+\(?(-?[0-9.]+)f?\)?\s*(?:/[*/].*)?$")
+    with open(path) as header:
+        for line in header:
+            match = pattern.match(line.strip())
+            if match:
+                defines[match.group(1)] = float(match.group(2))
+    return defines
+
+
+class Curve:
+    def __init__(self, defs):
+        self.coef = [defs["THERM_FIT_A8"], defs["THERM_FIT_A4"], defs["THERM_FIT_A2"],
+                     defs["THERM_FIT_A1"], defs["THERM_FIT_A0"]]
+        self.nominal = defs["THERM_NOMINAL_OHMS"]
+        self.pullup = defs["THERM_PULLUP_OHMS"]
+        self.lsb = defs["CELL_CODE_LSB_V"]
+        self.offset = defs["CELL_CODE_OFFSET_V"]
+        self.max_c = defs["THERM_LUT_MAX_C"]
+        self.shift = int(defs["THERM_LUT_SHIFT"])
+
+        # the fit turns back up past its minimum, clamp cold readings to it
+        self.min_c, self.turn_ohms = min(
+            (self.temp_of_res(r), r)
+            for r in (self.nominal * 1.001 ** i for i in range(8000)))
+
+    def temp_of_res(self, res):
+        """The fit, evaluated exactly as calc_temp() did."""
+        c = res / self.nominal
+        a8, a4, a2, a1, a0 = self.coef
+        return a8 * c ** (1 / 8) + a4 * c ** (1 / 4) + a2 * c ** (1 / 2) + a1 * c + a0
+
+    def temp_of_code(self, code, supply):
+        """Temperature of an ADC code, clamped to the range the fit is monotonic over."""
+        volts = code * self.lsb + self.offset
+        if volts <= 0:
+            return self.min_c
+        if volts >= supply:
+            return self.max_c
+        res = self.pullup * (supply - volts) / volts
+        if res >= self.turn_ohms:
+            return self.min_c
+        return min(self.temp_of_res(res), self.max_c)
+
+
+class Table:
+    def __init__(self, name, curve, supply):
+        self.name = name
+        self.curve = curve
+        self.supply = supply
+        step = 1 << curve.shift
+
+        # cover every code that lands between 0 V and the supply, on a node boundary
+        lo = math.floor(-curve.offset / curve.lsb)
+        hi = math.ceil((supply - curve.offset) / curve.lsb)
+        self.code_min = max(INT16_MIN, lo - lo % step)
+        self.nodes = [round(curve.temp_of_code(code, supply) * 100)
+                      for code in range(self.code_min, hi + step, step)]
+
+    def lookup(self, code):
+        """Mirror of therm_lut_lookup() in analyzer.c."""
+        offset = code - self.code_min
+        if offset <= 0:
+            return self.nodes[0] / 100
+        index = offset >> self.curve.shift
+        if index >= len(self.nodes) - 1:
+            return self.nodes[-1] / 100
+        frac = offset & ((1 << self.curve.shift) - 1)
+        a = self.nodes[index]
+        b = self.nodes[index + 1]
+        return (a + (((b - a) * frac) >> self.curve.shift)) / 100
+
+    def accuracy(self):
+        """Max and mean error against the fit, over the codes that read from -40 C up to the clamp."""
+        worst = 0.0
+        worst_code = 0
+        total = 0.0
+        count = 0
+        for code in range(INT16_MIN, INT16_MAX + 1):
+            exact = self.curve.temp_of_code(code, self.supply)
+            if exact < REPORT_MIN_C or exact >= self.curve.max_c:
+                continue
+            error = abs(self.lookup(code) - exact)
+            total += error
+            count += 1
+            if error > worst:
+                worst = error
+                worst_code = code
+        return worst, worst_code, total / count, count
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    inc_dir, out_dir = sys.argv[1:]
+
+    defs = read_defines(os.path.join(inc_dir, "therm_curve.h"))
+    defs.update(read_defines(os.path.join(inc_dir, "datastructs.h")))
+    curve = Curve(defs)
+
+    tables = [Table("cell", curve, defs["THERM_CELL_SUPPLY_V"]),
+              Table("onboard", curve, defs["THERM_ONBOARD_SUPPLY_V"])]
+
+    report = ["Thermistor lookup tables, %d codes per node, interpolated against the fit" %
+              (1 << curve.shift),
+              "Clamped to %.2f..%.2f C, the fit's minimum is at %.0f ohms" %
+              (curve.min_c, curve.max_c, curve.turn_ohms)]
+    for table in tables:
+        worst, worst_code, mean, count = table.accuracy()
+        report.append("%-7s %.1f V: %4d nodes, max error %.3f C at code %d, mean %.4f C over %d codes" %
+                      (table.name, table.supply, len(table.nodes), worst, worst_code, mean, count))
+
+    os.makedirs(out_dir, exist_ok=True)
+
+    with open(os.path.join(out_dir, "therm_lut_report.txt"), "w") as out:
+        out.write("\n".join(report) + "\n")
+
+    with open(os.path.join(out_dir, "therm_lut.h"), "w") as out:
+        out.write("/**\n * @file therm_lut.h\n")
+        out.write(" * @brief Generated by scripts/gen_therm_lut.py from therm_curve.h, do not edit.\n *\n")
+        for line in report:
+            out.write(" * %s\n" % line)
+        out.write(" */\n\n#ifndef _THERM_LUT_H\n#define _THERM_LUT_H\n\n")
+        out.write("#include <stdint.h>\n#include \"therm_curve.h\"\n\n")
+        out.write("/**\n * @brief Temperatures in centidegrees C of ADC codes code_min + (i << THERM_LUT_SHIFT).\n */\n")
+        out.write("typedef struct {\n\tint16_t code_min;\n\tuint16_t len;\n\tconst int16_t *centi_c;\n} therm_lut_t;\n\n")
+        for table in tables:
+            out.write("/* %.0f V divider */\nextern const therm_lut_t therm_lut_%s;\n" %
+                      (table.supply, table.name))
+        out.write("\n#endif\n")
+
+    with open(os.path.join(out_dir, "therm_lut.c"), "w") as out:
+        out.write("/* Generated by scripts/gen_therm_lut.py from therm_curve.h, do not edit. */\n\n")
+        out.write("#include \"therm_lut.h\"\n")
+        for table in tables:
+            out.write("\nstatic const int16_t %s_centi_c[%d] = {\n" % (table.name, len(table.nodes)))
+            for i in range(0, len(table.nodes), 8):
+                out.write("\t" + " ".join("%d," % n for n in table.nodes[i:i + 8]) + "\n")
+            out.write("};\n\n")
+            out.write("const therm_lut_t therm_lut_%s = { .code_min = %d,\n" % (table.name, table.code_min))
+            out.write("\t\t\t\t.len = %d,\n" % len(table.nodes))
+            out.write("\t\t\t\t.centi_c = %s_centi_c };\n" % table.name)
+
+    print("\n".join(report))
+
+
+if __name__ == "__main__":
+    main()